@@ -0,0 +1,426 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <algorithm>
+//Uses APIs newer than dist\include, so it builds against the sources
+#include "..\src\XnCv\xncv.hpp"
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+//-----------------------------------------------------------------------------
+//	Allocation counting. Only allocations made through operator new are
+//	seen; OpenCV matrices use their own allocator.
+//-----------------------------------------------------------------------------
+namespace
+{
+	volatile long allocations = 0;
+
+	inline void countAllocation()
+	{
+#if defined(_WIN32)
+		InterlockedIncrement(&allocations);
+#else
+		__sync_fetch_and_add(&allocations, 1);
+#endif
+	}
+}
+
+void* operator new(size_t size)
+{
+	countAllocation();
+	void* p = malloc(size == 0 ? 1 : size);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) throw()
+{
+	free(p);
+}
+
+//-----------------------------------------------------------------------------
+//	Benchmark runner
+//-----------------------------------------------------------------------------
+const int DEPTH_COLS = 640;
+const int DEPTH_ROWS = 480;
+const int Z_RES = 10000;
+const int SKELETON_FRAMES = 300;
+const char* SKELETON_FILE = "benchmark.skl";
+const double FLOOR_HEIGHT = 1000.0;
+
+struct Result
+{
+	std::string name;
+	std::string unit;
+	int iterations;
+	int items;       //Work items processed by each iteration
+	double mean;     //Microseconds per item
+	double median;
+	double minimum;
+	double allocations; //Per item
+};
+
+bool json = false;
+double minSeconds = 1.0;
+std::vector<Result> results;
+
+XnUInt64 now()
+{
+	XnUInt64 timestamp = 0;
+	xnOSGetHighResTimeStamp(&timestamp);
+	return timestamp;
+}
+
+void run(const std::string& name, const std::string& unit, int items, const std::function<void()>& body)
+{
+	//Warm up caches and lazy initializations
+	for (int i = 0; i < 3; ++i)
+		body();
+
+	std::vector<double> times;
+	long allocationsBefore = allocations;
+	XnUInt64 start = now();
+	do
+	{
+		XnUInt64 begin = now();
+		body();
+		times.push_back(static_cast<double>(now() - begin) / items);
+	} while (times.size() < 5 || (now() - start) < minSeconds * 1000000.0);
+	long allocated = allocations - allocationsBefore;
+
+	std::sort(times.begin(), times.end());
+	double sum = 0;
+	for (unsigned i = 0; i < times.size(); ++i)
+		sum += times[i];
+
+	Result result;
+	result.name = name;
+	result.unit = unit;
+	result.iterations = static_cast<int>(times.size());
+	result.items = items;
+	result.mean = sum / times.size();
+	result.median = times[times.size() / 2];
+	result.minimum = times[0];
+	result.allocations = static_cast<double>(allocated) / (static_cast<double>(items) * times.size());
+	results.push_back(result);
+
+	if (!json)
+		std::cerr << "  " << name << std::endl;
+}
+
+void report()
+{
+	if (json)
+	{
+		std::cout << "[" << std::endl;
+		for (unsigned i = 0; i < results.size(); ++i)
+		{
+			const Result& r = results[i];
+			double throughput = r.mean > 0 ? 1000000.0 / r.mean : 0.0;
+			std::cout << "  {\"name\": \"" << r.name << "\", \"unit\": \"" << r.unit
+				<< "\", \"iterations\": " << r.iterations << ", \"items\": " << r.items
+				<< ", \"mean_us\": " << r.mean << ", \"median_us\": " << r.median
+				<< ", \"min_us\": " << r.minimum << ", \"per_second\": " << throughput
+				<< ", \"allocations\": " << r.allocations << "}"
+				<< (i + 1 < results.size() ? "," : "") << std::endl;
+		}
+		std::cout << "]" << std::endl;
+		return;
+	}
+
+	std::cout << std::left << std::setw(28) << "benchmark" << std::right
+		<< std::setw(12) << "mean us" << std::setw(12) << "median us" << std::setw(12) << "min us"
+		<< std::setw(14) << "per second" << std::setw(10) << "allocs" << "  unit" << std::endl;
+	for (unsigned i = 0; i < results.size(); ++i)
+	{
+		const Result& r = results[i];
+		double throughput = r.mean > 0 ? 1000000.0 / r.mean : 0.0;
+		std::cout << std::left << std::setw(28) << r.name << std::right << std::fixed << std::setprecision(3)
+			<< std::setw(12) << r.mean << std::setw(12) << r.median << std::setw(12) << r.minimum
+			<< std::setprecision(1) << std::setw(14) << throughput
+			<< std::setprecision(2) << std::setw(10) << r.allocations << "  " << r.unit << std::endl;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//	Synthetic data
+//-----------------------------------------------------------------------------
+cv::Mat syntheticDepth()
+{
+	//A tilted floor with a few boxes, noise and invalid pixels
+	cv::Mat depth(DEPTH_ROWS, DEPTH_COLS, CV_16U);
+	unsigned seed = 12345;
+	for (int y = 0; y < depth.rows; ++y)
+	{
+		ushort* row = depth.ptr<ushort>(y);
+		for (int x = 0; x < depth.cols; ++x)
+		{
+			seed = seed * 1103515245 + 12345;
+			int value = 4000 - y * 5;
+			if ((x / 80 + y / 60) % 3 == 0)
+				value = 1500 + (x % 80) * 4;
+			value += static_cast<int>((seed >> 16) % 16);
+			row[x] = (seed >> 8) % 23 == 0 ? 0 : static_cast<ushort>(value);
+		}
+	}
+	return depth;
+}
+
+void syntheticSnapshot(xncv::SkeletonSnapshot& snapshot, int frame)
+{
+	snapshot.clear();
+	snapshot.frame = frame;
+	snapshot.timestamp = static_cast<XnUInt64>(frame) * 33333;
+	for (int u = 0; u < 2; ++u)
+	{
+		int slot = snapshot.addUser(u + 1);
+		for (int j = XN_SKEL_HEAD; j <= xncv::MAX_JOINTS; ++j)
+		{
+			XnSkeletonJointTransformation joint;
+			memset(&joint, 0, sizeof(joint));
+			joint.position.position.X = 100.0f * j + 3.0f * frame + 500.0f * u;
+			joint.position.position.Y = 50.0f * j - 2.0f * frame;
+			joint.position.position.Z = 2500.0f + 10.0f * u + frame % 20;
+			joint.position.fConfidence = 1.0f;
+			joint.orientation.orientation.elements[0] = 1.0f;
+			joint.orientation.orientation.elements[4] = 1.0f;
+			joint.orientation.orientation.elements[8] = 1.0f;
+			joint.orientation.fConfidence = j % 2 ? 1.0f : 0.0f;
+			snapshot.setJoint(slot, static_cast<XnSkeletonJoint>(j), joint);
+
+			int i = xncv::SkeletonSnapshot::index(slot, static_cast<XnSkeletonJoint>(j));
+			snapshot.projectiveX[i] = 320 + j + frame % 50;
+			snapshot.projectiveY[i] = 240 - j;
+		}
+	}
+}
+
+xncv::Intrinsics syntheticIntrinsics()
+{
+	//Kinect depth camera, 58 x 45 degrees field of view
+	xncv::Intrinsics intrinsics;
+	intrinsics.xRes = DEPTH_COLS;
+	intrinsics.yRes = DEPTH_ROWS;
+	intrinsics.xzFactor = 1.1108f;
+	intrinsics.yzFactor = 0.8284f;
+	return intrinsics;
+}
+
+cv::Mat syntheticRoom(const xncv::Intrinsics& intrinsics)
+{
+	//Level sensor FLOOR_HEIGHT mm above the floor, a wall 4 m away and a
+	//table top 700 mm high, ray traced without noise
+	cv::Mat depth(DEPTH_ROWS, DEPTH_COLS, CV_16U);
+	for (int y = 0; y < depth.rows; ++y)
+	{
+		ushort* row = depth.ptr<ushort>(y);
+		double down = (static_cast<double>(y) / depth.rows - 0.5) * intrinsics.yzFactor;
+		for (int x = 0; x < depth.cols; ++x)
+		{
+			double z = 4000.0;
+			if (down > 0.0)
+			{
+				z = std::min(z, FLOOR_HEIGHT / down);
+				double table = (FLOOR_HEIGHT - 700.0) / down;
+				if (x > 250 && x < 400 && table > 2000.0 && table < 2600.0)
+					z = std::min(z, table);
+			}
+			row[x] = static_cast<ushort>(z + 0.5);
+		}
+	}
+	return depth;
+}
+
+void writeSkeletons(bool compressed)
+{
+	xncv::SkeletonWriter writer;
+	writer.setIntrinsics(syntheticIntrinsics());
+	writer.setCompression(compressed);
+	writer.open(SKELETON_FILE);
+
+	xncv::SkeletonSnapshot snapshot;
+	for (int frame = 0; frame < SKELETON_FRAMES; ++frame)
+	{
+		syntheticSnapshot(snapshot, frame);
+		writer.writeFrame(snapshot);
+	}
+	writer.close();
+}
+
+//-----------------------------------------------------------------------------
+//	Benchmarks
+//-----------------------------------------------------------------------------
+void depthBenchmarks()
+{
+	const int pixels = DEPTH_ROWS * DEPTH_COLS;
+	cv::Mat depth = syntheticDepth();
+	cv::Mat hist = xncv::calcDepthHist(depth, Z_RES);
+	volatile int sink = 0;
+
+	run("cvtDepthTo8UDist", "frame", 1, [&]() { sink += xncv::cvtDepthTo8UDist(depth).data[0]; });
+	run("cvtDepthTo8UDist_zRes", "frame", 1, [&]() { sink += xncv::cvtDepthTo8UDist(depth, Z_RES).data[0]; });
+	run("calcDepthHist", "frame", 1, [&]() { sink += xncv::calcDepthHist(depth, Z_RES).rows; });
+	run("cvtDepthTo8UHist", "frame", 1, [&]() { sink += xncv::cvtDepthTo8UHist(depth, hist).data[0]; });
+	run("histogramImage", "frame", 1, [&]() { sink += xncv::histogramImage(hist, 480, true, true).cols; });
+
+	xncv::DepthFilter filter;
+	run("DepthFilter", "frame", 1, [&]() { sink += filter.apply(depth).ptr<ushort>(0)[0]; });
+	xncv::DepthFilterParams serialParams;
+	serialParams.parallel = false;
+	xncv::DepthFilter serialFilter(serialParams);
+	run("DepthFilter_serial", "frame", 1, [&]() { sink += serialFilter.apply(depth).ptr<ushort>(0)[0]; });
+
+	xncv::BackgroundModel model;
+	model.apply(depth);
+	run("BackgroundModel", "frame", 1, [&]() { sink += model.apply(depth).data[0]; });
+
+	cv::Mat mask;
+	cv::inRange(depth, cv::Scalar(1), cv::Scalar(2499), mask);
+	xncv::BlobLabeller labeller;
+	labeller.setIntrinsics(syntheticIntrinsics());
+	run("BlobLabeller", "frame", 1, [&]() { sink += static_cast<int>(labeller.apply(mask, depth).size()); });
+
+	xncv::DepthIntegral integral(depth);
+	run("DepthIntegral", "frame", 1, [&]() { integral.compute(depth); sink += integral.count(cv::Rect(0, 0, 64, 64)); });
+	run("DepthIntegral_stats", "zone", 100, [&]() {
+		float sum = 0.0f;
+		for (int i = 0; i < 100; ++i)
+			sum += integral.stats(cv::Rect(i * 5, i * 3, 80, 60)).mean;
+		sink += static_cast<int>(sum);
+	});
+
+	xncv::NormalEstimator normals(syntheticIntrinsics());
+	run("NormalEstimator", "frame", 1, [&]() { sink += normals.compute(depth).rows; });
+	xncv::FloorPlane floor;
+	run("estimateFloor", "frame", 1, [&]() { sink += normals.estimateFloor(floor) ? floor.support : 0; });
+
+	run("forEach_sum", "pixel", pixels, [&]() {
+		unsigned long long sum = 0;
+		xncv::forEach<ushort>(depth, [&sum](const cv::Point&, const ushort& d) { sum += d; });
+		sink += static_cast<int>(sum);
+	});
+
+	xncv::Intrinsics intrinsics = syntheticIntrinsics();
+	run("projectiveToWorld", "pixel", pixels, [&]() {
+		float sum = 0;
+		xncv::forEach<ushort>(depth, [&](const cv::Point& p, const ushort& d) {
+			sum += xncv::projectiveToWorld(cv::Point(p.x % DEPTH_COLS, p.x / DEPTH_COLS), d, intrinsics).X;
+		});
+		sink += static_cast<int>(sum);
+	});
+
+	run("worldToProjective", "pixel", pixels, [&]() {
+		int sum = 0;
+		xncv::forEach<ushort>(depth, [&](const cv::Point& p, const ushort& d) {
+			XnPoint3D point = {static_cast<float>(p.x % 1000) - 500.0f, 100.0f, static_cast<float>(d)};
+			sum += xncv::worldToProjective(point, intrinsics).x;
+		});
+		sink += sum;
+	});
+}
+
+void skeletonBenchmarks()
+{
+	const char* names[2][2] = {{"skeleton_write", "skeleton_read"},
+		{"skeleton_write_compressed", "skeleton_read_compressed"}};
+	volatile int sink = 0;
+
+	for (int compressed = 0; compressed < 2; ++compressed)
+	{
+		run(names[compressed][0], "frame", SKELETON_FRAMES, [&]() { writeSkeletons(compressed != 0); });
+
+		writeSkeletons(compressed != 0);
+		run(names[compressed][1], "frame", SKELETON_FRAMES, [&]() {
+			xncv::SkeletonReader reader;
+			reader.open(SKELETON_FILE, false);
+			xncv::SkeletonSnapshot snapshot;
+			for (int frame = 0; frame < reader.frameCount(); ++frame)
+				if (reader.getSnapshot(frame, snapshot))
+					sink += snapshot.userCount;
+		});
+	}
+	remove(SKELETON_FILE);
+}
+
+//-----------------------------------------------------------------------------
+//	Accuracy checks, on scenes with a known answer
+//-----------------------------------------------------------------------------
+bool check(const std::string& name, bool passed, const std::string& detail)
+{
+	std::cerr << "  check " << name << ": " << (passed ? "ok" : "FAILED") << " (" << detail << ")" << std::endl;
+	return passed;
+}
+
+bool floorCheck()
+{
+	xncv::Intrinsics intrinsics = syntheticIntrinsics();
+	xncv::NormalEstimator estimator(intrinsics);
+	estimator.compute(syntheticRoom(intrinsics));
+
+	xncv::FloorPlane floor;
+	if (!estimator.estimateFloor(floor))
+		return check("estimateFloor", false, "no floor found");
+
+	//The floor is level, so its normal is (0, 1, 0) and its offset the height
+	const double PI = 3.14159265358979;
+	double tilt = acos(std::min(1.0, static_cast<double>(floor.normal.Y))) * 180.0 / PI;
+	double error = floor.offset - FLOOR_HEIGHT;
+	char detail[128];
+	sprintf(detail, "offset error %.1f mm, tilt %.2f degrees", error, tilt);
+	return check("estimateFloor", fabs(error) <= 5.0 && tilt <= 1.0, detail);
+}
+
+int main(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-json") == 0)
+			json = true;
+		else if (strcmp(argv[i], "-time") == 0 && i + 1 < argc)
+			minSeconds = atof(argv[++i]);
+		else
+		{
+			std::cout << "Usage: benchmark [-json] [-time <seconds per benchmark>]" << std::endl;
+			return 1;
+		}
+	}
+
+	bool passed = true;
+	try
+	{
+		passed = floorCheck();
+		depthBenchmarks();
+		skeletonBenchmarks();
+		report();
+	}
+	catch (std::exception& e)
+	{
+		//Show error and leave
+		std::cout << "Some problems have occurred:" << std::endl;
+		std::cout << e.what() << std::endl;
+		return 2;
+	}
+
+	return passed ? 0 : 3;
+}
@@ -0,0 +1,122 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+//Uses APIs newer than dist\include, so it builds against the sources
+#include "..\src\XnCv\xncv.hpp"
+
+//-----------------------------------------------------------------------------
+//	Command line tool to edit skeleton files without a device
+//-----------------------------------------------------------------------------
+void usage()
+{
+	std::cout << "Usage:" << std::endl;
+	std::cout << "  skltool info <input>" << std::endl;
+	std::cout << "  skltool convert [options] <input> <output>" << std::endl;
+	std::cout << "  skltool slice [options] <input> <output> <first> <last>" << std::endl;
+	std::cout << "  skltool downsample [options] <input> <output> <factor>" << std::endl;
+	std::cout << "  skltool merge [options] <output> <input> [<input> ...]" << std::endl;
+	std::cout << "Options:" << std::endl;
+	std::cout << "  -compress      Writes the compressed encoding" << std::endl;
+	std::cout << "  -step <mm>     Position quantization step of compressed files" << std::endl;
+	std::cout << "  -noprojective  Stores intrinsics instead of projective coordinates" << std::endl;
+}
+
+void info(const std::string& fileName)
+{
+	xncv::SkeletonReader reader;
+	reader.open(fileName);
+
+	//Frames without a record have no timestamp
+	int recorded = 0;
+	XnUInt64 first = 0;
+	XnUInt64 last = 0;
+	for (int frame = 0; frame < reader.frameCount(); ++frame)
+	{
+		XnUInt64 timestamp = reader.getTimestamp(frame);
+		if (timestamp != 0 || !reader.getUsers(frame).empty())
+			++recorded;
+		if (timestamp == 0)
+			continue;
+		if (first == 0)
+			first = timestamp;
+		last = timestamp;
+	}
+
+	std::cout << fileName << std::endl;
+	std::cout << "  Version:     " << reader.getVersion() << std::endl;
+	std::cout << "  Compressed:  " << (reader.isCompressed() ? "yes" : "no") << std::endl;
+	std::cout << "  Intrinsics:  " << (reader.hasIntrinsics() ? "yes" : "no") << std::endl;
+	std::cout << "  Frames:      " << reader.frameCount() << std::endl;
+	std::cout << "  With data:   " << recorded << std::endl;
+	if (first != 0)
+	{
+		double seconds = (last - first) / 1000000.0;
+		std::cout << "  Duration:    " << seconds << "s" << std::endl;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		usage();
+		return 1;
+	}
+
+	//Splits options from the positional arguments
+	xncv::ConvertOptions options;
+	std::vector<std::string> args;
+	for (int i = 2; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-compress") == 0)
+			options.compressed = true;
+		else if (strcmp(argv[i], "-noprojective") == 0)
+			options.storeProjective = false;
+		else if (strcmp(argv[i], "-step") == 0 && i + 1 < argc)
+			options.codec.positionStep = static_cast<float>(atof(argv[++i]));
+		else
+			args.push_back(argv[i]);
+	}
+
+	try
+	{
+		std::string command = argv[1];
+		if (command == "info" && args.size() == 1)
+			info(args[0]);
+		else if (command == "convert" && args.size() == 2)
+			xncv::convertSkeletons(args[0], args[1], options);
+		else if (command == "slice" && args.size() == 4)
+			xncv::sliceSkeletons(args[0], args[1], atoi(args[2].c_str()), atoi(args[3].c_str()), options);
+		else if (command == "downsample" && args.size() == 3)
+			xncv::downsampleSkeletons(args[0], args[1], atoi(args[2].c_str()), options);
+		else if (command == "merge" && args.size() >= 2)
+			xncv::mergeSkeletons(std::vector<std::string>(args.begin() + 1, args.end()), args[0], options);
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+	catch (std::exception& e)
+	{
+		//Show error and leave
+		std::cout << "Some problems have occurred:" << std::endl;
+		std::cout << e.what() << std::endl;
+		return 2;
+	}
+
+	return 0;
+}
@@ -0,0 +1,292 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "background.hpp"
+#include "threading.hpp"
+#include "profiler.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	//Weight a mixture mode needs to be taken as background
+	const float MIN_BACKGROUND_WEIGHT = 0.25f;
+
+#if defined(XNCV_SSE2)
+	inline __m128i load(const ushort* p)
+	{
+		return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	}
+
+	inline __m128i select(__m128i mask, __m128i a, __m128i b)
+	{
+		return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+	}
+
+	//Valid and either unknown background or closer than threshold
+	inline __m128i foreground(__m128i d, __m128i bg, __m128i threshold)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		__m128i inside = _mm_cmpeq_epi16(_mm_subs_epu16(_mm_subs_epu16(bg, d), threshold), zero);
+		__m128i background = _mm_or_si128(_mm_cmpeq_epi16(d, zero), _mm_andnot_si128(_mm_cmpeq_epi16(bg, zero), inside));
+		return _mm_xor_si128(background, _mm_cmpeq_epi16(zero, zero));
+	}
+#endif
+
+	void maskRow(const ushort* d, const ushort* bg, uchar* mask, int cols, ushort threshold)
+	{
+		int x = 0;
+#if defined(XNCV_SSE2)
+		const __m128i limit = _mm_set1_epi16(static_cast<short>(threshold));
+		for (; x + 16 <= cols; x += 16)
+		{
+			__m128i lo = foreground(load(d + x), load(bg + x), limit);
+			__m128i hi = foreground(load(d + x + 8), load(bg + x + 8), limit);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(mask + x), _mm_packs_epi16(lo, hi));
+		}
+#endif
+		for (; x < cols; ++x)
+		{
+			bool fg = d[x] != 0 && (bg[x] == 0 || bg[x] - d[x] > threshold);
+			mask[x] = fg ? 255 : 0;
+		}
+	}
+
+	//rate is a 0.16 fixed point fraction. Closer depths are approached by
+	//at least 1mm per frame, so the background always converges.
+	void farthestRow(const ushort* d, ushort* bg, int cols, int rate)
+	{
+		int minStep = rate > 0 ? 1 : 0;
+		int x = 0;
+#if defined(XNCV_SSE2)
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i rv = _mm_set1_epi16(static_cast<short>(rate));
+		const __m128i mv = _mm_set1_epi16(static_cast<short>(minStep));
+		for (; x + 8 <= cols; x += 8)
+		{
+			__m128i dv = load(d + x);
+			__m128i bv = load(bg + x);
+			__m128i diff = _mm_subs_epu16(bv, dv);
+			__m128i step = _mm_mulhi_epu16(diff, rv);
+			__m128i small = _mm_andnot_si128(_mm_cmpeq_epi16(diff, zero), _mm_cmpeq_epi16(step, zero));
+			step = _mm_add_epi16(step, _mm_and_si128(small, mv));
+			__m128i learned = _mm_add_epi16(_mm_sub_epi16(bv, step), _mm_subs_epu16(dv, bv));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(bg + x), select(_mm_cmpeq_epi16(dv, zero), bv, learned));
+		}
+#endif
+		for (; x < cols; ++x)
+		{
+			if (d[x] == 0)
+				continue;
+			if (d[x] >= bg[x])
+			{
+				bg[x] = d[x];
+				continue;
+			}
+
+			int diff = bg[x] - d[x];
+			int step = (diff * rate) >> 16;
+			bg[x] = static_cast<ushort>(bg[x] - (step == 0 ? minStep : step));
+		}
+	}
+
+	void medianRow(const ushort* d, ushort* bg, int cols, ushort maxStep)
+	{
+		int x = 0;
+#if defined(XNCV_SSE2)
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i sv = _mm_set1_epi16(static_cast<short>(maxStep));
+		for (; x + 8 <= cols; x += 8)
+		{
+			__m128i dv = load(d + x);
+			__m128i bv = load(bg + x);
+
+			//min(a, step) is a - max(a - step, 0), without SSE4 unsigned min
+			__m128i up = _mm_subs_epu16(dv, bv);
+			__m128i down = _mm_subs_epu16(bv, dv);
+			up = _mm_sub_epi16(up, _mm_subs_epu16(up, sv));
+			down = _mm_sub_epi16(down, _mm_subs_epu16(down, sv));
+			__m128i learned = select(_mm_cmpeq_epi16(bv, zero), dv, _mm_sub_epi16(_mm_add_epi16(bv, up), down));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(bg + x), select(_mm_cmpeq_epi16(dv, zero), bv, learned));
+		}
+#endif
+		for (; x < cols; ++x)
+		{
+			if (d[x] == 0)
+				continue;
+			if (bg[x] == 0)
+				bg[x] = d[x];
+			else if (d[x] > bg[x])
+				bg[x] = static_cast<ushort>(bg[x] + std::min<int>(d[x] - bg[x], maxStep));
+			else
+				bg[x] = static_cast<ushort>(bg[x] - std::min<int>(bg[x] - d[x], maxStep));
+		}
+	}
+
+	//Each pixel keeps two modes as (mean, weight, mean, weight)
+	void mixtureRow(const ushort* d, ushort* bg, float* modes, int cols, float rate, float threshold)
+	{
+		for (int x = 0; x < cols; ++x, modes += 4)
+		{
+			if (d[x] != 0)
+			{
+				float z = static_cast<float>(d[x]);
+				int match = -1;
+				float best = threshold;
+				for (int i = 0; i < 2; ++i)
+				{
+					float distance = fabs(z - modes[2 * i]);
+					if (modes[2 * i + 1] > 0.0f && distance <= best)
+					{
+						best = distance;
+						match = i;
+					}
+				}
+
+				modes[1] *= 1.0f - rate;
+				modes[3] *= 1.0f - rate;
+				if (match == -1)
+				{
+					//Replaces the weakest mode
+					match = modes[1] <= modes[3] ? 0 : 1;
+					modes[2 * match] = z;
+					modes[2 * match + 1] = rate;
+				}
+				else
+				{
+					float& weight = modes[2 * match + 1];
+					weight += rate;
+					modes[2 * match] += (z - modes[2 * match]) * std::min(1.0f, rate / weight);
+				}
+			}
+
+			int b = -1;
+			if (modes[1] >= MIN_BACKGROUND_WEIGHT && modes[3] >= MIN_BACKGROUND_WEIGHT)
+				b = modes[0] >= modes[2] ? 0 : 1;
+			else if (modes[1] > 0.0f || modes[3] > 0.0f)
+				b = modes[1] >= modes[3] ? 0 : 1;
+			bg[x] = b == -1 ? 0 : static_cast<ushort>(modes[2 * b] + 0.5f);
+		}
+	}
+}
+
+xncv::BackgroundParams::BackgroundParams(BackgroundMode backgroundMode)
+	: mode(backgroundMode), learningRate(0.01f), medianStep(4), threshold(100), freeze(false), parallel(false)
+{
+}
+
+xncv::BackgroundModel::BackgroundModel(const BackgroundParams& modelParams)
+	: params(modelParams), frames(0)
+{
+}
+
+const xncv::BackgroundParams& xncv::BackgroundModel::getParams() const
+{
+	return params;
+}
+
+void xncv::BackgroundModel::setParams(const BackgroundParams& modelParams)
+{
+	if (modelParams.mode != params.mode)
+		reset();
+	params = modelParams;
+}
+
+void xncv::BackgroundModel::setFrozen(bool freeze)
+{
+	params.freeze = freeze;
+}
+
+bool xncv::BackgroundModel::isFrozen() const
+{
+	return params.freeze;
+}
+
+void xncv::BackgroundModel::reset()
+{
+	frames = 0;
+	background.release();
+	modes.release();
+}
+
+void xncv::BackgroundModel::init(const cv::Mat& depth)
+{
+	depth.copyTo(background);
+	mask = cv::Mat::zeros(depth.size(), CV_8U);
+	frames = 1;
+	if (params.mode != BACKGROUND_MIXTURE)
+		return;
+
+	modes = cv::Mat::zeros(depth.rows, depth.cols, CV_32FC4);
+	for (int y = 0; y < depth.rows; ++y)
+	{
+		const ushort* d = depth.ptr<ushort>(y);
+		float* m = modes.ptr<float>(y);
+		for (int x = 0; x < depth.cols; ++x, m += 4)
+		{
+			m[0] = static_cast<float>(d[x]);
+			m[1] = d[x] != 0 ? 1.0f : 0.0f;
+		}
+	}
+}
+
+void xncv::BackgroundModel::update(const cv::Mat& depth)
+{
+	float rate = std::max(0.0f, std::min(params.learningRate, 1.0f));
+	int fixedRate = std::min(static_cast<int>(rate * 65536.0f + 0.5f), 65535);
+	parallelTiles(depth.rows, params.parallel, [&](int first, int last) {
+		for (int y = first; y < last; ++y)
+		{
+			const ushort* d = depth.ptr<ushort>(y);
+			ushort* bg = background.ptr<ushort>(y);
+			if (params.mode == BACKGROUND_FARTHEST)
+				farthestRow(d, bg, depth.cols, fixedRate);
+			else if (params.mode == BACKGROUND_MEDIAN)
+				medianRow(d, bg, depth.cols, params.medianStep);
+			else
+				mixtureRow(d, bg, modes.ptr<float>(y), depth.cols, rate, params.threshold);
+		}
+	});
+	++frames;
+}
+
+const cv::Mat& xncv::BackgroundModel::apply(const cv::Mat& depth)
+{
+	XNCV_PROFILE_SCOPE("BackgroundModel::apply");
+	if (frames == 0 || depth.size() != background.size())
+	{
+		init(depth);
+		return mask;
+	}
+
+	mask.create(depth.size(), CV_8U);
+	parallelTiles(depth.rows, params.parallel, [&](int first, int last) {
+		for (int y = first; y < last; ++y)
+			maskRow(depth.ptr<ushort>(y), background.ptr<ushort>(y), mask.ptr<uchar>(y), depth.cols, params.threshold);
+	});
+
+	if (!params.freeze)
+		update(depth);
+	return mask;
+}
+
+const cv::Mat& xncv::BackgroundModel::getBackground() const
+{
+	return background;
+}
+
+int xncv::BackgroundModel::getFrames() const
+{
+	return frames;
+}
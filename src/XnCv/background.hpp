@@ -0,0 +1,85 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__BACKGROUND_HPP__)
+#define __BACKGROUND_HPP__
+
+#include "functions.hpp"
+
+namespace xncv
+{
+	//How the background depth of each pixel is learned:
+	//- FARTHEST: jumps to farther measurements, approaches closer ones at
+	//  the learning rate. A running minimum of disparity.
+	//- MEDIAN: approximate median, moves at most medianStep mm per frame.
+	//- MIXTURE: two depth modes per pixel, for surfaces that alternate
+	//  between two depths. The background is the farthest mode with enough
+	//  weight.
+	enum BackgroundMode {BACKGROUND_FARTHEST, BACKGROUND_MEDIAN, BACKGROUND_MIXTURE};
+
+	struct BackgroundParams
+	{
+		BackgroundMode mode;
+
+		//Fraction of the distance to the measurement learned per frame
+		float learningRate;
+		ushort medianStep;
+
+		//Valid pixels this many millimeters closer than the background, or
+		//where no background was seen yet, are foreground
+		ushort threshold;
+
+		//A frozen model only classifies pixels
+		bool freeze;
+
+		//Splits the work in row tiles on the default thread pool
+		bool parallel;
+
+		BackgroundParams(BackgroundMode backgroundMode=BACKGROUND_FARTHEST);
+	};
+
+	//Works on any depth map, so live sensors and recordings are processed
+	//the same way, without a user generator
+	class BackgroundModel
+	{
+		private:
+			BackgroundParams params;
+			cv::Mat background;
+			cv::Mat modes;
+			cv::Mat mask;
+			int frames;
+
+			void init(const cv::Mat& depth);
+			void update(const cv::Mat& depth);
+
+		public:
+			BackgroundModel(const BackgroundParams& params=BackgroundParams());
+
+			const BackgroundParams& getParams() const;
+			void setParams(const BackgroundParams& params);
+			void setFrozen(bool freeze);
+			bool isFrozen() const;
+
+			void reset();
+
+			//Classifies depth against the current model, then learns it.
+			//Returns a CV_8U mask (255 for foreground) owned by the model.
+			const cv::Mat& apply(const cv::Mat& depth);
+
+			//Learned background depth, 0 where it is still unknown
+			const cv::Mat& getBackground() const;
+			int getFrames() const;
+	};
+}
+
+#endif
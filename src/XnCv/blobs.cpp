@@ -0,0 +1,387 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "blobs.hpp"
+#include "threading.hpp"
+#include "profiler.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+	inline bool joins(ushort a, ushort b, int maxStep)
+	{
+		return maxStep == 0 || a == 0 || b == 0 || abs(a - b) <= maxStep;
+	}
+
+	inline int find(int* parent, int label)
+	{
+		while (parent[label] != label)
+		{
+			parent[label] = parent[parent[label]];
+			label = parent[label];
+		}
+		return label;
+	}
+
+	//Links the larger root to the smaller one, so every label points to a
+	//smaller or equal label and a single ascending pass flattens the trees
+	inline int unite(int* parent, int a, int b)
+	{
+		a = find(parent, a);
+		b = find(parent, b);
+		if (a < b)
+		{
+			parent[b] = a;
+			return a;
+		}
+		parent[a] = b;
+		return b;
+	}
+
+	struct Neighbours
+	{
+		const ushort* depth;
+		const int* labels;
+	};
+
+	//Joins label with the neighbour at x, if it is connected
+	inline int connect(int* parent, int label, const Neighbours& n, int x, ushort z, int maxStep)
+	{
+		int other = n.labels[x];
+		if (other == 0 || !joins(z, n.depth ? n.depth[x] : 0, maxStep))
+			return label;
+		return label == 0 ? other : unite(parent, label, other);
+	}
+
+	//First pass of a row tile. Returns the label after the last one used.
+	int labelRows(const cv::Mat& mask, const cv::Mat& depth, cv::Mat& labels, int first, int last,
+		const xncv::BlobParams& params, int* parent, int* count)
+	{
+		int cols = mask.cols;
+		int next = first * cols + 1;
+		int maxStep = params.maxDepthStep;
+#if defined(XNCV_SSE2)
+		const __m128i zero = _mm_setzero_si128();
+#endif
+		for (int y = first; y < last; ++y)
+		{
+			const uchar* m = mask.ptr<uchar>(y);
+			const ushort* d = depth.empty() ? NULL : depth.ptr<ushort>(y);
+			int* l = labels.ptr<int>(y);
+
+			Neighbours left = {d, l};
+			Neighbours up = {NULL, NULL};
+			if (y > first)
+			{
+				up.depth = depth.empty() ? NULL : depth.ptr<ushort>(y - 1);
+				up.labels = labels.ptr<int>(y - 1);
+			}
+
+			int x = 0;
+			while (x < cols)
+			{
+#if defined(XNCV_SSE2)
+				//Skips background 16 pixels at a time
+				if (x + 16 <= cols)
+				{
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m + x));
+					if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) == 0xFFFF)
+					{
+						memset(l + x, 0, 16 * sizeof(int));
+						x += 16;
+						continue;
+					}
+				}
+#endif
+				int end = std::min(x + 16, cols);
+				for (; x < end; ++x)
+				{
+					if (m[x] == 0)
+					{
+						l[x] = 0;
+						continue;
+					}
+
+					ushort z = d ? d[x] : 0;
+					int label = 0;
+					if (x > 0)
+						label = connect(parent, label, left, x - 1, z, maxStep);
+					if (up.labels)
+					{
+						label = connect(parent, label, up, x, z, maxStep);
+						if (params.eightConnected)
+						{
+							if (x > 0)
+								label = connect(parent, label, up, x - 1, z, maxStep);
+							if (x + 1 < cols)
+								label = connect(parent, label, up, x + 1, z, maxStep);
+						}
+					}
+
+					if (label == 0)
+					{
+						label = next++;
+						parent[label] = label;
+						count[label] = 0;
+					}
+					l[x] = label;
+					++count[label];
+				}
+			}
+		}
+		return next;
+	}
+
+	struct Accumulator
+	{
+		int minX, minY, maxX, maxY;
+		int area, valid;
+		long long sumX, sumY;
+		unsigned long long depthSum;
+		double sumXZ, sumYZ;
+
+		void reset()
+		{
+			minX = minY = INT_MAX;
+			maxX = maxY = -1;
+			area = valid = 0;
+			sumX = sumY = 0;
+			depthSum = 0;
+			sumXZ = sumYZ = 0.0;
+		}
+
+		void merge(const Accumulator& other)
+		{
+			if (other.area == 0)
+				return;
+			minX = std::min(minX, other.minX);
+			minY = std::min(minY, other.minY);
+			maxX = std::max(maxX, other.maxX);
+			maxY = std::max(maxY, other.maxY);
+			area += other.area;
+			valid += other.valid;
+			sumX += other.sumX;
+			sumY += other.sumY;
+			depthSum += other.depthSum;
+			sumXZ += other.sumXZ;
+			sumYZ += other.sumYZ;
+		}
+	};
+}
+
+xncv::BlobParams::BlobParams()
+	: maxDepthStep(100), minArea(50), eightConnected(true), parallel(false)
+{
+}
+
+xncv::BlobLabeller::BlobLabeller(const BlobParams& blobParams)
+	: params(blobParams), hasIntrinsics(false)
+{
+}
+
+const xncv::BlobParams& xncv::BlobLabeller::getParams() const
+{
+	return params;
+}
+
+void xncv::BlobLabeller::setParams(const BlobParams& blobParams)
+{
+	params = blobParams;
+}
+
+void xncv::BlobLabeller::setIntrinsics(const Intrinsics& cameraIntrinsics)
+{
+	intrinsics = cameraIntrinsics;
+	hasIntrinsics = true;
+}
+
+int xncv::BlobLabeller::resolve(int cols)
+{
+	//Labels only point to smaller ones, and tiles are visited top to
+	//bottom, so parents are always final when their children are read
+	int* p = &parent[0];
+	for (int y = 0; y < labels.rows; ++y)
+	{
+		if (tileEnd[y] == 0)
+			continue;
+		for (int l = y * cols + 1; l < tileEnd[y]; ++l)
+		{
+			p[l] = p[p[l]];
+			if (p[l] != l)
+				count[p[l]] += count[l];
+		}
+	}
+
+	int blobCount = 0;
+	for (int y = 0; y < labels.rows; ++y)
+	{
+		if (tileEnd[y] == 0)
+			continue;
+		for (int l = y * cols + 1; l < tileEnd[y]; ++l)
+		{
+			if (p[l] != l)
+				remap[l] = remap[p[l]];
+			else
+				remap[l] = count[l] >= params.minArea ? ++blobCount : 0;
+		}
+	}
+	return blobCount;
+}
+
+void xncv::BlobLabeller::computeStats(const cv::Mat& depth, int blobCount)
+{
+	std::vector<Accumulator> total(blobCount + 1);
+	for (unsigned i = 0; i < total.size(); ++i)
+		total[i].reset();
+
+	CriticalSection mutex;
+	const int* r = &remap[0];
+	parallelTiles(labels.rows, params.parallel, [&](int first, int last) {
+		std::vector<Accumulator> acc(blobCount + 1);
+		for (unsigned i = 0; i < acc.size(); ++i)
+			acc[i].reset();
+
+		for (int y = first; y < last; ++y)
+		{
+			int* l = labels.ptr<int>(y);
+			const ushort* d = depth.empty() ? NULL : depth.ptr<ushort>(y);
+			for (int x = 0; x < labels.cols; ++x)
+			{
+				if (l[x] == 0)
+					continue;
+
+				int label = r[l[x]];
+				l[x] = label;
+				if (label == 0)
+					continue;
+
+				Accumulator& a = acc[label];
+				if (x < a.minX) a.minX = x;
+				if (x > a.maxX) a.maxX = x;
+				if (y < a.minY) a.minY = y;
+				a.maxY = y;
+				++a.area;
+				a.sumX += x;
+				a.sumY += y;
+
+				if (d && d[x] != 0)
+				{
+					++a.valid;
+					a.depthSum += d[x];
+					a.sumXZ += static_cast<double>(x) * d[x];
+					a.sumYZ += static_cast<double>(y) * d[x];
+				}
+			}
+		}
+
+		Lock lock(mutex);
+		for (int i = 1; i <= blobCount; ++i)
+			total[i].merge(acc[i]);
+	});
+
+	blobs.resize(blobCount);
+	for (int i = 1; i <= blobCount; ++i)
+	{
+		const Accumulator& a = total[i];
+		Blob& blob = blobs[i - 1];
+		blob.label = i;
+		blob.bounds = cv::Rect(a.minX, a.minY, a.maxX - a.minX + 1, a.maxY - a.minY + 1);
+		blob.area = a.area;
+		blob.centroid = cv::Point2f(static_cast<float>(static_cast<double>(a.sumX) / a.area),
+			static_cast<float>(static_cast<double>(a.sumY) / a.area));
+		blob.validPixels = a.valid;
+		blob.meanDepth = 0.0f;
+		memset(&blob.center, 0, sizeof(blob.center));
+		if (a.valid == 0)
+			continue;
+
+		//Mean of projectiveToWorld over the valid pixels, in closed form
+		double z = static_cast<double>(a.depthSum) / a.valid;
+		blob.meanDepth = static_cast<float>(z);
+		if (!hasIntrinsics)
+			continue;
+		double xz = intrinsics.xOffset * z + intrinsics.factor * a.sumXZ / a.valid;
+		double yz = intrinsics.yOffset * z + intrinsics.factor * a.sumYZ / a.valid;
+		blob.center.X = static_cast<float>(intrinsics.xzFactor * (xz / intrinsics.xRes - 0.5 * z));
+		blob.center.Y = static_cast<float>(intrinsics.yzFactor * (0.5 * z - yz / intrinsics.yRes));
+		blob.center.Z = static_cast<float>(z);
+	}
+}
+
+const std::vector<xncv::Blob>& xncv::BlobLabeller::apply(const cv::Mat& mask, const cv::Mat& depth)
+{
+	XNCV_PROFILE_SCOPE("BlobLabeller::apply");
+	blobs.clear();
+	labels.create(mask.size(), CV_32S);
+	if (mask.empty())
+		return blobs;
+
+	int cols = mask.cols;
+	size_t size = static_cast<size_t>(mask.rows) * cols + 1;
+	if (parent.size() < size)
+	{
+		parent.resize(size);
+		count.resize(size);
+		remap.resize(size);
+	}
+	tileEnd.assign(mask.rows, 0);
+
+	parallelTiles(mask.rows, params.parallel, [&](int first, int last) {
+		tileEnd[first] = labelRows(mask, depth, labels, first, last, params, &parent[0], &count[0]);
+	});
+
+	//Joins blobs across the tile borders
+	int* p = &parent[0];
+	int maxStep = params.maxDepthStep;
+	for (int y = 1; y < mask.rows; ++y)
+	{
+		if (tileEnd[y] == 0)
+			continue;
+
+		const int* l = labels.ptr<int>(y);
+		Neighbours up = {depth.empty() ? NULL : depth.ptr<ushort>(y - 1), labels.ptr<int>(y - 1)};
+		const ushort* d = depth.empty() ? NULL : depth.ptr<ushort>(y);
+		for (int x = 0; x < cols; ++x)
+		{
+			if (l[x] == 0)
+				continue;
+
+			ushort z = d ? d[x] : 0;
+			connect(p, l[x], up, x, z, maxStep);
+			if (params.eightConnected)
+			{
+				if (x > 0)
+					connect(p, l[x], up, x - 1, z, maxStep);
+				if (x + 1 < cols)
+					connect(p, l[x], up, x + 1, z, maxStep);
+			}
+		}
+	}
+
+	computeStats(depth, resolve(cols));
+	return blobs;
+}
+
+const cv::Mat& xncv::BlobLabeller::getLabels() const
+{
+	return labels;
+}
+
+const std::vector<xncv::Blob>& xncv::BlobLabeller::getBlobs() const
+{
+	return blobs;
+}
@@ -0,0 +1,96 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__BLOBS_HPP__)
+#define __BLOBS_HPP__
+
+#include <vector>
+#include "functions.hpp"
+
+namespace xncv
+{
+	struct BlobParams
+	{
+		//Neighbours join the same blob only if their depths differ by at
+		//most maxDepthStep millimeters, so people at different distances
+		//stay apart. Zero ignores depth. Pixels without depth join anyone.
+		ushort maxDepthStep;
+
+		//Smaller blobs are discarded
+		int minArea;
+
+		bool eightConnected;
+
+		//Splits the work in row tiles on the default thread pool
+		bool parallel;
+
+		BlobParams();
+	};
+
+	struct Blob
+	{
+		//Value of the blob pixels in the labels matrix
+		int label;
+		cv::Rect bounds;
+		int area;
+		cv::Point2f centroid;
+
+		//Depth statistics consider only pixels with valid (non zero) depth
+		int validPixels;
+		float meanDepth;
+
+		//Mean real world position of the valid pixels, in millimeters. Zero
+		//unless intrinsics were given.
+		XnPoint3D center;
+	};
+
+	class BlobLabeller
+	{
+		private:
+			BlobParams params;
+			Intrinsics intrinsics;
+			bool hasIntrinsics;
+
+			cv::Mat labels;
+			std::vector<Blob> blobs;
+
+			//Union-find over provisional labels. Each row tile numbers its
+			//labels from first row * cols + 1, so tiles never share labels.
+			std::vector<int> parent;
+			std::vector<int> count;
+			std::vector<int> remap;
+			std::vector<int> tileEnd;
+
+			int resolve(int cols);
+			void computeStats(const cv::Mat& depth, int blobCount);
+
+		public:
+			BlobLabeller(const BlobParams& params=BlobParams());
+
+			const BlobParams& getParams() const;
+			void setParams(const BlobParams& params);
+
+			//Intrinsics must match the resolution of the masks
+			void setIntrinsics(const Intrinsics& intrinsics);
+
+			//Labels the non zero pixels of a CV_8U mask. The optional CV_16U
+			//depth drives connectivity and the depth statistics.
+			const std::vector<Blob>& apply(const cv::Mat& mask, const cv::Mat& depth=cv::Mat());
+
+			//CV_32S, 0 for background
+			const cv::Mat& getLabels() const;
+			const std::vector<Blob>& getBlobs() const;
+	};
+}
+
+#endif
@@ -0,0 +1,205 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "compositor.hpp"
+#include <climits>
+#include <opencv2\imgproc\imgproc.hpp>
+
+namespace
+{
+	const int DEPTH_VALUES = 65536;
+	const int JOINT_RADIUS = 3;
+	const int OVERLAY_MARGIN = JOINT_RADIUS + 2;
+}
+
+xncv::SceneCompositor::SceneCompositor()
+	: histogram(DEPTH_VALUES, 0), shades(DEPTH_VALUES, 0), hasShades(false),
+	skeletonColor(cv::Scalar::all(255)), confidenceThreshold(0.5f)
+{
+	userColors.push_back(cv::Vec3b(255, 160, 64));
+	userColors.push_back(cv::Vec3b(64, 255, 64));
+	userColors.push_back(cv::Vec3b(64, 64, 255));
+	userColors.push_back(cv::Vec3b(64, 255, 255));
+	userColors.push_back(cv::Vec3b(255, 64, 255));
+	userColors.push_back(cv::Vec3b(255, 255, 64));
+}
+
+void xncv::SceneCompositor::setSkeletonColor(const cv::Scalar& color)
+{
+	skeletonColor = color;
+}
+
+void xncv::SceneCompositor::setUserColors(const std::vector<cv::Vec3b>& colors)
+{
+	if (!colors.empty())
+		userColors = colors;
+}
+
+void xncv::SceneCompositor::setConfidenceThreshold(float threshold)
+{
+	confidenceThreshold = threshold;
+}
+
+void xncv::SceneCompositor::updateShades()
+{
+	//Same distribution used by cvtDepthTo8UHist
+	long long count = 0;
+	for (int i = 1; i < DEPTH_VALUES; ++i)
+		count += histogram[i];
+
+	if (count == 0)
+		return;
+
+	long long accum = 0;
+	shades[0] = 0;
+	for (int i = 1; i < DEPTH_VALUES; ++i)
+	{
+		accum += histogram[i];
+		int value = static_cast<int>(256.0 * (1.0 - static_cast<double>(accum) / count));
+		shades[i] = static_cast<uchar>(value > 255 ? 255 : value);
+	}
+	hasShades = true;
+}
+
+void xncv::SceneCompositor::shade(const cv::Mat& depth, const cv::Mat& labels, const cv::Rect& area, bool accumulate)
+{
+	if (accumulate)
+		std::fill(histogram.begin(), histogram.end(), 0);
+
+	int colors = static_cast<int>(userColors.size());
+	for (int y = area.y; y < area.y + area.height; ++y)
+	{
+		const ushort* d = depth.ptr<ushort>(y) + area.x;
+		const ushort* l = labels.empty() ? NULL : labels.ptr<ushort>(y) + area.x;
+		cv::Vec3b* out = background.ptr<cv::Vec3b>(y) + area.x;
+
+		for (int x = 0; x < area.width; ++x)
+		{
+			if (accumulate)
+				++histogram[d[x]];
+
+			int s = shades[d[x]];
+			if (l && l[x])
+			{
+				const cv::Vec3b& color = userColors[l[x] % colors];
+				out[x] = cv::Vec3b(static_cast<uchar>(s * color[0] >> 8),
+					static_cast<uchar>(s * color[1] >> 8), static_cast<uchar>(s * color[2] >> 8));
+			}
+			else
+				out[x] = cv::Vec3b(static_cast<uchar>(s), static_cast<uchar>(s), static_cast<uchar>(s));
+		}
+	}
+
+	if (accumulate)
+		updateShades();
+}
+
+cv::Rect xncv::SceneCompositor::drawSkeletons(const SkeletonSnapshot& skeletons)
+{
+	bool usedByLimb[MAX_JOINTS + 1] = {false};
+	for (int i = 0; i < MAX_LIMBS; ++i)
+	{
+		usedByLimb[LIMB_JOINTS[i][0]] = true;
+		usedByLimb[LIMB_JOINTS[i][1]] = true;
+	}
+
+	int minX = INT_MAX, minY = INT_MAX, maxX = INT_MIN, maxY = INT_MIN;
+	for (int s = 0; s < skeletons.userCount; ++s)
+	{
+		for (int i = 0; i < MAX_LIMBS; ++i)
+		{
+			int j1 = SkeletonSnapshot::index(s, LIMB_JOINTS[i][0]);
+			int j2 = SkeletonSnapshot::index(s, LIMB_JOINTS[i][1]);
+			if (!skeletons.present[j1] || !skeletons.present[j2])
+				continue;
+
+			float confidence = std::min(skeletons.confidence[j1], skeletons.confidence[j2]);
+			cv::line(output, cv::Point(skeletons.projectiveX[j1], skeletons.projectiveY[j1]),
+				cv::Point(skeletons.projectiveX[j2], skeletons.projectiveY[j2]),
+				skeletonColor, confidence < confidenceThreshold ? 1 : 2);
+		}
+
+		//Each joint is drawn once, even when shared by several limbs
+		for (int joint = XN_SKEL_HEAD; joint <= MAX_JOINTS; ++joint)
+		{
+			int j = SkeletonSnapshot::index(s, static_cast<XnSkeletonJoint>(joint));
+			if (!usedByLimb[joint] || !skeletons.present[j])
+				continue;
+
+			cv::Point p(skeletons.projectiveX[j], skeletons.projectiveY[j]);
+			cv::circle(output, p, JOINT_RADIUS, skeletonColor, -1);
+			minX = std::min(minX, p.x);
+			minY = std::min(minY, p.y);
+			maxX = std::max(maxX, p.x);
+			maxY = std::max(maxY, p.y);
+		}
+	}
+
+	if (minX > maxX)
+		return cv::Rect();
+
+	return cv::Rect(minX - OVERLAY_MARGIN, minY - OVERLAY_MARGIN,
+		maxX - minX + 2 * OVERLAY_MARGIN + 1, maxY - minY + 2 * OVERLAY_MARGIN + 1);
+}
+
+const cv::Mat& xncv::SceneCompositor::compose(const cv::Mat& depth, const cv::Mat& labels,
+	const SkeletonSnapshot& skeletons, const cv::Rect& dirty)
+{
+	CV_Assert(depth.type() == CV_16U);
+	CV_Assert(labels.empty() || (labels.type() == CV_16U && labels.size() == depth.size()));
+
+	bool resized = background.rows != depth.rows || background.cols != depth.cols;
+	if (resized)
+	{
+		background.create(depth.rows, depth.cols, CV_8UC3);
+		output.create(depth.rows, depth.cols, CV_8UC3);
+		overlayArea = cv::Rect();
+	}
+
+	cv::Rect frame(0, 0, depth.cols, depth.rows);
+	cv::Rect area = resized || dirty.area() == 0 ? frame : dirty & frame;
+	bool full = area == frame;
+
+	//The very first frame has no previous histogram to shade with
+	if (!hasShades)
+	{
+		for (int y = 0; y < depth.rows; ++y)
+		{
+			const ushort* d = depth.ptr<ushort>(y);
+			for (int x = 0; x < depth.cols; ++x)
+				++histogram[d[x]];
+		}
+		updateShades();
+	}
+
+	//The histogram is rebuilt only when the whole frame is shaded, so a
+	//partial update keeps the background colors consistent.
+	shade(depth, labels, area, full);
+	cv::Mat target = output(area);
+	background(area).copyTo(target);
+
+	//Erases the skeletons of the last frame
+	if (overlayArea.area() > 0)
+	{
+		target = output(overlayArea);
+		background(overlayArea).copyTo(target);
+	}
+
+	overlayArea = drawSkeletons(skeletons) & frame;
+	return output;
+}
+
+const cv::Mat& xncv::SceneCompositor::getImage() const
+{
+	return output;
+}
@@ -0,0 +1,59 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__COMPOSITOR_HPP__)
+#define __COMPOSITOR_HPP__
+
+#include <vector>
+#include "snapshot.hpp"
+
+namespace xncv
+{
+	//Draws depth shading, user tint and skeletons into a single reusable BGR
+	//image. The depth histogram of each frame shades the next one, so the
+	//whole frame is read only once.
+	class SceneCompositor
+	{
+		private:
+			cv::Mat background;
+			cv::Mat output;
+			cv::Rect overlayArea;
+
+			std::vector<int> histogram;
+			std::vector<uchar> shades;
+			bool hasShades;
+
+			std::vector<cv::Vec3b> userColors;
+			cv::Scalar skeletonColor;
+			float confidenceThreshold;
+
+			void updateShades();
+			void shade(const cv::Mat& depth, const cv::Mat& labels, const cv::Rect& area, bool accumulate);
+			cv::Rect drawSkeletons(const SkeletonSnapshot& skeletons);
+
+		public:
+			SceneCompositor();
+
+			void setSkeletonColor(const cv::Scalar& color);
+			void setUserColors(const std::vector<cv::Vec3b>& colors);
+			void setConfidenceThreshold(float threshold);
+
+			//Only the dirty area of the background is shaded again. An empty
+			//rectangle means the whole frame changed.
+			const cv::Mat& compose(const cv::Mat& depth, const cv::Mat& labels,
+				const SkeletonSnapshot& skeletons, const cv::Rect& dirty=cv::Rect());
+			const cv::Mat& getImage() const;
+	};
+}
+
+#endif
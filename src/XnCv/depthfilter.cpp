@@ -0,0 +1,276 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "depthfilter.hpp"
+#include "threading.hpp"
+#include "profiler.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <vector>
+#include <cstdlib>
+
+namespace
+{
+	//Each pixel takes the closest end. Ties go to the farther depth, since
+	//holes are usually shadows cast by the foreground on the background.
+	inline void fillGap(ushort* p, int stride, int first, int last)
+	{
+		ushort a = p[first * stride];
+		ushort b = p[last * stride];
+		ushort tie = std::max(a, b);
+		for (int i = first + 1; i < last; ++i)
+		{
+			int da = i - first;
+			int db = last - i;
+			p[i * stride] = da < db ? a : (db < da ? b : tie);
+		}
+	}
+
+	void fillRow(const ushort* src, ushort* dst, int cols, int maxHole)
+	{
+#if defined(XNCV_SSE2)
+		const __m128i zero = _mm_setzero_si128();
+#endif
+		int last = -1;
+		int x = 0;
+		while (x < cols)
+		{
+#if defined(XNCV_SSE2)
+			//Copies valid runs 8 pixels at a time, when no gap is pending
+			if (x + 8 <= cols && last == x - 1)
+			{
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), v);
+				if (_mm_movemask_epi8(_mm_cmpeq_epi16(v, zero)) == 0)
+				{
+					x += 8;
+					last = x - 1;
+					continue;
+				}
+			}
+#endif
+			int end = std::min(x + 8, cols);
+			for (; x < end; ++x)
+			{
+				dst[x] = src[x];
+				if (src[x] == 0)
+					continue;
+
+				int gap = x - last - 1;
+				if (last >= 0 && gap > 0 && gap <= maxHole)
+					fillGap(dst, 1, last, x);
+				last = x;
+			}
+		}
+	}
+
+	void fillColumns(cv::Mat& depth, int first, int last, int maxHole)
+	{
+		std::vector<int> lastValid(last - first, -1);
+		ushort* base = depth.ptr<ushort>(0);
+		int stride = static_cast<int>(depth.step1());
+#if defined(XNCV_SSE2)
+		const __m128i zero = _mm_setzero_si128();
+#endif
+		for (int y = 0; y < depth.rows; ++y)
+		{
+			const ushort* row = depth.ptr<ushort>(y);
+			int* valid = &lastValid[0] - first;
+			int x = first;
+			while (x < last)
+			{
+#if defined(XNCV_SSE2)
+				//Valid pixels right below valid pixels only move the marks
+				if (x + 8 <= last)
+				{
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+					__m128i previous = _mm_set1_epi32(y - 1);
+					__m128i l0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(valid + x));
+					__m128i l1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(valid + x + 4));
+					__m128i pending = _mm_and_si128(_mm_cmpeq_epi32(l0, previous), _mm_cmpeq_epi32(l1, previous));
+					if (_mm_movemask_epi8(_mm_cmpeq_epi16(v, zero)) == 0 && _mm_movemask_epi8(pending) == 0xFFFF)
+					{
+						__m128i current = _mm_set1_epi32(y);
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(valid + x), current);
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(valid + x + 4), current);
+						x += 8;
+						continue;
+					}
+				}
+#endif
+				int end = std::min(x + 8, last);
+				for (; x < end; ++x)
+				{
+					if (row[x] == 0)
+						continue;
+
+					int gap = y - valid[x] - 1;
+					if (valid[x] >= 0 && gap > 0 && gap <= maxHole)
+						fillGap(base + x, stride, valid[x], y);
+					valid[x] = y;
+				}
+			}
+		}
+	}
+
+	struct TemporalParams
+	{
+		int smoothing;
+		int half;
+		int threshold;
+		int hold;
+	};
+
+	void temporalRow(const ushort* d, ushort* s, uchar* a, int cols, const TemporalParams& p)
+	{
+		int x = 0;
+#if defined(XNCV_SSE2)
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i one = _mm_set1_epi16(1);
+		const __m128i half = _mm_set1_epi16(static_cast<short>(p.half));
+		const __m128i threshold = _mm_set1_epi16(static_cast<short>(p.threshold));
+		const __m128i hold = _mm_set1_epi16(static_cast<short>(p.hold));
+		const __m128i shift = _mm_cvtsi32_si128(p.smoothing);
+		for (; x + 8 <= cols; x += 8)
+		{
+			__m128i dv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + x));
+			__m128i sv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + x));
+			__m128i av = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + x)), zero);
+
+			__m128i holes = _mm_cmpeq_epi16(dv, zero);
+			__m128i unset = _mm_cmpeq_epi16(sv, zero);
+
+			//Measured pixels: smooth small changes, restart on motion
+			__m128i change = _mm_or_si128(_mm_subs_epu16(dv, sv), _mm_subs_epu16(sv, dv));
+			__m128i still = _mm_andnot_si128(unset, _mm_cmpeq_epi16(_mm_subs_epu16(change, threshold), zero));
+			__m128i smooth = _mm_add_epi16(sv, _mm_sra_epi16(_mm_add_epi16(_mm_sub_epi16(dv, sv), half), shift));
+			__m128i measured = _mm_or_si128(_mm_and_si128(still, smooth), _mm_andnot_si128(still, dv));
+
+			//Holes keep the estimate while it is young enough
+			__m128i young = _mm_andnot_si128(unset, _mm_cmplt_epi16(av, hold));
+			__m128i held = _mm_and_si128(young, sv);
+
+			sv = _mm_or_si128(_mm_and_si128(holes, held), _mm_andnot_si128(holes, measured));
+			av = _mm_and_si128(holes, _mm_adds_epu16(av, one));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(s + x), sv);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(a + x), _mm_packus_epi16(av, av));
+		}
+#endif
+		for (; x < cols; ++x)
+		{
+			if (d[x] == 0)
+			{
+				if (a[x] >= p.hold)
+					s[x] = 0;
+				if (a[x] < 255)
+					++a[x];
+				continue;
+			}
+
+			int diff = d[x] - s[x];
+			if (s[x] != 0 && abs(diff) <= p.threshold)
+				s[x] = static_cast<ushort>(s[x] + ((diff + p.half) >> p.smoothing));
+			else
+				s[x] = d[x];
+			a[x] = 0;
+		}
+	}
+}
+
+xncv::DepthFilterParams::DepthFilterParams()
+	: maxHole(4), temporal(true), smoothing(2), motionThreshold(50), holdFrames(3), parallel(false)
+{
+}
+
+xncv::DepthFilter::DepthFilter(const DepthFilterParams& filterParams)
+	: params(filterParams)
+{
+}
+
+const xncv::DepthFilterParams& xncv::DepthFilter::getParams() const
+{
+	return params;
+}
+
+void xncv::DepthFilter::setParams(const DepthFilterParams& filterParams)
+{
+	params = filterParams;
+}
+
+void xncv::DepthFilter::reset()
+{
+	estimate.release();
+	age.release();
+}
+
+void xncv::DepthFilter::fillHoles(const cv::Mat& depth)
+{
+	filled.create(depth.size(), CV_16U);
+	int maxHole = params.maxHole;
+	parallelTiles(depth.rows, params.parallel, [&](int first, int last) {
+		for (int y = first; y < last; ++y)
+			fillRow(depth.ptr<ushort>(y), filled.ptr<ushort>(y), depth.cols, maxHole);
+	});
+
+	//Vertical holes are filled in column bands, top to bottom
+	parallelTiles(depth.cols, params.parallel, [&](int first, int last) {
+		fillColumns(filled, first, last, maxHole);
+	});
+}
+
+void xncv::DepthFilter::filterTemporal(const cv::Mat& depth)
+{
+	if (estimate.size() != depth.size())
+	{
+		estimate = cv::Mat::zeros(depth.size(), CV_16U);
+		age = cv::Mat(depth.size(), CV_8U, cv::Scalar(255));
+	}
+
+	//Keeps the signed 16 bit math of the SSE2 kernel exact
+	TemporalParams p;
+	p.smoothing = std::max(0, std::min(params.smoothing, 15));
+	p.half = p.smoothing > 0 ? 1 << (p.smoothing - 1) : 0;
+	p.threshold = std::min<int>(params.motionThreshold, 16383);
+	p.hold = std::max(0, std::min(params.holdFrames, 255));
+
+	parallelTiles(depth.rows, params.parallel, [&](int first, int last) {
+		for (int y = first; y < last; ++y)
+			temporalRow(depth.ptr<ushort>(y), estimate.ptr<ushort>(y), age.ptr<uchar>(y), depth.cols, p);
+	});
+}
+
+const cv::Mat& xncv::DepthFilter::apply(const cv::Mat& depth)
+{
+	XNCV_PROFILE_SCOPE("DepthFilter::apply");
+	const cv::Mat* input = &depth;
+	if (params.maxHole > 0)
+	{
+		fillHoles(depth);
+		input = &filled;
+	}
+
+	if (!params.temporal)
+	{
+		if (input == &depth)
+			depth.copyTo(filled);
+		return filled;
+	}
+
+	filterTemporal(*input);
+	return estimate;
+}
+
+const cv::Mat& xncv::DepthFilter::getAge() const
+{
+	return age;
+}
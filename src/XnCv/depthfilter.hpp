@@ -0,0 +1,69 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__DEPTH_FILTER_HPP__)
+#define __DEPTH_FILTER_HPP__
+
+#include "functions.hpp"
+
+namespace xncv
+{
+	struct DepthFilterParams
+	{
+		//Holes up to this many pixels wide or tall, with valid depth on both
+		//ends, take the depth of the nearest end. Zero disables filling.
+		int maxHole;
+
+		//Temporal filter: each frame moves the estimate 1/2^smoothing of the
+		//way to the measured depth. Changes above motionThreshold (mm) are
+		//taken as motion and reset the estimate. Pixels the sensor loses keep
+		//their estimate for holdFrames frames.
+		bool temporal;
+		int smoothing;
+		ushort motionThreshold;
+		int holdFrames;
+
+		//Splits the work in row tiles on the default thread pool
+		bool parallel;
+
+		DepthFilterParams();
+	};
+
+	class DepthFilter
+	{
+		private:
+			DepthFilterParams params;
+			cv::Mat filled;
+			cv::Mat estimate;
+			cv::Mat age;
+
+			void fillHoles(const cv::Mat& depth);
+			void filterTemporal(const cv::Mat& depth);
+
+		public:
+			DepthFilter(const DepthFilterParams& params=DepthFilterParams());
+
+			const DepthFilterParams& getParams() const;
+			void setParams(const DepthFilterParams& params);
+
+			void reset();
+
+			//Returns a buffer owned by the filter, overwritten by the next call
+			const cv::Mat& apply(const cv::Mat& depth);
+
+			//Frames since each pixel had a valid measurement, saturated at 255
+			const cv::Mat& getAge() const;
+	};
+}
+
+#endif
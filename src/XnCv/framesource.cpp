@@ -0,0 +1,237 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "framesource.hpp"
+#include "exceptions.hpp"
+#include <sstream>
+
+namespace
+{
+	XnUInt64 now()
+	{
+		XnUInt64 timestamp = 0;
+		xnOSGetHighResTimeStamp(&timestamp);
+		return timestamp;
+	}
+}
+
+xncv::SourceFrame::SourceFrame()
+	: source(-1), frame(0), timestamp(0), arrival(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+//Frame pool
+//-----------------------------------------------------------------------------
+xncv::FramePool::FramePool()
+{
+}
+
+xncv::FramePtr xncv::FramePool::acquire()
+{
+	SourceFrame* frame;
+	{
+		Lock lock(mutex);
+		if (available.empty())
+		{
+			frames.push_back(new SourceFrame());
+			available.push_back(frames.back());
+		}
+		frame = available.back();
+		available.pop_back();
+	}
+
+	frame->source = -1;
+	frame->frame = 0;
+	frame->timestamp = 0;
+	frame->arrival = 0;
+	return FramePtr(frame, [this](SourceFrame* f) { release(f); });
+}
+
+void xncv::FramePool::release(SourceFrame* frame)
+{
+	Lock lock(mutex);
+	available.push_back(frame);
+}
+
+unsigned xncv::FramePool::size() const
+{
+	Lock lock(mutex);
+	return static_cast<unsigned>(frames.size());
+}
+
+unsigned xncv::FramePool::freeFrames() const
+{
+	Lock lock(mutex);
+	return static_cast<unsigned>(available.size());
+}
+
+xncv::FramePool::~FramePool()
+{
+	for (unsigned i = 0; i < frames.size(); ++i)
+		delete frames[i];
+}
+
+//-----------------------------------------------------------------------------
+//Video source
+//-----------------------------------------------------------------------------
+xncv::VideoFrameSource::VideoFrameSource(int device)
+	: source(new VideoSource(device)), owned(true), lastFrameId(0), ended(false)
+{
+	std::stringstream ss;
+	ss << "device" << device;
+	name = ss.str();
+}
+
+xncv::VideoFrameSource::VideoFrameSource(const std::string& file)
+	: source(new VideoSource(file)), owned(true), name(file), lastFrameId(0), ended(false)
+{
+}
+
+xncv::VideoFrameSource::VideoFrameSource(VideoSource& videoSource, const std::string& sourceName)
+	: source(&videoSource), owned(false), name(sourceName), lastFrameId(0), ended(false)
+{
+}
+
+std::string xncv::VideoFrameSource::getName() const
+{
+	return name;
+}
+
+void xncv::VideoFrameSource::start()
+{
+	if (source->fromFile())
+		source->getXnPlayer().SetRepeat(FALSE);
+	source->start();
+}
+
+void xncv::VideoFrameSource::stop()
+{
+	source->stop();
+}
+
+bool xncv::VideoFrameSource::poll(SourceFrame& frame)
+{
+	if (ended)
+		return false;
+
+	//Players only read the next frame when updated
+	xn::DepthGenerator& depthGen = source->getXnDepthGenerator();
+	if (!source->fromFile() && !depthGen.IsNewDataAvailable())
+		return false;
+
+	if (source->getXnContext().WaitNoneUpdateAll() != XN_STATUS_OK)
+		throw GeneratorError("Unable to update data from generators!");
+
+	XnUInt32 frameId = depthGen.GetFrameID();
+	if (frameId == lastFrameId)
+	{
+		if (source->fromFile() && source->getXnPlayer().IsEOF())
+			ended = true;
+		return false;
+	}
+	lastFrameId = frameId;
+
+	frame.frame = static_cast<int>(frameId);
+	frame.timestamp = depthGen.GetTimestamp();
+	source->captureDepth().copyTo(frame.depth);
+
+	//Converted straight into the pooled buffer
+	xn::ImageGenerator& imgGen = source->getXnImageGenerator();
+	if (imgGen.IsValid())
+		cv::cvtColor(captureRGB(imgGen), frame.image, CV_BGR2RGB);
+	return true;
+}
+
+bool xncv::VideoFrameSource::finished() const
+{
+	return ended;
+}
+
+bool xncv::VideoFrameSource::isLive() const
+{
+	return !source->fromFile();
+}
+
+xncv::VideoFrameSource::~VideoFrameSource()
+{
+	if (owned)
+		delete source;
+}
+
+//-----------------------------------------------------------------------------
+//Synthetic source
+//-----------------------------------------------------------------------------
+xncv::SyntheticFrameSource::SyntheticFrameSource(const std::string& sourceName, int frameCount, double fps,
+	XnInt64 offset, bool isRealTime, int width, int height)
+	: name(sourceName), frames(frameCount), period(static_cast<XnUInt64>(1000000.0 / fps)),
+	clockOffset(offset), realTime(isRealTime), cols(width), rows(height),
+	produced(0), startTime(0), running(false)
+{
+}
+
+std::string xncv::SyntheticFrameSource::getName() const
+{
+	return name;
+}
+
+void xncv::SyntheticFrameSource::start()
+{
+	produced = 0;
+	startTime = now();
+	running = true;
+}
+
+void xncv::SyntheticFrameSource::stop()
+{
+	running = false;
+}
+
+bool xncv::SyntheticFrameSource::poll(SourceFrame& frame)
+{
+	if (!running || finished())
+		return false;
+
+	XnUInt64 due = startTime + produced * period;
+	if (realTime && now() < due)
+		return false;
+
+	frame.frame = produced + 1;
+	frame.timestamp = static_cast<XnUInt64>(static_cast<XnInt64>(produced * period) + clockOffset);
+
+	//A slanted plane that moves back and forth
+	int shift = produced % 200 < 100 ? produced % 100 : 100 - produced % 100;
+	frame.depth.create(rows, cols, CV_16U);
+	for (int y = 0; y < rows; ++y)
+	{
+		ushort* row = frame.depth.ptr<ushort>(y);
+		for (int x = 0; x < cols; ++x)
+			row[x] = static_cast<ushort>(1000 + 4 * x + 2 * y + 10 * shift);
+	}
+
+	frame.image.create(rows, cols, CV_8UC3);
+	frame.image.setTo(cv::Scalar(produced % 256, 128, 255 - produced % 256));
+
+	++produced;
+	return true;
+}
+
+bool xncv::SyntheticFrameSource::finished() const
+{
+	return frames >= 0 && produced >= frames;
+}
+
+bool xncv::SyntheticFrameSource::isLive() const
+{
+	return realTime;
+}
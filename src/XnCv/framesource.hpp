@@ -0,0 +1,147 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__FRAME_SOURCE_HPP__)
+#define __FRAME_SOURCE_HPP__
+
+#include <memory>
+#include <string>
+#include "videosource.hpp"
+#include "threading.hpp"
+
+namespace xncv
+{
+	struct SourceFrame
+	{
+		int source; //Index of the source in its manager
+		int frame;
+		XnUInt64 timestamp; //Sensor clock, in microseconds
+		XnUInt64 arrival;   //Host clock when the frame was read, in microseconds
+		cv::Mat depth;
+		cv::Mat image;
+
+		SourceFrame();
+	};
+
+	//Frames return to their pool when the last pointer to them is destroyed
+	typedef std::shared_ptr<SourceFrame> FramePtr;
+
+	//Recycles frames, so their matrices are reused by the next captures.
+	//The pool must outlive its frames.
+	class FramePool
+	{
+		private:
+			mutable CriticalSection mutex;
+			std::vector<SourceFrame*> frames;
+			std::vector<SourceFrame*> available;
+
+			void release(SourceFrame* frame);
+
+			FramePool(const FramePool&);
+			FramePool& operator=(const FramePool&);
+		public:
+			FramePool();
+			FramePtr acquire();
+
+			//Frames created and frames not in use
+			unsigned size() const;
+			unsigned freeFrames() const;
+
+			~FramePool();
+	};
+
+	//Something that produces depth frames: a sensor, a recording or a
+	//generator. Sources are polled, so one thread can drive many of them.
+	class FrameSource
+	{
+		public:
+			virtual std::string getName() const = 0;
+			virtual void start() = 0;
+			virtual void stop() = 0;
+
+			//Fills the frame if a new one is available. Never blocks.
+			virtual bool poll(SourceFrame& frame) = 0;
+
+			//True when no more frames will come
+			virtual bool finished() const = 0;
+
+			//Live sources produce frames at their own pace and lose the ones
+			//not read in time. The others, such as recordings, produce them
+			//as fast as they are polled.
+			virtual bool isLive() const { return true; }
+
+			virtual ~FrameSource() {}
+	};
+
+	class VideoFrameSource : public FrameSource
+	{
+		private:
+			VideoSource* source;
+			bool owned;
+			std::string name;
+			XnUInt32 lastFrameId;
+			bool ended;
+
+			VideoFrameSource(const VideoFrameSource&);
+			VideoFrameSource& operator=(const VideoFrameSource&);
+		public:
+			//The device-th sensor connected to the computer
+			VideoFrameSource(int device);
+			//A recording, played once
+			VideoFrameSource(const std::string& file);
+			//A source owned by the caller
+			VideoFrameSource(VideoSource& videoSource, const std::string& sourceName);
+
+			VideoSource& getVideoSource() { return *source; }
+
+			virtual std::string getName() const;
+			virtual void start();
+			virtual void stop();
+			virtual bool poll(SourceFrame& frame);
+			virtual bool finished() const;
+			virtual bool isLive() const;
+
+			virtual ~VideoFrameSource();
+	};
+
+	//Generated depth maps, for tests without sensors. clockOffset is added
+	//to the timestamps to simulate sensors with other clocks. Without
+	//realTime, frames are produced as fast as they are polled.
+	class SyntheticFrameSource : public FrameSource
+	{
+		private:
+			std::string name;
+			int frames;
+			XnUInt64 period;
+			XnInt64 clockOffset;
+			bool realTime;
+			int cols;
+			int rows;
+
+			int produced;
+			XnUInt64 startTime;
+			bool running;
+		public:
+			SyntheticFrameSource(const std::string& sourceName, int frameCount=-1, double fps=30.0,
+				XnInt64 clockOffset=0, bool realTime=true, int cols=640, int rows=480);
+
+			virtual std::string getName() const;
+			virtual void start();
+			virtual void stop();
+			virtual bool poll(SourceFrame& frame);
+			virtual bool finished() const;
+			virtual bool isLive() const;
+	};
+}
+
+#endif
@@ -12,7 +12,13 @@
 *******************************************************************************/
 
 #include "functions.hpp"
+#include "profiler.hpp"
+#include "exceptions.hpp"
+#include "simd.hpp"
 #include <opencv2\imgproc\imgproc.hpp>
+#include <algorithm>
+#include <vector>
+#include <cmath>
 
 //Private declarations
 cv::Mat cvtDepth8UDistance(const cv::Mat& mat);
@@ -26,6 +32,8 @@ cv::Mat xncv::captureRGB(const xn::ImageGenerator& generator)
 
 cv::Mat xncv::captureBGR(const xn::ImageGenerator& generator)
 {
+	XNCV_PROFILE_SCOPE("captureBGR");
+	XNCV_PROFILE_COUNT("buffers.estimated", 1);
 	//Transforms it in a BGR cv::Mat
 	cv::Mat img;
 	cv::cvtColor(captureRGB(generator), img, CV_BGR2RGB);
@@ -39,8 +47,17 @@ cv::Mat xncv::captureDepth(const xn::DepthGenerator& generator)
 	return cv::Mat(meta.YRes(), meta.XRes(), cv::DataType<ushort>::type, (void*)meta.Data());
 }
 
+cv::Mat xncv::captureLabels(const xn::UserGenerator& generator)
+{
+	xn::SceneMetaData meta;
+	generator.GetUserPixels(0, meta);
+	return cv::Mat(meta.YRes(), meta.XRes(), cv::DataType<ushort>::type, (void*)meta.Data());
+}
+
 cv::Mat xncv::cvtDepthTo8UDist(const cv::Mat &mat, int zRes)
 {
+	XNCV_PROFILE_SCOPE("cvtDepthTo8UDist");
+	XNCV_PROFILE_COUNT("buffers.estimated", 1);
 	//Calculate the maximum value
 	if (zRes == 0)
 		forEach<ushort>(mat, [&zRes](const cv::Point p, const ushort& elem) {
@@ -60,6 +77,8 @@ cv::Mat xncv::cvtDepthTo8UDist(const cv::Mat &mat, int zRes)
 
 cv::Mat xncv::cvtDepthTo8UHist(const cv::Mat &mat, const cv::Mat& histogram)
 {
+	XNCV_PROFILE_SCOPE("cvtDepthTo8UHist");
+	XNCV_PROFILE_COUNT("buffers.estimated", 2);
 	cv::Mat result(mat.rows, mat.cols, CV_8U);
 
 	//If the histogram is empty, returns an empty image
@@ -96,10 +115,16 @@ cv::Mat xncv::calcDepthHist(const cv::Mat& depth, const xn::DepthGenerator& gene
 {
 	xn::DepthMetaData meta;
 	generator.GetMetaData(meta);
+	return calcDepthHist(depth, static_cast<int>(meta.ZRes()));
+}
 
+cv::Mat xncv::calcDepthHist(const cv::Mat& depth, int zRes)
+{
+	XNCV_PROFILE_SCOPE("calcDepthHist");
+	XNCV_PROFILE_COUNT("buffers.estimated", 1);
 	int channels[] = {0};
-	int histSize[] = {static_cast<int>(meta.ZRes())};
-	float hranges[] = {0.0f, static_cast<float>(meta.ZRes()-1)};
+	int histSize[] = {zRes};
+	float hranges[] = {0.0f, static_cast<float>(zRes-1)};
 	const float *ranges[] = {hranges};
 
 	cv::Mat hist;
@@ -109,6 +134,8 @@ cv::Mat xncv::calcDepthHist(const cv::Mat& depth, const xn::DepthGenerator& gene
 
 cv::Mat xncv::histogramImage(const cv::Mat& histogram, ushort height, bool cropRight, bool cropLeft)
 {
+	XNCV_PROFILE_SCOPE("histogramImage");
+	XNCV_PROFILE_COUNT("buffers.estimated", 1);
 	double max = 0, min = 0;
 	cv::minMaxLoc(histogram, &min, &max);
 	int lastCol = histogram.rows;
@@ -151,7 +178,313 @@ XnPoint3D xncv::projectiveToWorld(const cv::Point& point, XnFloat z, const xn::D
 	return p2;
 }
 
+xncv::Intrinsics::Intrinsics()
+	: xRes(0), yRes(0), xzFactor(0.0f), yzFactor(0.0f), factor(1), xOffset(0), yOffset(0)
+{
+}
+
+xncv::Intrinsics xncv::getIntrinsics(const xn::DepthGenerator& generator)
+{
+	xn::DepthMetaData meta;
+	generator.GetMetaData(meta);
+	XnFieldOfView fov;
+	generator.GetFieldOfView(fov);
+
+	//Same model used by OpenNI in ConvertProjectiveToRealWorld
+	Intrinsics intrinsics;
+	intrinsics.xRes = static_cast<int>(meta.XRes());
+	intrinsics.yRes = static_cast<int>(meta.YRes());
+	intrinsics.xzFactor = static_cast<float>(tan(fov.fHFOV / 2) * 2);
+	intrinsics.yzFactor = static_cast<float>(tan(fov.fVFOV / 2) * 2);
+	return intrinsics;
+}
+
+xncv::Intrinsics xncv::captureIntrinsics(const Intrinsics& intrinsics, int factor, const cv::Rect& roi)
+{
+	if (factor < 1 || factor > MAX_DECIMATION)
+		throw Exception("Invalid decimation factor");
+
+	//The roi is relative to the pixels the intrinsics already describe
+	cv::Size size((intrinsics.xRes - intrinsics.xOffset) / intrinsics.factor,
+		(intrinsics.yRes - intrinsics.yOffset) / intrinsics.factor);
+	cv::Point tl = captureRect(size, factor, roi).tl();
+
+	Intrinsics capture = intrinsics;
+	capture.xOffset += intrinsics.factor * tl.x;
+	capture.yOffset += intrinsics.factor * tl.y;
+	capture.factor *= factor;
+	return capture;
+}
+
+bool xncv::isFullFrame(const Intrinsics& intrinsics)
+{
+	return intrinsics.factor == 1 && intrinsics.xOffset == 0 && intrinsics.yOffset == 0;
+}
+
+cv::Point xncv::worldToProjective(const XnPoint3D& point, const Intrinsics& intrinsics)
+{
+	if (point.Z == 0.0f)
+		return cv::Point(0, 0);
+
+	float x = intrinsics.xRes * (0.5f + point.X / (intrinsics.xzFactor * point.Z));
+	float y = intrinsics.yRes * (0.5f - point.Y / (intrinsics.yzFactor * point.Z));
+	x = (x - intrinsics.xOffset) / intrinsics.factor;
+	y = (y - intrinsics.yOffset) / intrinsics.factor;
+	return cv::Point(static_cast<int>(x), static_cast<int>(y));
+}
+
+XnPoint3D xncv::projectiveToWorld(const cv::Point& point, XnFloat z, const Intrinsics& intrinsics)
+{
+	XnPoint3D p;
+	float x = static_cast<float>(intrinsics.xOffset + intrinsics.factor * point.x);
+	float y = static_cast<float>(intrinsics.yOffset + intrinsics.factor * point.y);
+	p.X = (x / intrinsics.xRes - 0.5f) * z * intrinsics.xzFactor;
+	p.Y = (0.5f - y / intrinsics.yRes) * z * intrinsics.yzFactor;
+	p.Z = z;
+	return p;
+}
+
 std::ostream& xncv::operator<<(std::ostream& output, const XnVector3D& p)
 {
     return (output << "[" <<  p.X << ", " << p.Y <<", " << p.Z << "]");
-}
\ No newline at end of file
+}
+
+//-----------------------------------------------------------------------------
+//Capture modes
+//-----------------------------------------------------------------------------
+namespace
+{
+	//MAX_DECIMATION keeps image block sums in 16 bits and depth blocks on the stack
+	void checkFactor(int factor)
+	{
+		if (factor < 1 || factor > xncv::MAX_DECIMATION)
+			throw xncv::Exception("Invalid decimation factor");
+	}
+
+	//Top left pixel of the block, or the first valid one if it is a hole
+	inline ushort nearestValid(const cv::Mat& depth, int x, int y, int factor)
+	{
+		for (int j = 0; j < factor; ++j)
+		{
+			const ushort* row = depth.ptr<ushort>(y + j) + x;
+			for (int i = 0; i < factor; ++i)
+				if (row[i] != 0)
+					return row[i];
+		}
+		return 0;
+	}
+
+	inline int validDepths(const cv::Mat& depth, int x, int y, int factor, ushort* values)
+	{
+		int count = 0;
+		for (int j = 0; j < factor; ++j)
+		{
+			const ushort* row = depth.ptr<ushort>(y + j) + x;
+			for (int i = 0; i < factor; ++i)
+				if (row[i] != 0)
+					values[count++] = row[i];
+		}
+		return count;
+	}
+
+#if defined(XNCV_SSE2)
+	//SSE2 has no unsigned 16 bit min. Subtracting one makes holes wrap to
+	//the largest value, and the xor moves everything to signed range.
+	inline __m128i toSigned(const ushort* p)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		return _mm_xor_si128(_mm_sub_epi16(v, _mm_set1_epi16(1)), _mm_set1_epi16(static_cast<short>(0x8000)));
+	}
+
+	inline void storeUnsigned(ushort* p, __m128i v)
+	{
+		v = _mm_add_epi16(_mm_xor_si128(v, _mm_set1_epi16(static_cast<short>(0x8000))), _mm_set1_epi16(1));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+	}
+
+	//Minimum of each adjacent pair of a followed by b: 16 values into 8
+	inline __m128i pairMin(__m128i a, __m128i b)
+	{
+		a = _mm_min_epi16(a, _mm_srli_epi32(a, 16));
+		b = _mm_min_epi16(b, _mm_srli_epi32(b, 16));
+		a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+		b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+		return _mm_packs_epi32(a, b);
+	}
+
+	//Both return the first output column left for the scalar code
+	int minRow2(const ushort* r0, const ushort* r1, ushort* out, int cols)
+	{
+		int x = 0;
+		for (; x + 8 <= cols; x += 8)
+		{
+			int i = 2 * x;
+			__m128i lo = _mm_min_epi16(toSigned(r0 + i), toSigned(r1 + i));
+			__m128i hi = _mm_min_epi16(toSigned(r0 + i + 8), toSigned(r1 + i + 8));
+			storeUnsigned(out + x, pairMin(lo, hi));
+		}
+		return x;
+	}
+
+	int minRow4(const ushort* const rows[4], ushort* out, int cols)
+	{
+		int x = 0;
+		for (; x + 8 <= cols; x += 8)
+		{
+			__m128i v[4];
+			for (int k = 0; k < 4; ++k)
+			{
+				int i = 4 * x + 8 * k;
+				__m128i m = _mm_min_epi16(toSigned(rows[0] + i), toSigned(rows[1] + i));
+				m = _mm_min_epi16(m, toSigned(rows[2] + i));
+				v[k] = _mm_min_epi16(m, toSigned(rows[3] + i));
+			}
+			storeUnsigned(out + x, pairMin(pairMin(v[0], v[1]), pairMin(v[2], v[3])));
+		}
+		return x;
+	}
+#endif
+
+	//Vertical sums of factor rows, one per byte of the row
+	void sumRows(const cv::Mat& image, int y, int factor, ushort* sums, int width)
+	{
+		int x = 0;
+#if defined(XNCV_SSE2)
+		const __m128i zero = _mm_setzero_si128();
+		for (; x + 16 <= width; x += 16)
+		{
+			__m128i lo = zero;
+			__m128i hi = zero;
+			for (int j = 0; j < factor; ++j)
+			{
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(image.ptr<uchar>(y + j) + x));
+				lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+				hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(sums + x), lo);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(sums + x + 8), hi);
+		}
+#endif
+		for (; x < width; ++x)
+		{
+			ushort sum = 0;
+			for (int j = 0; j < factor; ++j)
+				sum = static_cast<ushort>(sum + image.ptr<uchar>(y + j)[x]);
+			sums[x] = sum;
+		}
+	}
+}
+
+cv::Rect xncv::captureRect(const cv::Size& size, int factor, const cv::Rect& roi)
+{
+	cv::Rect frame(0, 0, size.width, size.height);
+	cv::Rect rect = roi.area() > 0 ? (roi & frame) : frame;
+	rect.width -= rect.width % factor;
+	rect.height -= rect.height % factor;
+	return rect;
+}
+
+void xncv::decimateDepth(const cv::Mat& depth, cv::Mat& output, int factor, DepthDecimation mode, const cv::Rect& roi)
+{
+	XNCV_PROFILE_SCOPE("decimateDepth");
+	checkFactor(factor);
+	cv::Rect rect = captureRect(depth.size(), factor, roi);
+	int rows = rect.height / factor;
+	int cols = rect.width / factor;
+	output.create(rows, cols, CV_16U);
+	if (rows == 0 || cols == 0)
+		return;
+
+	cv::Mat src = depth(rect);
+	if (factor == 1)
+	{
+		src.copyTo(output);
+		return;
+	}
+
+	ushort values[MAX_DECIMATION * MAX_DECIMATION];
+	for (int y = 0; y < rows; ++y)
+	{
+		int top = y * factor;
+		ushort* out = output.ptr<ushort>(y);
+		int x = 0;
+#if defined(XNCV_SSE2)
+		if (mode == DECIMATE_MIN && factor == 2)
+			x = minRow2(src.ptr<ushort>(top), src.ptr<ushort>(top + 1), out, cols);
+		else if (mode == DECIMATE_MIN && factor == 4)
+		{
+			const ushort* r[4] = {src.ptr<ushort>(top), src.ptr<ushort>(top + 1), src.ptr<ushort>(top + 2), src.ptr<ushort>(top + 3)};
+			x = minRow4(r, out, cols);
+		}
+#endif
+		for (; x < cols; ++x)
+		{
+			if (mode == DECIMATE_NEAREST_VALID)
+			{
+				out[x] = nearestValid(src, x * factor, top, factor);
+				continue;
+			}
+
+			int count = validDepths(src, x * factor, top, factor, values);
+			if (count == 0)
+				out[x] = 0;
+			else if (mode == DECIMATE_MIN)
+				out[x] = *std::min_element(values, values + count);
+			else
+			{
+				//Lower median, so the result is always a measured depth
+				ushort* middle = values + (count - 1) / 2;
+				std::nth_element(values, middle, values + count);
+				out[x] = *middle;
+			}
+		}
+	}
+}
+
+void xncv::decimateImage(const cv::Mat& image, cv::Mat& output, int factor, const cv::Rect& roi, bool swapRB)
+{
+	XNCV_PROFILE_SCOPE("decimateImage");
+	checkFactor(factor);
+	cv::Rect rect = captureRect(image.size(), factor, roi);
+	int rows = rect.height / factor;
+	int cols = rect.width / factor;
+	output.create(rows, cols, CV_8UC3);
+	if (rows == 0 || cols == 0)
+		return;
+
+	cv::Mat src = image(rect);
+	if (factor == 1)
+	{
+		if (swapRB)
+			cv::cvtColor(src, output, CV_BGR2RGB);
+		else
+			src.copyTo(output);
+		return;
+	}
+
+	int width = rect.width * 3;
+	int area = factor * factor;
+	int first = swapRB ? 2 : 0;
+	std::vector<ushort> sums(width);
+	for (int y = 0; y < rows; ++y)
+	{
+		sumRows(src, y * factor, factor, &sums[0], width);
+
+		//Horizontal box and channel order in the same pass
+		uchar* out = output.ptr<uchar>(y);
+		for (int x = 0; x < cols; ++x)
+		{
+			const ushort* s = &sums[x * factor * 3];
+			int c0 = 0, c1 = 0, c2 = 0;
+			for (int i = 0; i < factor; ++i, s += 3)
+			{
+				c0 += s[0];
+				c1 += s[1];
+				c2 += s[2];
+			}
+			out[3 * x + first] = static_cast<uchar>((c0 + area / 2) / area);
+			out[3 * x + 1] = static_cast<uchar>((c1 + area / 2) / area);
+			out[3 * x + 2 - first] = static_cast<uchar>((c2 + area / 2) / area);
+		}
+	}
+}
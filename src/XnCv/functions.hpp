@@ -28,12 +28,47 @@ namespace xncv
 	cv::Mat cvtDepthTo8UDist(const cv::Mat &mat, int zRes=0);
 	cv::Mat cvtDepthTo8UHist(const cv::Mat &mat, const cv::Mat& hist);
 
+	//Capture modes. Both functions read the roi (whole frame if empty) of
+	//the sensor buffer and write one pixel per factor x factor block on
+	//output, which is only reallocated when its size changes. Factors go
+	//from 1 to MAX_DECIMATION.
+	const int MAX_DECIMATION = 16;
+	enum DepthDecimation {DECIMATE_NEAREST_VALID, DECIMATE_MIN, DECIMATE_MEDIAN};
+	void decimateDepth(const cv::Mat& depth, cv::Mat& output, int factor, DepthDecimation mode=DECIMATE_NEAREST_VALID, const cv::Rect& roi=cv::Rect());
+	void decimateImage(const cv::Mat& image, cv::Mat& output, int factor, const cv::Rect& roi=cv::Rect(), bool swapRB=false);
+	cv::Rect captureRect(const cv::Size& size, int factor, const cv::Rect& roi);
+
+	//User functions
+	cv::Mat captureLabels(const xn::UserGenerator& generator);
+
 	//Histogram functions
 	cv::Mat calcDepthHist(const cv::Mat& depth, const xn::DepthGenerator& generator);
+	cv::Mat calcDepthHist(const cv::Mat& depth, int zRes);
 	cv::Mat histogramImage(const cv::Mat& histogram, ushort height=640, bool cropRight=false, bool cropLeft=false);
 
+	//Projection parameters, used to convert points without calling OpenNI.
+	//A decimated or cropped capture keeps the sensor resolution and field of
+	//view: its pixel p is sensor pixel (xOffset, yOffset) + factor * p.
+	struct Intrinsics
+	{
+		int xRes;
+		int yRes;
+		float xzFactor;
+		float yzFactor;
+		int factor;
+		int xOffset;
+		int yOffset;
+
+		Intrinsics();
+	};
+	Intrinsics getIntrinsics(const xn::DepthGenerator& generator);
+	Intrinsics captureIntrinsics(const Intrinsics& intrinsics, int factor, const cv::Rect& roi);
+	bool isFullFrame(const Intrinsics& intrinsics);
+
 	cv::Point worldToProjective(const XnPoint3D& point, const xn::DepthGenerator& depth);
 	XnPoint3D projectiveToWorld(const cv::Point& point, XnFloat z, const xn::DepthGenerator& depth);
+	cv::Point worldToProjective(const XnPoint3D& point, const Intrinsics& intrinsics);
+	XnPoint3D projectiveToWorld(const cv::Point& point, XnFloat z, const Intrinsics& intrinsics);
 	std::ostream& operator<<(std::ostream& output, const XnPoint3D& p);
 
 	//Fast iterators
@@ -0,0 +1,187 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "integral.hpp"
+#include "threading.hpp"
+#include "profiler.hpp"
+#include "simd.hpp"
+
+namespace
+{
+	//Prefix sums of one depth row, written to its table row
+	void prefixRow(const ushort* d, double* sum, double* square, int* count, int cols)
+	{
+		double s = 0.0;
+		double q = 0.0;
+		int c = 0;
+		sum[0] = square[0] = 0.0;
+		count[0] = 0;
+		for (int x = 0; x < cols; ++x)
+		{
+			double z = d[x];
+			s += z;
+			q += z * z;
+			c += d[x] != 0;
+			sum[x + 1] = s;
+			square[x + 1] = q;
+			count[x + 1] = c;
+		}
+	}
+
+	//Adds the table row above to each row of a column band, top to bottom
+	void accumulateColumns(cv::Mat& sums, cv::Mat& squares, cv::Mat& counts, int first, int last)
+	{
+		for (int y = 2; y < sums.rows; ++y)
+		{
+			const double* sumAbove = sums.ptr<double>(y - 1);
+			const double* squareAbove = squares.ptr<double>(y - 1);
+			const int* countAbove = counts.ptr<int>(y - 1);
+			double* sum = sums.ptr<double>(y);
+			double* square = squares.ptr<double>(y);
+			int* count = counts.ptr<int>(y);
+
+			int x = first;
+#if defined(XNCV_SSE2)
+			for (; x + 4 <= last; x += 4)
+			{
+				_mm_storeu_pd(sum + x, _mm_add_pd(_mm_loadu_pd(sum + x), _mm_loadu_pd(sumAbove + x)));
+				_mm_storeu_pd(sum + x + 2, _mm_add_pd(_mm_loadu_pd(sum + x + 2), _mm_loadu_pd(sumAbove + x + 2)));
+				_mm_storeu_pd(square + x, _mm_add_pd(_mm_loadu_pd(square + x), _mm_loadu_pd(squareAbove + x)));
+				_mm_storeu_pd(square + x + 2, _mm_add_pd(_mm_loadu_pd(square + x + 2), _mm_loadu_pd(squareAbove + x + 2)));
+				__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(count + x));
+				__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(countAbove + x));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(count + x), _mm_add_epi32(c, a));
+			}
+#endif
+			for (; x < last; ++x)
+			{
+				sum[x] += sumAbove[x];
+				square[x] += squareAbove[x];
+				count[x] += countAbove[x];
+			}
+		}
+	}
+}
+
+xncv::DepthIntegral::DepthIntegral(bool parallelBuild)
+	: parallel(parallelBuild)
+{
+}
+
+xncv::DepthIntegral::DepthIntegral(const cv::Mat& depth, bool parallelBuild)
+	: parallel(parallelBuild)
+{
+	compute(depth);
+}
+
+void xncv::DepthIntegral::compute(const cv::Mat& depth)
+{
+	XNCV_PROFILE_SCOPE("DepthIntegral::compute");
+	if (sums.rows != depth.rows + 1 || sums.cols != depth.cols + 1)
+	{
+		sums = cv::Mat::zeros(depth.rows + 1, depth.cols + 1, CV_64F);
+		squares = cv::Mat::zeros(depth.rows + 1, depth.cols + 1, CV_64F);
+		counts = cv::Mat::zeros(depth.rows + 1, depth.cols + 1, CV_32S);
+	}
+
+	//Rows are independent while building prefixes, columns while adding
+	//them up, so both steps split in tiles
+	parallelTiles(depth.rows, parallel, [&](int first, int last) {
+		for (int y = first; y < last; ++y)
+			prefixRow(depth.ptr<ushort>(y), sums.ptr<double>(y + 1), squares.ptr<double>(y + 1), counts.ptr<int>(y + 1), depth.cols);
+	});
+	parallelTiles(sums.cols, parallel, [&](int first, int last) {
+		accumulateColumns(sums, squares, counts, first, last);
+	});
+}
+
+cv::Rect xncv::DepthIntegral::clip(const cv::Rect& rect) const
+{
+	return rect & cv::Rect(0, 0, sums.cols - 1, sums.rows - 1);
+}
+
+template <typename T>
+T xncv::DepthIntegral::area(const cv::Mat& table, const cv::Rect& rect) const
+{
+	if (rect.width <= 0 || rect.height <= 0)
+		return 0;
+
+	const T* top = table.ptr<T>(rect.y);
+	const T* bottom = table.ptr<T>(rect.y + rect.height);
+	int right = rect.x + rect.width;
+	return bottom[right] - bottom[rect.x] - top[right] + top[rect.x];
+}
+
+int xncv::DepthIntegral::count(const cv::Rect& rect) const
+{
+	return area<int>(counts, clip(rect));
+}
+
+double xncv::DepthIntegral::sum(const cv::Rect& rect) const
+{
+	return area<double>(sums, clip(rect));
+}
+
+double xncv::DepthIntegral::squareSum(const cv::Rect& rect) const
+{
+	return area<double>(squares, clip(rect));
+}
+
+float xncv::DepthIntegral::mean(const cv::Rect& rect) const
+{
+	return stats(rect).mean;
+}
+
+float xncv::DepthIntegral::variance(const cv::Rect& rect) const
+{
+	return stats(rect).variance;
+}
+
+xncv::RegionStats xncv::DepthIntegral::stats(const cv::Rect& rect) const
+{
+	cv::Rect r = clip(rect);
+	RegionStats result;
+	result.count = area<int>(counts, r);
+	result.sum = area<double>(sums, r);
+	result.squareSum = area<double>(squares, r);
+	result.mean = 0.0f;
+	result.variance = 0.0f;
+	if (result.count == 0)
+		return result;
+
+	double mean = result.sum / result.count;
+	double variance = result.squareSum / result.count - mean * mean;
+	result.mean = static_cast<float>(mean);
+	result.variance = static_cast<float>(variance > 0.0 ? variance : 0.0);
+	return result;
+}
+
+cv::Size xncv::DepthIntegral::size() const
+{
+	return sums.empty() ? cv::Size() : cv::Size(sums.cols - 1, sums.rows - 1);
+}
+
+const cv::Mat& xncv::DepthIntegral::getSums() const
+{
+	return sums;
+}
+
+const cv::Mat& xncv::DepthIntegral::getSquares() const
+{
+	return squares;
+}
+
+const cv::Mat& xncv::DepthIntegral::getCounts() const
+{
+	return counts;
+}
@@ -0,0 +1,70 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__INTEGRAL_HPP__)
+#define __INTEGRAL_HPP__
+
+#include "functions.hpp"
+
+namespace xncv
+{
+	//Statistics of the valid (non zero) depths of a region
+	struct RegionStats
+	{
+		int count;
+		double sum;
+		double squareSum;
+		float mean;
+		float variance;
+	};
+
+	//Summed-area tables of depth, squared depth and valid pixels. After
+	//compute, any rectangle is queried in constant time.
+	class DepthIntegral
+	{
+		private:
+			//(rows+1) x (cols+1), with a zero first row and column. Doubles
+			//hold the sums exactly: squares of a VGA frame stay below 2^53.
+			cv::Mat sums;
+			cv::Mat squares;
+			cv::Mat counts;
+			bool parallel;
+
+			cv::Rect clip(const cv::Rect& rect) const;
+			template <typename T>
+			T area(const cv::Mat& table, const cv::Rect& rect) const;
+
+		public:
+			DepthIntegral(bool parallel=false);
+			DepthIntegral(const cv::Mat& depth, bool parallel=false);
+
+			void compute(const cv::Mat& depth);
+
+			//Rectangles are clipped to the frame
+			int count(const cv::Rect& rect) const;
+			double sum(const cv::Rect& rect) const;
+			double squareSum(const cv::Rect& rect) const;
+			float mean(const cv::Rect& rect) const;
+			float variance(const cv::Rect& rect) const;
+			RegionStats stats(const cv::Rect& rect) const;
+
+			//Size of the depth map, not of the tables
+			cv::Size size() const;
+
+			const cv::Mat& getSums() const;
+			const cv::Mat& getSquares() const;
+			const cv::Mat& getCounts() const;
+	};
+}
+
+#endif
@@ -0,0 +1,225 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "jointfilter.hpp"
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	const float PI = 3.14159265f;
+	const float DEFAULT_DT = 1.0f / 30.0f;
+	const float INITIAL_VELOCITY_VARIANCE = 1000000.0f;
+
+	inline float smoothingFactor(float cutoff, float dt)
+	{
+		float tau = 1.0f / (2.0f * PI * cutoff);
+		return 1.0f / (1.0f + tau / dt);
+	}
+}
+
+xncv::JointFilterParams::JointFilterParams(JointFilterType filterType, float predictionMs)
+	: type(filterType), minCutoff(1.0f), beta(0.007f), derivateCutoff(1.0f),
+	processNoise(2500000.0f), measurementNoise(100.0f), prediction(predictionMs)
+{
+}
+
+xncv::JointFilter::JointFilter(const JointFilterParams& filterParams)
+	: params(filterParams), hasIntrinsics(false)
+{
+	reset();
+}
+
+const xncv::JointFilterParams& xncv::JointFilter::getParams() const
+{
+	return params;
+}
+
+void xncv::JointFilter::setParams(const JointFilterParams& filterParams)
+{
+	if (filterParams.type != params.type)
+		reset();
+	params = filterParams;
+}
+
+void xncv::JointFilter::setIntrinsics(const Intrinsics& cameraIntrinsics)
+{
+	intrinsics = cameraIntrinsics;
+	hasIntrinsics = true;
+}
+
+void xncv::JointFilter::reset()
+{
+	memset(users, 0, sizeof(users));
+	memset(lastTimestamp, 0, sizeof(lastTimestamp));
+	memset(initialized, 0, sizeof(initialized));
+}
+
+void xncv::JointFilter::resetSlot(int slot)
+{
+	users[slot] = 0;
+	lastTimestamp[slot] = 0;
+	memset(initialized + slot * MAX_JOINTS, 0, MAX_JOINTS);
+}
+
+int xncv::JointFilter::findSlot(XnUserID id, const SkeletonSnapshot& snapshot)
+{
+	for (int i = 0; i < MAX_USERS; ++i)
+		if (users[i] == id)
+			return i;
+
+	//New user, reuses the slot of someone who left the scene
+	for (int i = 0; i < MAX_USERS; ++i)
+	{
+		if (users[i] != 0 && snapshot.findUser(users[i]) != -1)
+			continue;
+		resetSlot(i);
+		users[i] = id;
+		return i;
+	}
+	return -1;
+}
+
+void xncv::JointFilter::apply(SkeletonSnapshot& snapshot)
+{
+	for (int s = 0; s < snapshot.userCount; ++s)
+	{
+		int slot = findSlot(snapshot.users[s], snapshot);
+		if (slot == -1)
+			continue;
+
+		float dt = DEFAULT_DT;
+		if (lastTimestamp[slot] != 0 && snapshot.timestamp > lastTimestamp[slot])
+			dt = static_cast<float>(snapshot.timestamp - lastTimestamp[slot]) / 1000000.0f;
+		lastTimestamp[slot] = snapshot.timestamp;
+
+		int first = s * MAX_JOINTS;
+		float* out[3] = {snapshot.x + first, snapshot.y + first, snapshot.z + first};
+		if (params.type == FILTER_KALMAN)
+			kalman(slot * MAX_JOINTS, MAX_JOINTS, snapshot, first, dt, out);
+		else
+			oneEuro(slot * MAX_JOINTS, MAX_JOINTS, snapshot, first, dt, out);
+
+		if (!hasIntrinsics)
+			continue;
+
+		for (int i = first; i < first + MAX_JOINTS; ++i)
+		{
+			if (!snapshot.present[i] || snapshot.confidence[i] == 0.0f)
+				continue;
+
+			XnPoint3D point = {snapshot.x[i], snapshot.y[i], snapshot.z[i]};
+			cv::Point projective = worldToProjective(point, intrinsics);
+			snapshot.projectiveX[i] = projective.x;
+			snapshot.projectiveY[i] = projective.y;
+		}
+	}
+}
+
+void xncv::JointFilter::oneEuro(int first, int count, const SkeletonSnapshot& snapshot, int snapFirst, float dt, float* out[3])
+{
+	float derivateAlpha = smoothingFactor(params.derivateCutoff, dt);
+	float ahead = params.prediction / 1000.0f;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float* r = raw[axis] + first;
+		float* p = position[axis] + first;
+		float* d = derivate[axis] + first;
+		float* o = out[axis];
+
+		for (int j = 0; j < count; ++j)
+		{
+			int s = snapFirst + j;
+			if (!snapshot.present[s] || snapshot.confidence[s] == 0.0f)
+				continue;
+
+			float value = o[j];
+			if (!initialized[first + j])
+			{
+				r[j] = p[j] = value;
+				d[j] = 0.0f;
+				continue;
+			}
+
+			//Filtered derivate drives the cutoff: slow movements are
+			//smoothed, fast ones follow the sensor with little lag.
+			float dx = (value - r[j]) / dt;
+			d[j] += derivateAlpha * (dx - d[j]);
+			float alpha = smoothingFactor(params.minCutoff + params.beta * fabs(d[j]), dt);
+			p[j] += alpha * (value - p[j]);
+			r[j] = value;
+			o[j] = p[j] + d[j] * ahead;
+		}
+	}
+
+	for (int j = 0; j < count; ++j)
+		if (snapshot.present[snapFirst + j] && snapshot.confidence[snapFirst + j] != 0.0f)
+			initialized[first + j] = 1;
+}
+
+void xncv::JointFilter::kalman(int first, int count, const SkeletonSnapshot& snapshot, int snapFirst, float dt, float* out[3])
+{
+	float dt2 = dt * dt;
+	float q00 = params.processNoise * dt2 * dt2 / 4.0f;
+	float q01 = params.processNoise * dt2 * dt / 2.0f;
+	float q11 = params.processNoise * dt2;
+	float ahead = params.prediction / 1000.0f;
+
+	for (int j = 0; j < count; ++j)
+	{
+		int s = snapFirst + j;
+		int f = first + j;
+		if (!snapshot.present[s] || snapshot.confidence[s] == 0.0f)
+			continue;
+
+		if (!initialized[f])
+		{
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				position[axis][f] = out[axis][j];
+				derivate[axis][f] = 0.0f;
+			}
+			p00[f] = params.measurementNoise;
+			p01[f] = 0.0f;
+			p11[f] = INITIAL_VELOCITY_VARIANCE;
+			initialized[f] = 1;
+			continue;
+		}
+
+		//Predict covariance
+		float a00 = p00[f] + dt * (2.0f * p01[f] + dt * p11[f]) + q00;
+		float a01 = p01[f] + dt * p11[f] + q01;
+		float a11 = p11[f] + q11;
+
+		//Gain
+		float k0 = a00 / (a00 + params.measurementNoise);
+		float k1 = a01 / (a00 + params.measurementNoise);
+
+		p00[f] = (1.0f - k0) * a00;
+		p01[f] = (1.0f - k0) * a01;
+		p11[f] = a11 - k1 * a01;
+
+		//Predict and correct each axis with the shared gain
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float& x = position[axis][f];
+			float& v = derivate[axis][f];
+			x += v * dt;
+			float residual = out[axis][j] - x;
+			x += k0 * residual;
+			v += k1 * residual;
+			out[axis][j] = x + v * ahead;
+		}
+	}
+}
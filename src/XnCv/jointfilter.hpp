@@ -0,0 +1,88 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__JOINT_FILTER_HPP__)
+#define __JOINT_FILTER_HPP__
+
+#include "snapshot.hpp"
+
+namespace xncv
+{
+	enum JointFilterType {FILTER_ONE_EURO, FILTER_KALMAN};
+
+	struct JointFilterParams
+	{
+		JointFilterType type;
+
+		//One Euro filter: cutoffs in Hz, beta is the speed coefficient
+		float minCutoff;
+		float beta;
+		float derivateCutoff;
+
+		//Constant velocity Kalman filter: acceleration variance in (mm/s^2)^2
+		//and measurement variance in mm^2
+		float processNoise;
+		float measurementNoise;
+
+		//How far ahead joints are extrapolated, in milliseconds
+		float prediction;
+
+		JointFilterParams(JointFilterType filterType=FILTER_ONE_EURO, float predictionMs=0.0f);
+	};
+
+	class JointFilter
+	{
+		private:
+			static const int SIZE = SkeletonSnapshot::SIZE;
+
+			JointFilterParams params;
+			Intrinsics intrinsics;
+			bool hasIntrinsics;
+
+			XnUserID users[MAX_USERS];
+			XnUInt64 lastTimestamp[MAX_USERS];
+			unsigned char initialized[SIZE];
+
+			//Per axis state. One Euro keeps the last raw sample, the filtered
+			//position and its derivate. Kalman keeps position and velocity.
+			float raw[3][SIZE];
+			float position[3][SIZE];
+			float derivate[3][SIZE];
+
+			//Kalman covariance. It does not depend on the samples, so the
+			//three axis share it.
+			float p00[SIZE];
+			float p01[SIZE];
+			float p11[SIZE];
+
+			int findSlot(XnUserID id, const SkeletonSnapshot& snapshot);
+			void resetSlot(int slot);
+			void oneEuro(int first, int count, const SkeletonSnapshot& snapshot, int snapFirst, float dt, float* out[3]);
+			void kalman(int first, int count, const SkeletonSnapshot& snapshot, int snapFirst, float dt, float* out[3]);
+
+		public:
+			JointFilter(const JointFilterParams& params=JointFilterParams());
+
+			const JointFilterParams& getParams() const;
+			void setParams(const JointFilterParams& params);
+
+			//Filtered joints are projected again with these intrinsics. Without
+			//them projectiveX and projectiveY keep the raw sensor values.
+			void setIntrinsics(const Intrinsics& intrinsics);
+
+			void reset();
+			void apply(SkeletonSnapshot& snapshot);
+	};
+}
+
+#endif
@@ -0,0 +1,205 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "labels.hpp"
+#include "threading.hpp"
+#include "simd.hpp"
+#include <climits>
+#include <cstring>
+
+using xncv::MAX_LABELS;
+
+namespace
+{
+	struct Accumulator
+	{
+		int minX, minY, maxX, maxY;
+		int pixels, valid;
+		ushort minDepth, maxDepth;
+		unsigned long long depthSum;
+
+		void reset()
+		{
+			minX = minY = INT_MAX;
+			maxX = maxY = -1;
+			pixels = valid = 0;
+			minDepth = USHRT_MAX;
+			maxDepth = 0;
+			depthSum = 0;
+		}
+
+		void merge(const Accumulator& other)
+		{
+			if (other.pixels == 0)
+				return;
+			minX = std::min(minX, other.minX);
+			minY = std::min(minY, other.minY);
+			maxX = std::max(maxX, other.maxX);
+			maxY = std::max(maxY, other.maxY);
+			pixels += other.pixels;
+			valid += other.valid;
+			minDepth = std::min(minDepth, other.minDepth);
+			maxDepth = std::max(maxDepth, other.maxDepth);
+			depthSum += other.depthSum;
+		}
+	};
+
+	//Masks are created the first time a tile finds their label
+	struct MaskSet
+	{
+		cv::Mat masks[MAX_LABELS];
+		xncv::CriticalSection mutex;
+		int rows;
+		int bytesPerRow;
+
+		uchar* get(int label)
+		{
+			xncv::Lock lock(mutex);
+			if (masks[label].empty())
+				masks[label] = cv::Mat::zeros(rows, bytesPerRow, CV_8U);
+			return masks[label].data;
+		}
+	};
+
+	void accumulateRows(const cv::Mat& labels, const cv::Mat& depth, int first, int last, Accumulator* acc, MaskSet* masks)
+	{
+		uchar* maskData[MAX_LABELS];
+		memset(maskData, 0, sizeof(maskData));
+
+#if defined(XNCV_SSE2)
+		const __m128i zero = _mm_setzero_si128();
+#endif
+		int cols = labels.cols;
+		for (int y = first; y < last; ++y)
+		{
+			const ushort* label = labels.ptr<ushort>(y);
+			const ushort* d = depth.empty() ? NULL : depth.ptr<ushort>(y);
+
+			int x = 0;
+			while (x < cols)
+			{
+#if defined(XNCV_SSE2)
+				//Skips background 8 pixels at a time
+				if (x + 8 <= cols)
+				{
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(label + x));
+					if (_mm_movemask_epi8(_mm_cmpeq_epi16(v, zero)) == 0xFFFF)
+					{
+						x += 8;
+						continue;
+					}
+				}
+#endif
+				int end = std::min(x + 8, cols);
+				for (; x < end; ++x)
+				{
+					int l = label[x];
+					if (l == 0 || l >= MAX_LABELS)
+						continue;
+
+					Accumulator& a = acc[l];
+					if (x < a.minX) a.minX = x;
+					if (x > a.maxX) a.maxX = x;
+					if (y < a.minY) a.minY = y;
+					a.maxY = y;
+					++a.pixels;
+
+					if (d && d[x] != 0)
+					{
+						++a.valid;
+						a.depthSum += d[x];
+						if (d[x] < a.minDepth) a.minDepth = d[x];
+						if (d[x] > a.maxDepth) a.maxDepth = d[x];
+					}
+
+					if (masks)
+					{
+						if (!maskData[l])
+							maskData[l] = masks->get(l);
+						maskData[l][y * masks->bytesPerRow + (x >> 3)] |= static_cast<uchar>(0x80 >> (x & 7));
+					}
+				}
+			}
+		}
+	}
+}
+
+std::vector<xncv::UserStats> xncv::calcUserStats(const cv::Mat& labels, const cv::Mat& depth, bool masks, bool parallel)
+{
+	std::vector<UserStats> result;
+	if (labels.empty())
+		return result;
+
+	MaskSet maskSet;
+	maskSet.rows = labels.rows;
+	maskSet.bytesPerRow = (labels.cols + 7) / 8;
+
+	//Each row tile owns its accumulators, merged at the end
+	ThreadPool& pool = defaultThreadPool();
+	int tiles = parallel ? std::min(pool.size() + 1, labels.rows) : 1;
+	std::vector<Accumulator> acc(tiles * MAX_LABELS);
+	for (unsigned i = 0; i < acc.size(); ++i)
+		acc[i].reset();
+
+	MaskSet* maskPtr = masks ? &maskSet : NULL;
+	auto tileBody = [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+		{
+			int first = labels.rows * t / tiles;
+			int last = labels.rows * (t + 1) / tiles;
+			accumulateRows(labels, depth, first, last, &acc[t * MAX_LABELS], maskPtr);
+		}
+	};
+
+	if (tiles == 1)
+		tileBody(0, 1);
+	else
+		pool.parallelFor(0, tiles, tileBody);
+
+	for (int l = 1; l < MAX_LABELS; ++l)
+	{
+		Accumulator total;
+		total.reset();
+		for (int t = 0; t < tiles; ++t)
+			total.merge(acc[t * MAX_LABELS + l]);
+
+		if (total.pixels == 0)
+			continue;
+
+		UserStats stats;
+		stats.id = static_cast<XnUserID>(l);
+		stats.bounds = cv::Rect(total.minX, total.minY, total.maxX - total.minX + 1, total.maxY - total.minY + 1);
+		stats.pixels = total.pixels;
+		stats.validPixels = total.valid;
+		stats.minDepth = total.valid ? total.minDepth : 0;
+		stats.maxDepth = total.maxDepth;
+		stats.meanDepth = total.valid ? static_cast<float>(static_cast<double>(total.depthSum) / total.valid) : 0.0f;
+		stats.mask = maskSet.masks[l];
+		result.push_back(stats);
+	}
+
+	return result;
+}
+
+cv::Mat xncv::unpackMask(const cv::Mat& packed, int cols)
+{
+	cv::Mat mask(packed.rows, cols, CV_8U);
+	for (int y = 0; y < packed.rows; ++y)
+	{
+		const uchar* bits = packed.ptr<uchar>(y);
+		uchar* row = mask.ptr<uchar>(y);
+		for (int x = 0; x < cols; ++x)
+			row[x] = (bits[x >> 3] & (0x80 >> (x & 7))) ? 255 : 0;
+	}
+	return mask;
+}
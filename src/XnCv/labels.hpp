@@ -0,0 +1,45 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__LABELS_HPP__)
+#define __LABELS_HPP__
+
+#include <vector>
+#include "functions.hpp"
+
+namespace xncv
+{
+	const int MAX_LABELS=256;
+
+	struct UserStats
+	{
+		XnUserID id;
+		cv::Rect bounds;
+		int pixels;
+
+		//Depth statistics consider only pixels with valid (non zero) depth
+		int validPixels;
+		ushort minDepth;
+		ushort maxDepth;
+		float meanDepth;
+
+		//Packed binary mask: one bit per pixel, most significant bit first,
+		//with (cols+7)/8 bytes per row.
+		cv::Mat mask;
+	};
+
+	std::vector<UserStats> calcUserStats(const cv::Mat& labels, const cv::Mat& depth=cv::Mat(), bool masks=false, bool parallel=false);
+	cv::Mat unpackMask(const cv::Mat& packed, int cols);
+}
+
+#endif
@@ -0,0 +1,126 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "mappedfile.hpp"
+#include <XnCppWrapper.h>
+#include "exceptions.hpp"
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+xncv::MappedFile::MappedFile() : data(NULL), length(0)
+{
+#if defined(_WIN32)
+	fileHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = NULL;
+#else
+	fileHandle = -1;
+#endif
+}
+
+void xncv::MappedFile::open(const std::string& fileName)
+{
+	close();
+
+#if defined(_WIN32)
+	fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		throw UnableToOpenFileException(fileName);
+
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(fileHandle, &fileSize);
+	length = static_cast<unsigned long long>(fileSize.QuadPart);
+	if (length == 0)
+		return;
+	checkSize(fileName);
+
+	mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappingHandle != NULL)
+		data = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+#else
+	fileHandle = ::open(fileName.c_str(), O_RDONLY);
+	if (fileHandle == -1)
+		throw UnableToOpenFileException(fileName);
+
+	struct stat info;
+	fstat(fileHandle, &info);
+	length = static_cast<unsigned long long>(info.st_size);
+	if (length == 0)
+		return;
+	checkSize(fileName);
+
+	void* address = mmap(NULL, static_cast<size_t>(length), PROT_READ, MAP_SHARED, fileHandle, 0);
+	if (address != MAP_FAILED)
+		data = static_cast<const char*>(address);
+#endif
+
+	if (data == NULL)
+	{
+		close();
+		throw IOException("Unable to map file", fileName);
+	}
+}
+
+void xncv::MappedFile::checkSize(const std::string& fileName)
+{
+	//size_t would silently truncate the view on 32 bit builds
+	if (length > static_cast<unsigned long long>(static_cast<size_t>(-1)))
+	{
+		close();
+		throw IOException("File too large to map", fileName);
+	}
+}
+
+void xncv::MappedFile::close()
+{
+#if defined(_WIN32)
+	if (data)
+		UnmapViewOfFile(data);
+	if (mappingHandle)
+		CloseHandle(mappingHandle);
+	if (fileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(fileHandle);
+	mappingHandle = NULL;
+	fileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (data)
+		munmap(const_cast<char*>(data), static_cast<size_t>(length));
+	if (fileHandle != -1)
+		::close(fileHandle);
+	fileHandle = -1;
+#endif
+	data = NULL;
+	length = 0;
+}
+
+bool xncv::MappedFile::isOpen() const
+{
+#if defined(_WIN32)
+	return fileHandle != INVALID_HANDLE_VALUE;
+#else
+	return fileHandle != -1;
+#endif
+}
+
+xncv::MappedFile::~MappedFile()
+{
+	close();
+}
@@ -0,0 +1,54 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__MAPPED_FILE_HPP__)
+#define __MAPPED_FILE_HPP__
+
+#include <string>
+
+namespace xncv
+{
+	//Read only memory mapping of a whole file. The file must fit in the
+	//address space: 32 bit builds throw for files over 4 GB and usually
+	//fail to map files of more than 1 or 2 GB.
+	class MappedFile
+	{
+		private:
+			const char* data;
+			unsigned long long length;
+#if defined(_WIN32)
+			void* fileHandle;
+			void* mappingHandle;
+#else
+			int fileHandle;
+#endif
+
+			void checkSize(const std::string& fileName);
+
+			MappedFile(const MappedFile&);
+			MappedFile& operator=(const MappedFile&);
+		public:
+			MappedFile();
+			void open(const std::string& fileName);
+			void close();
+			bool isOpen() const;
+
+			const char* begin() const { return data; }
+			const char* end() const { return data + length; }
+			unsigned long long size() const { return length; }
+
+			~MappedFile();
+	};
+}
+
+#endif
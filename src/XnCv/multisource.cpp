@@ -0,0 +1,326 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "multisource.hpp"
+#include "exceptions.hpp"
+#include <algorithm>
+
+namespace
+{
+	XnUInt64 now()
+	{
+		XnUInt64 timestamp = 0;
+		xnOSGetHighResTimeStamp(&timestamp);
+		return timestamp;
+	}
+}
+
+xncv::MultiSourceManager::MultiSourceManager(unsigned queueSize, QueuePolicy queuePolicy, ThreadPool& threadPool)
+	: pool(threadPool), maxQueued(queueSize < 1 ? 1 : queueSize), policy(queuePolicy),
+	running(false), stopping(false), done(false),
+	sets(0), arrivalSkew(0), maxArrivalSkew(0), timestampSkew(0), maxTimestampSkew(0)
+{
+}
+
+int xncv::MultiSourceManager::addSource(FrameSource* source)
+{
+	if (running)
+	{
+		delete source;
+		throw Exception("Sources cannot be added to a running manager");
+	}
+
+	SourceState state;
+	state.source = source;
+	state.frames = state.dropped = 0;
+	state.firstArrival = state.lastArrival = 0;
+	state.finished = false;
+	state.inSet = false;
+	state.setArrival = state.setTimestamp = 0;
+	sources.push_back(state);
+	return static_cast<int>(sources.size()) - 1;
+}
+
+int xncv::MultiSourceManager::addDevice(int device)
+{
+	return addSource(new VideoFrameSource(device));
+}
+
+int xncv::MultiSourceManager::addRecording(const std::string& file)
+{
+	return addSource(new VideoFrameSource(file));
+}
+
+int xncv::MultiSourceManager::sourceCount() const
+{
+	return static_cast<int>(sources.size());
+}
+
+xncv::FrameSource& xncv::MultiSourceManager::getSource(int source)
+{
+	return *sources[source].source;
+}
+
+void xncv::MultiSourceManager::start()
+{
+	if (running)
+		return;
+
+	for (unsigned i = 0; i < sources.size(); ++i)
+	{
+		sources[i].source->start();
+		sources[i].finished = false;
+	}
+
+	stopping = false;
+	done = false;
+	error = std::exception_ptr();
+	running = true;
+	scheduler.start([this]() { schedule(); });
+}
+
+void xncv::MultiSourceManager::schedule()
+{
+	int count = static_cast<int>(sources.size());
+	std::vector<char> polled(count);
+	for (;;)
+	{
+		{
+			Lock lock(mutex);
+			if (stopping)
+				break;
+		}
+
+		//Sources without news return right away, so polling them on the
+		//pool costs little and overlaps the copies of the ones with frames.
+		try
+		{
+			pool.parallelFor(0, count, [&](int begin, int end) {
+				for (int i = begin; i < end; ++i)
+				{
+					SourceState& state = sources[i];
+					polled[i] = 0;
+					if (state.source->finished())
+						continue;
+					if (!state.spare)
+						state.spare = framePool.acquire();
+					if (!state.source->poll(*state.spare))
+						continue;
+					state.spare->source = i;
+					state.spare->arrival = now();
+					polled[i] = 1;
+				}
+			});
+		}
+		catch (...)
+		{
+			Lock lock(mutex);
+			error = std::current_exception();
+			break;
+		}
+
+		//Read here, never while the pool polls the sources
+		bool finished = true;
+		{
+			Lock lock(mutex);
+			for (int i = 0; i < count; ++i)
+			{
+				sources[i].finished = sources[i].source->finished();
+				finished = finished && sources[i].finished;
+			}
+		}
+
+		bool any = false;
+		for (int i = 0; i < count; ++i)
+		{
+			if (!polled[i])
+				continue;
+			FramePtr frame;
+			frame.swap(sources[i].spare);
+			deliver(i, frame);
+			any = true;
+		}
+
+		if (finished)
+			break;
+		if (!any)
+			xnOSSleep(1);
+	}
+
+	Lock lock(mutex);
+	done = true;
+	frameReady.set();
+}
+
+void xncv::MultiSourceManager::updateSkew(int source, const SourceFrame& frame)
+{
+	SourceState& state = sources[source];
+	state.inSet = true;
+	state.setArrival = frame.arrival;
+	state.setTimestamp = frame.timestamp;
+
+	int members = 0;
+	XnUInt64 minArrival = 0, maxArrival = 0, minTimestamp = 0, maxTimestamp = 0;
+	for (unsigned i = 0; i < sources.size(); ++i)
+	{
+		const SourceState& s = sources[i];
+		if (!s.inSet)
+		{
+			//Finished sources do not hold the set back
+			if (s.finished)
+				continue;
+			return;
+		}
+
+		if (members == 0 || s.setArrival < minArrival) minArrival = s.setArrival;
+		if (members == 0 || s.setArrival > maxArrival) maxArrival = s.setArrival;
+		if (members == 0 || s.setTimestamp < minTimestamp) minTimestamp = s.setTimestamp;
+		if (members == 0 || s.setTimestamp > maxTimestamp) maxTimestamp = s.setTimestamp;
+		++members;
+	}
+
+	for (unsigned i = 0; i < sources.size(); ++i)
+		sources[i].inSet = false;
+	if (members < 2)
+		return;
+
+	//Incremental means
+	++sets;
+	double arrival = static_cast<double>(maxArrival - minArrival);
+	double timestamp = static_cast<double>(maxTimestamp - minTimestamp);
+	arrivalSkew += (arrival - arrivalSkew) / sets;
+	timestampSkew += (timestamp - timestampSkew) / sets;
+	maxArrivalSkew = std::max(maxArrivalSkew, arrival);
+	maxTimestampSkew = std::max(maxTimestampSkew, timestamp);
+}
+
+void xncv::MultiSourceManager::deliver(int source, const FramePtr& frame)
+{
+	Lock lock(mutex);
+	SourceState& state = sources[source];
+	if (state.frames++ == 0)
+		state.firstArrival = frame->arrival;
+	state.lastArrival = frame->arrival;
+	if (sources.size() > 1)
+		updateSkew(source, *frame);
+
+	//Sources that are not live wait for the reader instead of dropping,
+	//since their frames would be lost for good
+	QueuePolicy sourcePolicy = policy == QUEUE_DROP && !state.source->isLive() ? QUEUE_BLOCK : policy;
+	while (queue.size() >= maxQueued && sourcePolicy == QUEUE_BLOCK && !stopping)
+	{
+		spaceReady.reset();
+		mutex.unlock();
+		spaceReady.wait();
+		mutex.lock();
+	}
+
+	if (stopping || (queue.size() >= maxQueued && sourcePolicy == QUEUE_DROP))
+	{
+		++state.dropped;
+		return;
+	}
+
+	queue.push_back(frame);
+	frameReady.set();
+}
+
+bool xncv::MultiSourceManager::next(FramePtr& frame, XnUInt32 timeout)
+{
+	Lock lock(mutex);
+	while (queue.empty() && !done && !error)
+	{
+		frameReady.reset();
+		mutex.unlock();
+		bool signaled = frameReady.wait(timeout);
+		mutex.lock();
+		if (!signaled)
+			break;
+	}
+
+	if (error)
+	{
+		std::exception_ptr sourceError = error;
+		error = std::exception_ptr();
+		std::rethrow_exception(sourceError);
+	}
+
+	if (queue.empty())
+		return false;
+
+	frame = queue.front();
+	queue.pop_front();
+	spaceReady.set();
+	return true;
+}
+
+void xncv::MultiSourceManager::stop()
+{
+	if (!running)
+		return;
+
+	{
+		Lock lock(mutex);
+		stopping = true;
+		spaceReady.set();
+	}
+	scheduler.join();
+
+	for (unsigned i = 0; i < sources.size(); ++i)
+	{
+		sources[i].source->stop();
+		sources[i].spare.reset();
+	}
+
+	Lock lock(mutex);
+	queue.clear();
+	running = false;
+}
+
+std::vector<xncv::SourceStats> xncv::MultiSourceManager::sourceStats() const
+{
+	Lock lock(mutex);
+	std::vector<SourceStats> result;
+	for (unsigned i = 0; i < sources.size(); ++i)
+	{
+		const SourceState& state = sources[i];
+		SourceStats stats;
+		stats.name = state.source->getName();
+		stats.frames = state.frames;
+		stats.dropped = state.dropped;
+		stats.fps = state.frames > 1 && state.lastArrival > state.firstArrival ?
+			(state.frames - 1) * 1000000.0 / (state.lastArrival - state.firstArrival) : 0.0;
+		stats.finished = state.finished;
+		result.push_back(stats);
+	}
+	return result;
+}
+
+xncv::SkewStats xncv::MultiSourceManager::skew() const
+{
+	Lock lock(mutex);
+	SkewStats stats;
+	stats.sets = sets;
+	stats.meanArrival = arrivalSkew;
+	stats.maxArrival = maxArrivalSkew;
+	stats.meanTimestamp = timestampSkew;
+	stats.maxTimestamp = maxTimestampSkew;
+	return stats;
+}
+
+xncv::MultiSourceManager::~MultiSourceManager()
+{
+	stop();
+	for (unsigned i = 0; i < sources.size(); ++i)
+		delete sources[i].source;
+}
@@ -0,0 +1,132 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__MULTI_SOURCE_HPP__)
+#define __MULTI_SOURCE_HPP__
+
+#include <deque>
+#include <exception>
+#include "framesource.hpp"
+
+namespace xncv
+{
+	struct SourceStats
+	{
+		std::string name;
+		XnUInt64 frames;
+		XnUInt64 dropped; //Frames lost to a full queue
+		double fps;
+		bool finished;
+	};
+
+	//A set is completed every time all running sources delivered a frame.
+	//Skew is the spread of the latest frames of a set, in microseconds.
+	//Timestamp skew only makes sense for sources sharing a clock, such as
+	//recordings made together.
+	struct SkewStats
+	{
+		XnUInt64 sets;
+		double meanArrival;
+		double maxArrival;
+		double meanTimestamp;
+		double maxTimestamp;
+	};
+
+	//Drives many sources from one scheduler thread. Sources are polled on
+	//the shared thread pool, so the frames of several sensors are copied in
+	//parallel, and all of them share one frame pool. Frames must be released
+	//before the manager is destroyed, since they return to its pool.
+	class MultiSourceManager
+	{
+		private:
+			struct SourceState
+			{
+				FrameSource* source;
+				FramePtr spare;
+				XnUInt64 frames;
+				XnUInt64 dropped;
+				XnUInt64 firstArrival;
+				XnUInt64 lastArrival;
+				bool finished;
+
+				//Latest frame of the current skew set
+				bool inSet;
+				XnUInt64 setArrival;
+				XnUInt64 setTimestamp;
+			};
+
+			std::vector<SourceState> sources;
+			FramePool framePool;
+			ThreadPool& pool;
+
+			std::deque<FramePtr> queue;
+			unsigned maxQueued;
+			QueuePolicy policy;
+
+			mutable CriticalSection mutex;
+			Event frameReady;
+			Event spaceReady;
+			Thread scheduler;
+			bool running;
+			bool stopping;
+			bool done;
+			std::exception_ptr error;
+
+			XnUInt64 sets;
+			double arrivalSkew;
+			double maxArrivalSkew;
+			double timestampSkew;
+			double maxTimestampSkew;
+
+			void schedule();
+			void deliver(int source, const FramePtr& frame);
+			void updateSkew(int source, const SourceFrame& frame);
+
+			MultiSourceManager(const MultiSourceManager&);
+			MultiSourceManager& operator=(const MultiSourceManager&);
+
+		public:
+			//queueSize and policy apply to the frames waiting for next().
+			//QUEUE_DROP only drops frames of live sources: recordings block
+			//the scheduler until there is room, which also holds back the
+			//other sources.
+			MultiSourceManager(unsigned queueSize=16, QueuePolicy policy=QUEUE_DROP,
+				ThreadPool& threadPool=defaultThreadPool());
+
+			//Takes ownership of the source. Returns its index.
+			int addSource(FrameSource* source);
+			int addDevice(int device);
+			int addRecording(const std::string& file);
+
+			int sourceCount() const;
+			FrameSource& getSource(int source);
+
+			void start();
+			void stop();
+
+			//Next frame of any source, in arrival order. Returns false on
+			//timeout, or when every source finished and all frames were
+			//read. Rethrows errors of the sources.
+			bool next(FramePtr& frame, XnUInt32 timeout=XN_WAIT_INFINITE);
+
+			std::vector<SourceStats> sourceStats() const;
+			SkewStats skew() const;
+
+			FramePool& getFramePool() { return framePool; }
+			ThreadPool& getThreadPool() { return pool; }
+
+			~MultiSourceManager();
+	};
+}
+
+#endif
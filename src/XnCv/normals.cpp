@@ -0,0 +1,377 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "normals.hpp"
+#include "threading.hpp"
+#include "profiler.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+
+namespace
+{
+	const float PI = 3.14159265f;
+
+	//Floor search: orientation bins per axis, height bin in millimeters,
+	//and angle (degrees) between a floor normal and the plane orientation
+	const int ORIENTATION_BINS = 16;
+	const float HEIGHT_BIN = 20.0f;
+	const float FLOOR_ANGLE = 10.0f;
+	const int MIN_FLOOR_SUPPORT = 50;
+
+	void prefixRow(const ushort* d, double* row, int cols, int y)
+	{
+		row[0] = row[1] = row[2] = row[3] = 0.0;
+#if defined(XNCV_SSE2)
+		__m128d depths = _mm_setzero_pd();
+		__m128d weights = _mm_setzero_pd();
+		for (int x = 0; x < cols; ++x)
+		{
+			double z = d[x];
+			depths = _mm_add_pd(depths, _mm_set_pd(x * z, z));
+			weights = _mm_add_pd(weights, _mm_set_pd(d[x] != 0 ? 1.0 : 0.0, y * z));
+			_mm_storeu_pd(row + 4 * (x + 1), depths);
+			_mm_storeu_pd(row + 4 * (x + 1) + 2, weights);
+		}
+#else
+		double sum[4] = {0.0, 0.0, 0.0, 0.0};
+		for (int x = 0; x < cols; ++x)
+		{
+			double z = d[x];
+			sum[0] += z;
+			sum[1] += x * z;
+			sum[2] += y * z;
+			sum[3] += d[x] != 0 ? 1.0 : 0.0;
+			std::copy(sum, sum + 4, row + 4 * (x + 1));
+		}
+#endif
+	}
+
+	void accumulateColumns(cv::Mat& table, int first, int last)
+	{
+		for (int y = 2; y < table.rows; ++y)
+		{
+			const double* above = table.ptr<double>(y - 1);
+			double* row = table.ptr<double>(y);
+			int i = first;
+#if defined(XNCV_SSE2)
+			for (; i + 2 <= last; i += 2)
+				_mm_storeu_pd(row + i, _mm_add_pd(_mm_loadu_pd(row + i), _mm_loadu_pd(above + i)));
+#endif
+			for (; i < last; ++i)
+				row[i] += above[i];
+		}
+	}
+
+	//Sums of [left, right) x [top, bottom), as table rows and columns
+	inline void boxSum(const double* top, const double* bottom, int left, int right, double* out)
+	{
+		const double* a = top + 4 * left;
+		const double* b = top + 4 * right;
+		const double* c = bottom + 4 * left;
+		const double* d = bottom + 4 * right;
+#if defined(XNCV_SSE2)
+		for (int k = 0; k < 4; k += 2)
+		{
+			__m128d v = _mm_sub_pd(_mm_loadu_pd(d + k), _mm_loadu_pd(b + k));
+			v = _mm_add_pd(v, _mm_sub_pd(_mm_loadu_pd(a + k), _mm_loadu_pd(c + k)));
+			_mm_storeu_pd(out + k, v);
+		}
+#else
+		for (int k = 0; k < 4; ++k)
+			out[k] = d[k] - b[k] - c[k] + a[k];
+#endif
+	}
+
+	struct FloorSample
+	{
+		XnPoint3D point;
+		const float* normal;
+		float height;
+	};
+
+	//Same model as projectiveToWorld, averaged over a box: with z, x*z and
+	//y*z sums, the mean point needs a single division
+	struct Projection
+	{
+		double ax, bx, ay, by;
+
+		Projection(const xncv::Intrinsics& intrinsics)
+			: ax(intrinsics.xzFactor * intrinsics.factor / intrinsics.xRes),
+			bx(intrinsics.xzFactor * (0.5 - static_cast<double>(intrinsics.xOffset) / intrinsics.xRes)),
+			ay(intrinsics.yzFactor * intrinsics.factor / intrinsics.yRes),
+			by(intrinsics.yzFactor * (0.5 - static_cast<double>(intrinsics.yOffset) / intrinsics.yRes))
+		{
+		}
+
+		bool toPoint(const double* sum, XnPoint3D& point) const
+		{
+			if (sum[3] < 0.5)
+				return false;
+			double inverse = 1.0 / sum[3];
+			double z = sum[0] * inverse;
+			point.X = static_cast<float>(sum[1] * inverse * ax - z * bx);
+			point.Y = static_cast<float>(z * by - sum[2] * inverse * ay);
+			point.Z = static_cast<float>(z);
+			return true;
+		}
+	};
+
+	inline bool boxPoint(const double* top, const double* bottom, int left, int right, const Projection& projection, XnPoint3D& point)
+	{
+		if (left >= right || top == bottom)
+			return false;
+		double sum[4];
+		boxSum(top, bottom, left, right, sum);
+		return projection.toPoint(sum, point);
+	}
+}
+
+xncv::NormalParams::NormalParams()
+	: window(4), maxDepthChange(100), factor(1), parallel(false)
+{
+}
+
+xncv::NormalEstimator::NormalEstimator(const Intrinsics& cameraIntrinsics, const NormalParams& normalParams)
+	: params(normalParams), intrinsics(cameraIntrinsics)
+{
+}
+
+const xncv::NormalParams& xncv::NormalEstimator::getParams() const
+{
+	return params;
+}
+
+void xncv::NormalEstimator::setParams(const NormalParams& normalParams)
+{
+	params = normalParams;
+}
+
+void xncv::NormalEstimator::setIntrinsics(const Intrinsics& cameraIntrinsics)
+{
+	intrinsics = cameraIntrinsics;
+}
+
+void xncv::NormalEstimator::buildTable(const cv::Mat& depth)
+{
+	int width = 4 * (depth.cols + 1);
+	if (table.rows != depth.rows + 1 || table.cols != width)
+		table = cv::Mat::zeros(depth.rows + 1, width, CV_64F);
+
+	parallelTiles(depth.rows, params.parallel, [&](int first, int last) {
+		for (int y = first; y < last; ++y)
+			prefixRow(depth.ptr<ushort>(y), table.ptr<double>(y + 1), depth.cols, y);
+	});
+	parallelTiles(width, params.parallel, [&](int first, int last) {
+		accumulateColumns(table, first, last);
+	});
+}
+
+cv::Point xncv::NormalEstimator::sampleCenter(int x, int y) const
+{
+	int factor = std::max(params.factor, 1);
+	return cv::Point(x * factor + factor / 2, y * factor + factor / 2);
+}
+
+bool xncv::NormalEstimator::meanPoint(const cv::Rect& rect, XnPoint3D& point) const
+{
+	cv::Rect r = rect & cv::Rect(0, 0, table.cols / 4 - 1, table.rows - 1);
+	if (r.width <= 0 || r.height <= 0)
+		return false;
+	return boxPoint(table.ptr<double>(r.y), table.ptr<double>(r.y + r.height), r.x, r.x + r.width, Projection(intrinsics), point);
+}
+
+const cv::Mat& xncv::NormalEstimator::compute(const cv::Mat& depth)
+{
+	XNCV_PROFILE_SCOPE("NormalEstimator::compute");
+	buildTable(depth);
+
+	int factor = std::max(params.factor, 1);
+	normals.create(depth.rows / factor, depth.cols / factor, CV_32FC3);
+
+	int r = std::max(params.window, 1);
+	float maxChange = params.maxDepthChange;
+	Projection projection(intrinsics);
+	parallelTiles(normals.rows, params.parallel, [&](int first, int last) {
+		for (int y = first; y < last; ++y)
+		{
+			float* out = normals.ptr<float>(y);
+			for (int x = 0; x < normals.cols; ++x, out += 3)
+			{
+				out[0] = out[1] = out[2] = 0.0f;
+				cv::Point c = sampleCenter(x, y);
+				if (depth.ptr<ushort>(c.y)[c.x] == 0)
+					continue;
+
+				//Window bounds, as table columns and rows
+				int left = std::max(c.x - r, 0);
+				int right = std::min(c.x + r + 1, depth.cols);
+				int top = std::max(c.y - r, 0);
+				int bottom = std::min(c.y + r + 1, depth.rows);
+
+				const double* topRow = table.ptr<double>(top);
+				const double* bottomRow = table.ptr<double>(bottom);
+				XnPoint3D l, rt, t, b;
+				if (!boxPoint(topRow, bottomRow, left, c.x, projection, l) ||
+					!boxPoint(topRow, bottomRow, c.x + 1, right, projection, rt) ||
+					!boxPoint(topRow, table.ptr<double>(c.y), left, right, projection, t) ||
+					!boxPoint(table.ptr<double>(c.y + 1), bottomRow, left, right, projection, b))
+					continue;
+
+				if (maxChange > 0.0f && (fabs(rt.Z - l.Z) > maxChange || fabs(b.Z - t.Z) > maxChange))
+					continue;
+
+				//Image right and down tangents, crossed to face the sensor
+				float hx = rt.X - l.X, hy = rt.Y - l.Y, hz = rt.Z - l.Z;
+				float vx = b.X - t.X, vy = b.Y - t.Y, vz = b.Z - t.Z;
+				float nx = hy * vz - hz * vy;
+				float ny = hz * vx - hx * vz;
+				float nz = hx * vy - hy * vx;
+				float length = sqrt(nx * nx + ny * ny + nz * nz);
+				if (length == 0.0f)
+					continue;
+				out[0] = nx / length;
+				out[1] = ny / length;
+				out[2] = nz / length;
+			}
+		}
+	});
+	return normals;
+}
+
+const cv::Mat& xncv::NormalEstimator::getNormals() const
+{
+	return normals;
+}
+
+bool xncv::NormalEstimator::estimateFloor(FloorPlane& floor, float maxTilt) const
+{
+	if (normals.empty())
+		return false;
+
+	//Orientation: peak of the (x, z) histogram of upward normals
+	float minUp = cos(maxTilt * PI / 180.0f);
+	std::vector<int> bins(ORIENTATION_BINS * ORIENTATION_BINS, 0);
+	auto binOf = [](float v) { return std::min(ORIENTATION_BINS - 1, static_cast<int>((v + 1.0f) * 0.5f * ORIENTATION_BINS)); };
+	for (int y = 0; y < normals.rows; ++y)
+	{
+		const float* n = normals.ptr<float>(y);
+		for (int x = 0; x < normals.cols; ++x, n += 3)
+			if (n[1] >= minUp)
+				++bins[binOf(n[2]) * ORIENTATION_BINS + binOf(n[0])];
+	}
+
+	int peak = static_cast<int>(std::max_element(bins.begin(), bins.end()) - bins.begin());
+	if (bins[peak] == 0)
+		return false;
+
+	//Mean of the normals in the peak and its neighbour bins
+	int peakX = peak % ORIENTATION_BINS;
+	int peakZ = peak / ORIENTATION_BINS;
+	double up[3] = {0.0, 0.0, 0.0};
+	for (int y = 0; y < normals.rows; ++y)
+	{
+		const float* n = normals.ptr<float>(y);
+		for (int x = 0; x < normals.cols; ++x, n += 3)
+		{
+			if (n[1] < minUp || abs(binOf(n[0]) - peakX) > 1 || abs(binOf(n[2]) - peakZ) > 1)
+				continue;
+			for (int k = 0; k < 3; ++k)
+				up[k] += n[k];
+		}
+	}
+	double length = sqrt(up[0] * up[0] + up[1] * up[1] + up[2] * up[2]);
+	for (int k = 0; k < 3; ++k)
+		up[k] /= length;
+
+	//Heights along it of the window means with a matching normal
+	float minDot = cos(FLOOR_ANGLE * PI / 180.0f);
+	int r = std::max(params.window, 1);
+	std::vector<FloorSample> samples;
+	for (int y = 0; y < normals.rows; ++y)
+	{
+		const float* n = normals.ptr<float>(y);
+		for (int x = 0; x < normals.cols; ++x, n += 3)
+		{
+			if (n[0] * up[0] + n[1] * up[1] + n[2] * up[2] < minDot)
+				continue;
+			cv::Point c = sampleCenter(x, y);
+			FloorSample sample;
+			if (!meanPoint(cv::Rect(c.x - r, c.y - r, 2 * r + 1, 2 * r + 1), sample.point))
+				continue;
+			sample.normal = n;
+			sample.height = static_cast<float>(sample.point.X * up[0] + sample.point.Y * up[1] + sample.point.Z * up[2]);
+			samples.push_back(sample);
+		}
+	}
+	if (samples.empty())
+		return false;
+
+	//The floor is the lowest height bin with a good share of the votes,
+	//so tables and seats above it are skipped
+	float lowest = samples[0].height;
+	float highest = samples[0].height;
+	for (unsigned i = 1; i < samples.size(); ++i)
+	{
+		lowest = std::min(lowest, samples[i].height);
+		highest = std::max(highest, samples[i].height);
+	}
+	std::vector<int> histogram(static_cast<int>((highest - lowest) / HEIGHT_BIN) + 1, 0);
+	for (unsigned i = 0; i < samples.size(); ++i)
+		++histogram[static_cast<int>((samples[i].height - lowest) / HEIGHT_BIN)];
+
+	int needed = std::max(MIN_FLOOR_SUPPORT, *std::max_element(histogram.begin(), histogram.end()) / 4);
+	int bin = 0;
+	while (bin < static_cast<int>(histogram.size()) && histogram[bin] < needed)
+		++bin;
+	if (bin == static_cast<int>(histogram.size()))
+		return false;
+
+	//Refines orientation and height with the samples of that bin only,
+	//leaving out normals bent by nearby surfaces
+	double band = lowest + (bin + 0.5) * HEIGHT_BIN;
+	double normal[3] = {0.0, 0.0, 0.0};
+	for (unsigned i = 0; i < samples.size(); ++i)
+		if (fabs(samples[i].height - band) <= HEIGHT_BIN)
+			for (int k = 0; k < 3; ++k)
+				normal[k] += samples[i].normal[k];
+	length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+	for (int k = 0; k < 3; ++k)
+		normal[k] /= length;
+
+	double sum = 0.0;
+	int support = 0;
+	for (unsigned i = 0; i < samples.size(); ++i)
+	{
+		if (fabs(samples[i].height - band) > HEIGHT_BIN)
+			continue;
+		const XnPoint3D& p = samples[i].point;
+		sum += p.X * normal[0] + p.Y * normal[1] + p.Z * normal[2];
+		++support;
+	}
+
+	floor.normal.X = static_cast<float>(normal[0]);
+	floor.normal.Y = static_cast<float>(normal[1]);
+	floor.normal.Z = static_cast<float>(normal[2]);
+	floor.offset = static_cast<float>(-sum / support);
+	floor.support = support;
+	return true;
+}
+
+void xncv::computeNormals(const cv::Mat& depth, cv::Mat& normals, const Intrinsics& intrinsics, const NormalParams& params)
+{
+	NormalEstimator estimator(intrinsics, params);
+	normals = estimator.compute(depth);
+}
@@ -0,0 +1,90 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__NORMALS_HPP__)
+#define __NORMALS_HPP__
+
+#include "functions.hpp"
+
+namespace xncv
+{
+	struct NormalParams
+	{
+		//Half size of the smoothing window, in pixels of the depth map
+		int window;
+
+		//Tangents spanning larger depth changes (mm) cross an edge and
+		//leave a zero normal. Zero disables the check.
+		ushort maxDepthChange;
+
+		//Normals are computed for one pixel of each factor x factor block
+		int factor;
+
+		//Splits the work in row tiles on the default thread pool
+		bool parallel;
+
+		NormalParams();
+	};
+
+	struct FloorPlane
+	{
+		//Unit normal pointing up, in real world coordinates. The height of a
+		//point above the floor is normal . point + offset.
+		XnVector3D normal;
+		float offset;
+
+		//Normals that voted for the plane
+		int support;
+	};
+
+	//Unit normals facing the sensor, in real world coordinates. Each one is
+	//the cross product of horizontal and vertical tangents between window
+	//means, read in constant time from an integral image of the points.
+	class NormalEstimator
+	{
+		private:
+			NormalParams params;
+			Intrinsics intrinsics;
+
+			//(rows+1) x 4(cols+1) doubles: sums of z, x*z, y*z and valid
+			//pixels, which give the mean real world point of any rectangle
+			cv::Mat table;
+			cv::Mat normals;
+
+			void buildTable(const cv::Mat& depth);
+			bool meanPoint(const cv::Rect& rect, XnPoint3D& point) const;
+			cv::Point sampleCenter(int x, int y) const;
+
+		public:
+			NormalEstimator(const Intrinsics& intrinsics, const NormalParams& params=NormalParams());
+
+			const NormalParams& getParams() const;
+			void setParams(const NormalParams& params);
+			void setIntrinsics(const Intrinsics& intrinsics);
+
+			//Returns a CV_32FC3 buffer owned by the estimator, zero where no
+			//normal could be computed
+			const cv::Mat& compute(const cv::Mat& depth);
+			const cv::Mat& getNormals() const;
+
+			//Floor from the last computed normals, without RANSAC: the peak of
+			//the histogram of normals within maxTilt degrees of vertical gives
+			//the orientation, and the lowest well supported height along it
+			//gives the offset. Assumes the sensor is roughly level.
+			bool estimateFloor(FloorPlane& floor, float maxTilt=30.0f) const;
+	};
+
+	void computeNormals(const cv::Mat& depth, cv::Mat& normals, const Intrinsics& intrinsics, const NormalParams& params=NormalParams());
+}
+
+#endif
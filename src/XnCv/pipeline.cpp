@@ -0,0 +1,320 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "pipeline.hpp"
+#include "profiler.hpp"
+#include "exceptions.hpp"
+
+xncv::PipelineFrame::PipelineFrame()
+	: index(0), frame(0), timestamp(0), started(0)
+{
+}
+
+xncv::Pipeline::Pipeline()
+	: running(false), stopping(false), aborting(false), nextIndex(0),
+	completed(0), totalLatency(0), maxLatency(0)
+{
+}
+
+void xncv::Pipeline::addStage(const std::string& name, const StageFunction& function,
+	unsigned queueSize, QueuePolicy policy)
+{
+	if (running)
+		throw Exception("Stages cannot be added to a running pipeline");
+
+	Stage* stage = new Stage();
+	stage->name = name;
+	stage->function = function;
+	stage->capacity = queueSize < 1 ? 1 : queueSize;
+	stage->policy = policy;
+	stage->finished = false;
+	stage->processed = stage->dropped = 0;
+	stage->maxQueued = 0;
+	stage->totalTime = stage->maxTime = 0;
+	stages.push_back(stage);
+}
+
+void xncv::Pipeline::start()
+{
+	if (running)
+		return;
+	if (stages.empty())
+		throw Exception("Pipeline has no stages");
+
+	stopping = false;
+	aborting = false;
+	error = std::exception_ptr();
+	for (unsigned i = 0; i < stages.size(); ++i)
+	{
+		stages[i]->finished = false;
+		stages[i]->inputReady.reset();
+		stages[i]->spaceReady.reset();
+	}
+	running = true;
+
+	//Consumers first, so the source never waits for a thread to start
+	for (int i = static_cast<int>(stages.size()) - 1; i > 0; --i)
+		stages[i]->thread.start([this, i]() { runStage(i); });
+	stages[0]->thread.start([this]() { runSource(); });
+}
+
+bool xncv::Pipeline::process(int stage, PipelineFrame& frame)
+{
+	XnUInt64 begin = profileClock();
+	bool keep = false;
+	try
+	{
+		keep = stages[stage]->function(frame);
+	}
+	catch (...)
+	{
+		Lock lock(mutex);
+		if (!error)
+			error = std::current_exception();
+		abort();
+		return false;
+	}
+	XnUInt64 elapsed = profileClock() - begin;
+
+	//The source returns false at the end, which is not a frame
+	Lock lock(mutex);
+	Stage& s = *stages[stage];
+	if (keep || stage > 0)
+	{
+		++s.processed;
+		s.totalTime += elapsed;
+		if (elapsed > s.maxTime)
+			s.maxTime = elapsed;
+	}
+	if (!keep && stage > 0)
+		++s.dropped;
+	return keep;
+}
+
+void xncv::Pipeline::runSource()
+{
+	for (;;)
+	{
+		PipelineFrame* frame;
+		{
+			Lock lock(mutex);
+			if (stopping || aborting)
+				break;
+
+			//Frames are only created when all others are in flight, so
+			//blocking queues also bound the memory
+			if (freeFrames.empty())
+			{
+				frames.push_back(new PipelineFrame());
+				freeFrames.push_back(frames.back());
+			}
+			frame = freeFrames.back();
+			freeFrames.pop_back();
+			frame->index = nextIndex++;
+		}
+
+		frame->frame = 0;
+		frame->timestamp = 0;
+		frame->skeletons.clear();
+		frame->started = profileClock();
+		if (!process(0, *frame))
+		{
+			recycle(frame);
+			break;
+		}
+		forward(1, frame);
+	}
+	finish(0);
+}
+
+void xncv::Pipeline::runStage(int stage)
+{
+	Stage& s = *stages[stage];
+	Stage& upstream = *stages[stage - 1];
+	for (;;)
+	{
+		PipelineFrame* frame;
+		{
+			Lock lock(mutex);
+			while (s.input.empty() && !upstream.finished && !aborting)
+			{
+				s.inputReady.reset();
+				mutex.unlock();
+				s.inputReady.wait();
+				mutex.lock();
+			}
+			if (aborting || s.input.empty())
+				break;
+
+			frame = s.input.front();
+			s.input.pop_front();
+			s.spaceReady.set();
+		}
+
+		if (process(stage, *frame))
+			forward(stage + 1, frame);
+		else
+			recycle(frame);
+	}
+	finish(stage);
+}
+
+void xncv::Pipeline::forward(int stage, PipelineFrame* frame)
+{
+	Lock lock(mutex);
+
+	//Past the last stage
+	if (stage == static_cast<int>(stages.size()))
+	{
+		XnUInt64 latency = profileClock() - frame->started;
+		++completed;
+		totalLatency += latency;
+		if (latency > maxLatency)
+			maxLatency = latency;
+		freeFrames.push_back(frame);
+		return;
+	}
+
+	Stage& s = *stages[stage];
+	while (s.input.size() >= s.capacity && s.policy == QUEUE_BLOCK && !aborting)
+	{
+		s.spaceReady.reset();
+		mutex.unlock();
+		s.spaceReady.wait();
+		mutex.lock();
+	}
+
+	if (aborting || (s.input.size() >= s.capacity && s.policy == QUEUE_DROP))
+	{
+		if (!aborting)
+			++s.dropped;
+		freeFrames.push_back(frame);
+		return;
+	}
+
+	s.input.push_back(frame);
+	if (s.input.size() > s.maxQueued)
+		s.maxQueued = static_cast<unsigned>(s.input.size());
+	s.inputReady.set();
+}
+
+void xncv::Pipeline::recycle(PipelineFrame* frame)
+{
+	Lock lock(mutex);
+	freeFrames.push_back(frame);
+}
+
+void xncv::Pipeline::finish(int stage)
+{
+	Lock lock(mutex);
+	stages[stage]->finished = true;
+	if (stage + 1 < static_cast<int>(stages.size()))
+		stages[stage + 1]->inputReady.set();
+}
+
+void xncv::Pipeline::abort()
+{
+	//Wakes every waiting thread. Called with the mutex locked.
+	aborting = true;
+	for (unsigned i = 0; i < stages.size(); ++i)
+	{
+		stages[i]->inputReady.set();
+		stages[i]->spaceReady.set();
+	}
+}
+
+void xncv::Pipeline::join()
+{
+	for (unsigned i = 0; i < stages.size(); ++i)
+		stages[i]->thread.join();
+
+	//Frames left behind by an error
+	Lock lock(mutex);
+	for (unsigned i = 0; i < stages.size(); ++i)
+	{
+		std::deque<PipelineFrame*>& input = stages[i]->input;
+		freeFrames.insert(freeFrames.end(), input.begin(), input.end());
+		input.clear();
+	}
+	running = false;
+}
+
+void xncv::Pipeline::wait()
+{
+	if (!running)
+		return;
+
+	join();
+	if (error)
+	{
+		std::exception_ptr stageError = error;
+		error = std::exception_ptr();
+		std::rethrow_exception(stageError);
+	}
+}
+
+void xncv::Pipeline::stop()
+{
+	{
+		Lock lock(mutex);
+		stopping = true;
+	}
+	wait();
+}
+
+bool xncv::Pipeline::isRunning() const
+{
+	Lock lock(mutex);
+	return running && !stages.back()->finished;
+}
+
+xncv::PipelineStats xncv::Pipeline::stats() const
+{
+	Lock lock(mutex);
+	PipelineStats result;
+	for (unsigned i = 0; i < stages.size(); ++i)
+	{
+		const Stage& s = *stages[i];
+		StageStats stage;
+		stage.name = s.name;
+		stage.processed = s.processed;
+		stage.dropped = s.dropped;
+		stage.queued = static_cast<unsigned>(s.input.size());
+		stage.maxQueued = s.maxQueued;
+		stage.meanTime = s.processed ? s.totalTime / 1000.0 / s.processed : 0.0;
+		stage.maxTime = s.maxTime / 1000.0;
+		result.stages.push_back(stage);
+	}
+
+	result.frames = completed;
+	result.meanLatency = completed ? totalLatency / 1000.0 / completed : 0.0;
+	result.maxLatency = maxLatency / 1000.0;
+	return result;
+}
+
+xncv::Pipeline::~Pipeline()
+{
+	try
+	{
+		stop();
+	}
+	catch (...)
+	{
+		//Errors of the last run are lost
+	}
+
+	for (unsigned i = 0; i < stages.size(); ++i)
+		delete stages[i];
+	for (unsigned i = 0; i < frames.size(); ++i)
+		delete frames[i];
+}
@@ -0,0 +1,151 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__PIPELINE_HPP__)
+#define __PIPELINE_HPP__
+
+#include <map>
+#include <string>
+#include <exception>
+#include "snapshot.hpp"
+#include "threading.hpp"
+
+namespace xncv
+{
+	//Data carried through the stages. Frames are recycled, so the matrices
+	//still hold the buffers of an earlier frame: stages should overwrite
+	//them, and cv::Mat::create reuses the memory.
+	struct PipelineFrame
+	{
+		int index; //Sequence number given by the pipeline
+		int frame;
+		XnUInt64 timestamp;
+		XnUInt64 started; //profileClock() when the source began the frame
+		cv::Mat depth;
+		cv::Mat image;
+		cv::Mat labels;
+		SkeletonSnapshot skeletons;
+
+		//Other stage outputs, by name
+		std::map<std::string, cv::Mat> mats;
+
+		PipelineFrame();
+	};
+
+	//The first stage is the source: it fills a new frame and returns false
+	//when there are no more. Other stages return false to drop the frame.
+	typedef std::function<bool(PipelineFrame&)> StageFunction;
+
+	struct StageStats
+	{
+		std::string name;
+		XnUInt64 processed;
+		XnUInt64 dropped; //Frames rejected by a full queue or by the stage
+		unsigned queued;
+		unsigned maxQueued;
+
+		//In microseconds
+		double meanTime;
+		double maxTime;
+	};
+
+	struct PipelineStats
+	{
+		std::vector<StageStats> stages;
+		XnUInt64 frames; //Frames that left the last stage
+
+		//From the source start to the last stage end, in microseconds
+		double meanLatency;
+		double maxLatency;
+	};
+
+	//Runs each stage in its own thread, so consecutive frames are processed
+	//by different stages at the same time. Stages are linked by bounded
+	//queues, and the policy of a stage says what happens when its input
+	//queue is full. A stage function is only called from its thread.
+	class Pipeline
+	{
+		private:
+			struct Stage
+			{
+				std::string name;
+				StageFunction function;
+				unsigned capacity;
+				QueuePolicy policy;
+
+				std::deque<PipelineFrame*> input;
+				Event inputReady;
+				Event spaceReady;
+				Thread thread;
+				bool finished;
+
+				XnUInt64 processed;
+				XnUInt64 dropped;
+				unsigned maxQueued;
+				XnUInt64 totalTime; //Nanoseconds
+				XnUInt64 maxTime;
+			};
+
+			std::vector<Stage*> stages;
+			std::vector<PipelineFrame*> frames;
+			std::vector<PipelineFrame*> freeFrames;
+			mutable CriticalSection mutex;
+
+			bool running;
+			bool stopping;
+			bool aborting;
+			int nextIndex;
+			std::exception_ptr error;
+
+			XnUInt64 completed;
+			XnUInt64 totalLatency;
+			XnUInt64 maxLatency;
+
+			void runSource();
+			void runStage(int stage);
+			bool process(int stage, PipelineFrame& frame);
+			void forward(int stage, PipelineFrame* frame);
+			void recycle(PipelineFrame* frame);
+			void finish(int stage);
+			void abort();
+			void join();
+
+			Pipeline(const Pipeline&);
+			Pipeline& operator=(const Pipeline&);
+
+		public:
+			Pipeline();
+
+			//Stages run in the order they are added. queueSize and policy
+			//apply to the input queue of the stage, so they are ignored for
+			//the source.
+			void addStage(const std::string& name, const StageFunction& function,
+				unsigned queueSize=2, QueuePolicy policy=QUEUE_BLOCK);
+
+			void start();
+
+			//Waits until the source ends and every frame is processed.
+			//Rethrows the first error of a stage.
+			void wait();
+
+			//Stops the source and waits for the frames already read
+			void stop();
+
+			bool isRunning() const;
+			PipelineStats stats() const;
+
+			~Pipeline();
+	};
+}
+
+#endif
@@ -0,0 +1,151 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "pointcloud.hpp"
+#include "labels.hpp"
+#include "threading.hpp"
+#include <algorithm>
+
+namespace
+{
+	const long long VOXEL_OFFSET = 1 << 20;
+	const unsigned long long VOXEL_MASK = (1 << 21) - 1;
+
+	unsigned long long voxelKey(const cv::Point3f& p, float inverseSize)
+	{
+		unsigned long long x = static_cast<unsigned long long>(cvFloor(p.x * inverseSize) + VOXEL_OFFSET) & VOXEL_MASK;
+		unsigned long long y = static_cast<unsigned long long>(cvFloor(p.y * inverseSize) + VOXEL_OFFSET) & VOXEL_MASK;
+		unsigned long long z = static_cast<unsigned long long>(cvFloor(p.z * inverseSize) + VOXEL_OFFSET) & VOXEL_MASK;
+		return x | (y << 21) | (z << 42);
+	}
+}
+
+std::vector<xncv::PointCloud> xncv::calcPointClouds(const cv::Mat& labels, const cv::Mat& depth,
+	const Intrinsics& intrinsics, float voxelSize, ThreadPool* pool)
+{
+	std::vector<PointCloud> clouds;
+	if (labels.empty() || depth.empty())
+		return clouds;
+
+	//Column factors are the same for every row
+	std::vector<float> columnFactor(labels.cols);
+	for (int x = 0; x < labels.cols; ++x)
+	{
+		float sensorX = static_cast<float>(intrinsics.xOffset + intrinsics.factor * x);
+		columnFactor[x] = (sensorX / intrinsics.xRes - 0.5f) * intrinsics.xzFactor;
+	}
+
+	//First stage: each row tile collects the points of every label
+	int tiles = pool ? std::min(pool->size() + 1, labels.rows) : 1;
+	std::vector<std::vector<cv::Point3f> > tilePoints(tiles * MAX_LABELS);
+
+	auto tileBody = [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+		{
+			std::vector<cv::Point3f>* points = &tilePoints[t * MAX_LABELS];
+			int last = labels.rows * (t + 1) / tiles;
+			for (int y = labels.rows * t / tiles; y < last; ++y)
+			{
+				const ushort* label = labels.ptr<ushort>(y);
+				const ushort* d = depth.ptr<ushort>(y);
+				float sensorY = static_cast<float>(intrinsics.yOffset + intrinsics.factor * y);
+				float rowFactor = (0.5f - sensorY / intrinsics.yRes) * intrinsics.yzFactor;
+
+				for (int x = 0; x < labels.cols; ++x)
+				{
+					if (label[x] == 0 || label[x] >= MAX_LABELS || d[x] == 0)
+						continue;
+					float z = d[x];
+					points[label[x]].push_back(cv::Point3f(columnFactor[x] * z, rowFactor * z, z));
+				}
+			}
+		}
+	};
+
+	if (pool)
+		pool->parallelFor(0, tiles, tileBody);
+	else
+		tileBody(0, tiles);
+
+	for (int l = 1; l < MAX_LABELS; ++l)
+	{
+		size_t total = 0;
+		for (int t = 0; t < tiles; ++t)
+			total += tilePoints[t * MAX_LABELS + l].size();
+
+		if (total == 0)
+			continue;
+
+		clouds.push_back(PointCloud());
+		clouds.back().id = static_cast<XnUserID>(l);
+		clouds.back().points.resize(total);
+	}
+
+	//Second stage: each user gathers its tiles and is downsampled
+	auto userBody = [&](int begin, int end) {
+		for (int c = begin; c < end; ++c)
+		{
+			std::vector<cv::Point3f>& points = clouds[c].points;
+			size_t offset = 0;
+			for (int t = 0; t < tiles; ++t)
+			{
+				const std::vector<cv::Point3f>& tile = tilePoints[t * MAX_LABELS + clouds[c].id];
+				std::copy(tile.begin(), tile.end(), points.begin() + offset);
+				offset += tile.size();
+			}
+
+			if (voxelSize > 0.0f)
+				voxelDownsample(points, voxelSize);
+		}
+	};
+
+	if (pool)
+		pool->parallelFor(0, static_cast<int>(clouds.size()), userBody);
+	else
+		userBody(0, static_cast<int>(clouds.size()));
+
+	return clouds;
+}
+
+void xncv::voxelDownsample(std::vector<cv::Point3f>& points, float voxelSize)
+{
+	if (points.empty() || voxelSize <= 0.0f)
+		return;
+
+	//Sorting by voxel key places the points of each voxel side by side
+	float inverseSize = 1.0f / voxelSize;
+	std::vector<std::pair<unsigned long long, int> > keys(points.size());
+	for (unsigned i = 0; i < points.size(); ++i)
+		keys[i] = std::make_pair(voxelKey(points[i], inverseSize), static_cast<int>(i));
+	std::sort(keys.begin(), keys.end());
+
+	std::vector<cv::Point3f> centroids;
+	for (unsigned i = 0; i < keys.size();)
+	{
+		unsigned j = i;
+		double x = 0, y = 0, z = 0;
+		for (; j < keys.size() && keys[j].first == keys[i].first; ++j)
+		{
+			const cv::Point3f& p = points[keys[j].second];
+			x += p.x;
+			y += p.y;
+			z += p.z;
+		}
+
+		double count = j - i;
+		centroids.push_back(cv::Point3f(static_cast<float>(x / count), static_cast<float>(y / count), static_cast<float>(z / count)));
+		i = j;
+	}
+
+	points.swap(centroids);
+}
@@ -0,0 +1,38 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__POINT_CLOUD_HPP__)
+#define __POINT_CLOUD_HPP__
+
+#include <vector>
+#include "functions.hpp"
+
+namespace xncv
+{
+	class ThreadPool;
+
+	struct PointCloud
+	{
+		XnUserID id;
+		std::vector<cv::Point3f> points;
+	};
+
+	//Builds one cloud per label. When voxelSize (in mm) is positive, the
+	//points inside each voxel are replaced by their centroid.
+	std::vector<PointCloud> calcPointClouds(const cv::Mat& labels, const cv::Mat& depth,
+		const Intrinsics& intrinsics, float voxelSize=0.0f, ThreadPool* pool=NULL);
+
+	void voxelDownsample(std::vector<cv::Point3f>& points, float voxelSize);
+}
+
+#endif
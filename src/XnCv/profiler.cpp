@@ -0,0 +1,439 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "profiler.hpp"
+#include "threading.hpp"
+#include <cstring>
+#include <iomanip>
+#include <algorithm>
+
+#if defined(_WIN32)
+	#define NOMINMAX
+	#include <windows.h>
+	#include <intrin.h>
+	#pragma intrinsic(_ReadWriteBarrier)
+	#define XNCV_THREAD_LOCAL __declspec(thread)
+	//x86 keeps stores and loads in order, only the compiler may move them
+	#define XNCV_BARRIER() _ReadWriteBarrier()
+#else
+	#include <time.h>
+	#define XNCV_THREAD_LOCAL __thread
+	#if defined(__i386__) || defined(__x86_64__)
+		#define XNCV_BARRIER() __asm__ __volatile__("" ::: "memory")
+	#else
+		#define XNCV_BARRIER() __sync_synchronize()
+	#endif
+#endif
+
+namespace
+{
+	const int MAX_PROBES = 128;
+
+	//Log-linear buckets, as in HDR histograms: values below SUB_BUCKETS
+	//are exact, and each power of two above it is split in SUB_BUCKETS.
+	const int SUB_BITS = 5;
+	const int SUB_BUCKETS = 1 << SUB_BITS;
+	const int MAX_EXPONENT = 40; //About 18 minutes in nanoseconds
+	const int BUCKETS = SUB_BUCKETS * (MAX_EXPONENT - SUB_BITS + 1);
+
+	struct Histogram
+	{
+		XnUInt32 buckets[BUCKETS];
+		XnUInt64 count;
+		XnUInt64 total;
+		XnUInt64 max;
+	};
+
+	//Each thread records in its own data, so probes take no locks. The
+	//sequence is odd while the owner updates the values, and readers copy
+	//them until they see the same even sequence before and after, so 64 bit
+	//values are never torn on 32 bit machines.
+	struct ThreadData
+	{
+		volatile XnUInt32 sequence;
+		XnUInt32 generation; //Values older than the registry one were reset
+		Histogram* timers[MAX_PROBES];
+		XnUInt64 counters[MAX_PROBES];
+	};
+
+	struct Registry
+	{
+		xncv::CriticalSection mutex;
+		std::vector<std::string> names;
+		std::vector<ThreadData*> threads;
+		volatile XnUInt32 generation;
+
+		//Values of finished threads, only touched under the lock
+		ThreadData retired;
+
+		std::ostream* dumpOutput;
+		unsigned dumpInterval;
+		XnUInt64 lastDump;
+
+		Registry() : generation(0), dumpOutput(NULL), dumpInterval(5000), lastDump(0)
+		{
+			memset(&retired, 0, sizeof(retired));
+		}
+	};
+
+	Registry& registry()
+	{
+		static Registry instance;
+		return instance;
+	}
+
+	XNCV_THREAD_LOCAL ThreadData* localData = NULL;
+
+	ThreadData& threadData()
+	{
+		if (!localData)
+		{
+			ThreadData* data = new ThreadData();
+			memset(data, 0, sizeof(ThreadData));
+
+			Registry& r = registry();
+			xncv::Lock lock(r.mutex);
+			r.threads.push_back(data);
+			localData = data;
+		}
+		return *localData;
+	}
+
+	//Only the owner thread writes its data. Values recorded before the last
+	//resetProfile are cleared here instead of by the resetting thread.
+	void beginUpdate(ThreadData& data)
+	{
+		data.sequence = data.sequence + 1;
+		XNCV_BARRIER();
+
+		XnUInt32 generation = registry().generation;
+		if (data.generation != generation)
+		{
+			memset(data.counters, 0, sizeof(data.counters));
+			for (int id = 0; id < MAX_PROBES; ++id)
+				if (data.timers[id])
+					memset(data.timers[id], 0, sizeof(Histogram));
+			data.generation = generation;
+		}
+	}
+
+	void endUpdate(ThreadData& data)
+	{
+		XNCV_BARRIER();
+		data.sequence = data.sequence + 1;
+	}
+
+	//Copies the values of a probe consistently. Returns false if they were
+	//recorded before the last reset.
+	bool readProbe(const ThreadData& data, int id, XnUInt32 generation, Histogram& histogram, XnUInt64& counter)
+	{
+		const Histogram* timer = data.timers[id];
+		XnUInt32 sequence;
+		bool current;
+		do
+		{
+			//The owner may have been preempted in the middle of an update
+			while ((sequence = data.sequence) & 1)
+				xnOSSleep(0);
+			XNCV_BARRIER();
+
+			current = data.generation == generation;
+			counter = data.counters[id];
+			if (timer)
+				memcpy(&histogram, timer, sizeof(Histogram));
+			XNCV_BARRIER();
+		} while (data.sequence != sequence);
+		return current;
+	}
+
+	void addHistogram(Histogram& total, const Histogram& histogram)
+	{
+		for (int b = 0; b < BUCKETS; ++b)
+			total.buckets[b] += histogram.buckets[b];
+		total.count += histogram.count;
+		total.total += histogram.total;
+		if (histogram.max > total.max)
+			total.max = histogram.max;
+	}
+
+	int probeId(xncv::ProfileSite& site)
+	{
+		if (site.id >= 0)
+			return site.id;
+
+		Registry& r = registry();
+		xncv::Lock lock(r.mutex);
+		int id = 0;
+		while (id < static_cast<int>(r.names.size()) && r.names[id] != site.name)
+			++id;
+		if (id == static_cast<int>(r.names.size()) && id < MAX_PROBES)
+			r.names.push_back(site.name);
+		site.id = id;
+		return id;
+	}
+
+	int bucketIndex(XnUInt64 value)
+	{
+		if (value < SUB_BUCKETS)
+			return static_cast<int>(value);
+
+		int exponent = SUB_BITS;
+		while (exponent < MAX_EXPONENT - 1 && (value >> (exponent + 1)) != 0)
+			++exponent;
+		if ((value >> (exponent + 1)) != 0)
+			return BUCKETS - 1;
+
+		int sub = static_cast<int>(value >> (exponent - SUB_BITS)) - SUB_BUCKETS;
+		return SUB_BUCKETS + (exponent - SUB_BITS) * SUB_BUCKETS + sub;
+	}
+
+	//Middle of the bucket range
+	double bucketValue(int index)
+	{
+		if (index < SUB_BUCKETS)
+			return index;
+
+		int shift = (index - SUB_BUCKETS) / SUB_BUCKETS;
+		int sub = (index - SUB_BUCKETS) % SUB_BUCKETS;
+		double low = static_cast<double>(static_cast<XnUInt64>(SUB_BUCKETS + sub) << shift);
+		return low + static_cast<double>(XnUInt64(1) << shift) / 2.0;
+	}
+
+	double percentile(const Histogram& histogram, double fraction)
+	{
+		XnUInt64 rank = static_cast<XnUInt64>(fraction * histogram.count + 0.5);
+		if (rank < 1)
+			rank = 1;
+
+		XnUInt64 seen = 0;
+		for (int i = 0; i < BUCKETS; ++i)
+		{
+			seen += histogram.buckets[i];
+			if (seen >= rank)
+				return bucketValue(i);
+		}
+		return static_cast<double>(histogram.max);
+	}
+}
+
+XnUInt64 xncv::profileClock()
+{
+#if defined(_WIN32)
+	static LARGE_INTEGER frequency = {0};
+	if (frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	XnUInt64 ticks = static_cast<XnUInt64>(counter.QuadPart);
+	XnUInt64 perSecond = static_cast<XnUInt64>(frequency.QuadPart);
+	return ticks / perSecond * 1000000000 + ticks % perSecond * 1000000000 / perSecond;
+#else
+	timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return static_cast<XnUInt64>(time.tv_sec) * 1000000000 + time.tv_nsec;
+#endif
+}
+
+void xncv::profileRecord(ProfileSite& site, XnUInt64 nanoseconds)
+{
+	int id = probeId(site);
+	if (id >= MAX_PROBES)
+		return;
+
+	ThreadData& data = threadData();
+	Histogram* histogram = data.timers[id];
+	if (!histogram)
+	{
+		histogram = new Histogram();
+		memset(histogram, 0, sizeof(Histogram));
+
+		//Published under the lock, so readers never see it half built
+		Registry& r = registry();
+		Lock lock(r.mutex);
+		data.timers[id] = histogram;
+	}
+
+	beginUpdate(data);
+	++histogram->buckets[bucketIndex(nanoseconds)];
+	++histogram->count;
+	histogram->total += nanoseconds;
+	if (nanoseconds > histogram->max)
+		histogram->max = nanoseconds;
+	endUpdate(data);
+}
+
+void xncv::profileCount(ProfileSite& site, XnUInt64 value)
+{
+	int id = probeId(site);
+	if (id >= MAX_PROBES)
+		return;
+
+	ThreadData& data = threadData();
+	beginUpdate(data);
+	data.counters[id] += value;
+	endUpdate(data);
+}
+
+xncv::ProfileStats xncv::profileStats()
+{
+	ProfileStats stats;
+	Registry& r = registry();
+	Lock lock(r.mutex);
+
+	Histogram merged;
+	Histogram histogram;
+	for (unsigned id = 0; id < r.names.size(); ++id)
+	{
+		memset(&merged, 0, sizeof(merged));
+		XnUInt64 counter = 0;
+		bool timed = false;
+		for (unsigned t = 0; t < r.threads.size(); ++t)
+		{
+			const ThreadData& data = *r.threads[t];
+			XnUInt64 threadCounter;
+			if (!readProbe(data, id, r.generation, histogram, threadCounter))
+				continue;
+			counter += threadCounter;
+
+			if (!data.timers[id])
+				continue;
+			timed = true;
+			addHistogram(merged, histogram);
+		}
+
+		counter += r.retired.counters[id];
+		if (r.retired.timers[id])
+		{
+			timed = true;
+			addHistogram(merged, *r.retired.timers[id]);
+		}
+
+		if (timed && merged.count > 0)
+		{
+			TimerStats timer;
+			timer.name = r.names[id];
+			timer.count = merged.count;
+			timer.total = merged.total / 1000.0;
+			timer.mean = timer.total / merged.count;
+			timer.p50 = percentile(merged, 0.50) / 1000.0;
+			timer.p90 = percentile(merged, 0.90) / 1000.0;
+			timer.p99 = percentile(merged, 0.99) / 1000.0;
+			timer.max = merged.max / 1000.0;
+			stats.timers.push_back(timer);
+		}
+
+		if (counter != 0)
+		{
+			CounterStats counterStats;
+			counterStats.name = r.names[id];
+			counterStats.value = counter;
+			stats.counters.push_back(counterStats);
+		}
+	}
+	return stats;
+}
+
+void xncv::resetProfile()
+{
+	//Threads clear their own values on their next probe, and until then
+	//profileStats skips them
+	Registry& r = registry();
+	Lock lock(r.mutex);
+	r.generation = r.generation + 1;
+
+	memset(r.retired.counters, 0, sizeof(r.retired.counters));
+	for (int id = 0; id < MAX_PROBES; ++id)
+		if (r.retired.timers[id])
+			memset(r.retired.timers[id], 0, sizeof(Histogram));
+}
+
+void xncv::profileThreadExit()
+{
+	ThreadData* data = localData;
+	if (!data)
+		return;
+	localData = NULL;
+
+	Registry& r = registry();
+	Lock lock(r.mutex);
+	r.threads.erase(std::find(r.threads.begin(), r.threads.end(), data));
+
+	//Values from before the last reset are dropped, as profileStats does
+	bool current = data->generation == r.generation;
+	for (int id = 0; id < MAX_PROBES; ++id)
+	{
+		Histogram* histogram = data->timers[id];
+		if (current)
+		{
+			r.retired.counters[id] += data->counters[id];
+			if (histogram && histogram->count > 0)
+			{
+				if (!r.retired.timers[id])
+				{
+					r.retired.timers[id] = new Histogram();
+					memset(r.retired.timers[id], 0, sizeof(Histogram));
+				}
+				addHistogram(*r.retired.timers[id], *histogram);
+			}
+		}
+		delete histogram;
+	}
+	delete data;
+}
+
+void xncv::dumpProfile(std::ostream& output)
+{
+	ProfileStats stats = profileStats();
+	if (stats.timers.empty() && stats.counters.empty())
+		return;
+
+	output << std::left << std::setw(32) << "timer (us)" << std::right
+		<< std::setw(10) << "count" << std::setw(10) << "mean" << std::setw(10) << "p50"
+		<< std::setw(10) << "p90" << std::setw(10) << "p99" << std::setw(10) << "max" << std::endl;
+	for (unsigned i = 0; i < stats.timers.size(); ++i)
+	{
+		const TimerStats& t = stats.timers[i];
+		output << std::left << std::setw(32) << t.name << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(10) << t.count << std::setw(10) << t.mean << std::setw(10) << t.p50
+			<< std::setw(10) << t.p90 << std::setw(10) << t.p99 << std::setw(10) << t.max << std::endl;
+	}
+
+	for (unsigned i = 0; i < stats.counters.size(); ++i)
+		output << std::left << std::setw(32) << stats.counters[i].name << std::right
+			<< std::setw(10) << stats.counters[i].value << std::endl;
+}
+
+void xncv::setProfileDump(std::ostream* output, unsigned interval)
+{
+	Registry& r = registry();
+	Lock lock(r.mutex);
+	r.dumpOutput = output;
+	r.dumpInterval = interval;
+	r.lastDump = profileClock();
+}
+
+void xncv::profileTick()
+{
+	std::ostream* output = NULL;
+	{
+		Registry& r = registry();
+		Lock lock(r.mutex);
+		XnUInt64 now = profileClock();
+		if (!r.dumpOutput || now - r.lastDump < static_cast<XnUInt64>(r.dumpInterval) * 1000000)
+			return;
+		r.lastDump = now;
+		output = r.dumpOutput;
+	}
+	dumpProfile(*output);
+}
@@ -0,0 +1,116 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__PROFILER_HPP__)
+#define __PROFILER_HPP__
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <XnOS.h>
+
+//Library entry points are instrumented with the macros below. They compile
+//to nothing unless XNCV_ENABLE_PROFILING is defined when building xncv.
+#if defined(XNCV_ENABLE_PROFILING)
+	#define XNCV_PROFILE_JOIN2(a, b) a##b
+	#define XNCV_PROFILE_JOIN(a, b) XNCV_PROFILE_JOIN2(a, b)
+
+	//Times the enclosing scope
+	#define XNCV_PROFILE_SCOPE(name) \
+		static xncv::ProfileSite XNCV_PROFILE_JOIN(xncvSite, __LINE__) = {name, -1}; \
+		xncv::ScopedTimer XNCV_PROFILE_JOIN(xncvTimer, __LINE__)(XNCV_PROFILE_JOIN(xncvSite, __LINE__))
+
+	//Adds value to a counter
+	#define XNCV_PROFILE_COUNT(name, value) \
+		do { \
+			static xncv::ProfileSite xncvSite = {name, -1}; \
+			xncv::profileCount(xncvSite, value); \
+		} while (false)
+#else
+	#define XNCV_PROFILE_SCOPE(name)
+	#define XNCV_PROFILE_COUNT(name, value) do {} while (false)
+#endif
+
+namespace xncv
+{
+	//Call site of a probe. Statically initialized, so it is safe to use
+	//from any thread; the id is looked up on the first use.
+	struct ProfileSite
+	{
+		const char* name;
+		int id;
+	};
+
+	struct TimerStats
+	{
+		std::string name;
+		XnUInt64 count;
+
+		//In microseconds. Percentiles are accurate to about 3%.
+		double total;
+		double mean;
+		double p50;
+		double p90;
+		double p99;
+		double max;
+	};
+
+	struct CounterStats
+	{
+		std::string name;
+		XnUInt64 value;
+	};
+
+	//Merged values of all threads
+	struct ProfileStats
+	{
+		std::vector<TimerStats> timers;
+		std::vector<CounterStats> counters;
+	};
+
+	//Process wide. Empty when profiling is disabled. Values recorded while
+	//the stats are read may or may not be included, but the values of each
+	//probe are read whole. Both are safe while other threads record.
+	ProfileStats profileStats();
+	void resetProfile();
+	void dumpProfile(std::ostream& output);
+
+	//Dumps the stats every interval milliseconds, checked by profileTick.
+	//A NULL output stops it.
+	void setProfileDump(std::ostream* output, unsigned interval=5000);
+	void profileTick();
+
+	//Used by the macros
+	XnUInt64 profileClock();
+	void profileRecord(ProfileSite& site, XnUInt64 nanoseconds);
+	void profileCount(ProfileSite& site, XnUInt64 value);
+
+	//Moves the values of the calling thread to the process totals and frees
+	//its data. Threads started by xncv::Thread call it when they finish.
+	void profileThreadExit();
+
+	class ScopedTimer
+	{
+		private:
+			ProfileSite& site;
+			XnUInt64 start;
+
+			ScopedTimer(const ScopedTimer&);
+			ScopedTimer& operator=(const ScopedTimer&);
+		public:
+			ScopedTimer(ProfileSite& profileSite) : site(profileSite), start(profileClock()) {}
+			~ScopedTimer() { profileRecord(site, profileClock() - start); }
+	};
+}
+
+#endif
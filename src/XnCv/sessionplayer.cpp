@@ -0,0 +1,226 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "sessionplayer.hpp"
+#include "exceptions.hpp"
+
+namespace
+{
+	//Mats are swapped, so the buffers of the old frame are reused
+	void moveFrame(xncv::SessionFrame& from, xncv::SessionFrame& to)
+	{
+		to.frame = from.frame;
+		to.skeletonFrame = from.skeletonFrame;
+		to.timestamp = from.timestamp;
+		std::swap(to.depth, from.depth);
+		std::swap(to.image, from.image);
+		to.skeletons = from.skeletons;
+	}
+}
+
+xncv::SessionFrame::SessionFrame() : frame(-1), skeletonFrame(-1), timestamp(0)
+{
+}
+
+xncv::SessionPlayer::SessionPlayer(const std::string& videoFile, const std::string& skeletonFile, unsigned prefetchFrames)
+	: video(videoFile), sync(SYNC_TIMESTAMP), frameOffset(0),
+	buffer(prefetchFrames == 0 ? 1 : prefetchFrames), head(0), count(0),
+	frameReady(true), spaceReady(true), stopping(false), endOfFile(false),
+	seekRequest(-1), generation(0), nextFrame(0)
+{
+	skeletons.open(skeletonFile);
+	frames = video.size();
+	video.getXnPlayer().SetRepeat(FALSE);
+	video.start();
+}
+
+void xncv::SessionPlayer::setSync(SessionSync mode, int offset)
+{
+	Lock lock(mutex);
+	if (mode == sync && offset == frameOffset)
+		return;
+	sync = mode;
+	frameOffset = offset;
+
+	//Frames read ahead were matched with the old settings, so they are
+	//read again from the first one not returned yet
+	if (prefetchThread.isRunning())
+		requestSeek(count > 0 ? buffer[head].frame : nextFrame);
+}
+
+int xncv::SessionPlayer::size() const
+{
+	return frames;
+}
+
+int xncv::SessionPlayer::toSkeletonFrame(int frame, XnUInt64 timestamp, SessionSync mode, int offset) const
+{
+	//Version 1 files have no timestamps
+	if (mode == SYNC_TIMESTAMP && skeletons.getVersion() >= 2)
+		return skeletons.findFrame(timestamp);
+
+	int skeletonFrame = frame + offset;
+	return skeletonFrame < 0 || skeletonFrame >= skeletons.frameCount() ? -1 : skeletonFrame;
+}
+
+void xncv::SessionPlayer::readFrame()
+{
+	//setSync may run concurrently, so the settings are read once under the lock
+	SessionSync mode;
+	int offset;
+	{
+		Lock lock(mutex);
+		mode = sync;
+		offset = frameOffset;
+	}
+
+	video.update();
+	staging.frame = video.currentFrame();
+	staging.timestamp = video.getXnDepthGenerator().GetTimestamp();
+	video.captureDepth().copyTo(staging.depth);
+	video.captureBGR().copyTo(staging.image);
+
+	staging.skeletonFrame = toSkeletonFrame(staging.frame, staging.timestamp, mode, offset);
+	if (staging.skeletonFrame == -1 || !skeletons.getSnapshot(staging.skeletonFrame, staging.skeletons))
+	{
+		staging.skeletonFrame = -1;
+		staging.skeletons.clear();
+	}
+}
+
+void xncv::SessionPlayer::prefetch()
+{
+	for (;;)
+	{
+		int target;
+		int requestGeneration;
+		{
+			Lock lock(mutex);
+			while (!stopping && seekRequest < 0 && (endOfFile || count == static_cast<int>(buffer.size())))
+			{
+				spaceReady.reset();
+				mutex.unlock();
+				spaceReady.wait();
+				mutex.lock();
+			}
+			if (stopping)
+				return;
+
+			target = seekRequest;
+			seekRequest = -1;
+			requestGeneration = generation;
+		}
+
+		//Only this thread touches OpenNI and the skeleton reader while playing
+		bool finished = false;
+		std::exception_ptr readError;
+		try
+		{
+			if (target >= 0)
+				video.goTo(target);
+
+			finished = video.getXnPlayer().IsEOF() != FALSE;
+			if (!finished)
+				readFrame();
+		}
+		catch (...)
+		{
+			readError = std::current_exception();
+			finished = true;
+		}
+
+		Lock lock(mutex);
+		if (requestGeneration != generation)
+			continue; //A seek arrived while reading
+
+		if (finished)
+		{
+			endOfFile = true;
+			error = readError;
+		}
+		else
+		{
+			moveFrame(staging, buffer[(head + count) % buffer.size()]);
+			++count;
+		}
+		frameReady.set();
+	}
+}
+
+bool xncv::SessionPlayer::next(SessionFrame& frame)
+{
+	if (!prefetchThread.isRunning())
+		prefetchThread.start([this]() { prefetch(); });
+
+	Lock lock(mutex);
+	while (count == 0 && !endOfFile)
+	{
+		frameReady.reset();
+		mutex.unlock();
+		frameReady.wait();
+		mutex.lock();
+	}
+
+	if (error)
+	{
+		std::exception_ptr readError = error;
+		error = std::exception_ptr();
+		std::rethrow_exception(readError);
+	}
+
+	if (count == 0)
+		return false;
+
+	moveFrame(buffer[head], frame);
+	nextFrame = frame.frame + 1;
+	head = (head + 1) % buffer.size();
+	--count;
+	spaceReady.set();
+	return true;
+}
+
+void xncv::SessionPlayer::seek(int frame)
+{
+	Lock lock(mutex);
+	requestSeek(frame);
+}
+
+void xncv::SessionPlayer::requestSeek(int frame)
+{
+	seekRequest = frame < 0 ? 0 : frame;
+	nextFrame = seekRequest;
+	++generation;
+	head = 0;
+	count = 0;
+	endOfFile = false;
+	error = std::exception_ptr();
+	spaceReady.set();
+}
+
+xncv::SessionPlayer::~SessionPlayer()
+{
+	{
+		Lock lock(mutex);
+		stopping = true;
+		spaceReady.set();
+	}
+	prefetchThread.join();
+
+	try
+	{
+		video.stop();
+	}
+	catch (...)
+	{
+	}
+}
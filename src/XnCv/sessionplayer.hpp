@@ -0,0 +1,99 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__SESSION_PLAYER_HPP__)
+#define __SESSION_PLAYER_HPP__
+
+#include <exception>
+#include "videosource.hpp"
+#include "skeletonio.hpp"
+#include "threading.hpp"
+
+namespace xncv
+{
+	//How video frames are matched to skeleton frames
+	enum SessionSync {SYNC_TIMESTAMP, SYNC_FRAME_NUMBER};
+
+	struct SessionFrame
+	{
+		int frame; //Video frame
+		int skeletonFrame; //-1 if no skeleton was recorded for this frame
+		XnUInt64 timestamp;
+		cv::Mat depth;
+		cv::Mat image;
+		SkeletonSnapshot skeletons;
+
+		SessionFrame();
+	};
+
+	//Plays an .oni recording together with its skeleton file. Frames of both
+	//are read ahead by a background thread, so next() rarely waits.
+	class SessionPlayer
+	{
+		private:
+			VideoSource video;
+			SkeletonReader skeletons;
+			SessionSync sync;
+			int frameOffset;
+			int frames;
+
+			//Frames read ahead, recycled so their buffers are reused
+			std::vector<SessionFrame> buffer;
+			int head;
+			int count;
+			SessionFrame staging;
+
+			Thread prefetchThread;
+			CriticalSection mutex;
+			Event frameReady;
+			Event spaceReady;
+			bool stopping;
+			bool endOfFile;
+			int seekRequest;
+			int generation;
+			int nextFrame; //Video frame after the last returned one
+			std::exception_ptr error;
+
+			void prefetch();
+			void readFrame();
+			void requestSeek(int frame);
+			int toSkeletonFrame(int frame, XnUInt64 timestamp, SessionSync mode, int offset) const;
+
+			SessionPlayer(const SessionPlayer&);
+			SessionPlayer& operator=(const SessionPlayer&);
+
+		public:
+			SessionPlayer(const std::string& videoFile, const std::string& skeletonFile, unsigned prefetchFrames=8);
+
+			//Frame numbers are only used when the skeleton file has no
+			//timestamps. skeletonFrame = videoFrame + frameOffset. Frames
+			//read ahead are discarded and read again with the new settings.
+			void setSync(SessionSync mode, int frameOffset=0);
+
+			//Returns false at the end of the recording
+			bool next(SessionFrame& frame);
+
+			//Discards the frames read ahead and restarts reading at frame
+			void seek(int frame);
+
+			int size() const;
+
+			//Not thread safe while the player is running
+			VideoSource& getVideoSource() { return video; }
+			const SkeletonReader& getSkeletonReader() const { return skeletons; }
+
+			~SessionPlayer();
+	};
+}
+
+#endif
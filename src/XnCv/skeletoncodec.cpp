@@ -0,0 +1,407 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "skeletoncodec.hpp"
+#include "exceptions.hpp"
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	const float SQRT1_2 = 0.70710678f;
+	const float CONFIDENCE_SCALE = 200.0f;
+
+	//-------------------------------------------------------------------------
+	//Variable length integers
+	//-------------------------------------------------------------------------
+	inline void putVarint(std::vector<char>& out, XnUInt64 value)
+	{
+		while (value >= 0x80)
+		{
+			out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+			value >>= 7;
+		}
+		out.push_back(static_cast<char>(value));
+	}
+
+	inline void putSigned(std::vector<char>& out, int value)
+	{
+		//Zigzag keeps small negative deltas small
+		putVarint(out, (static_cast<XnUInt32>(value) << 1) ^ static_cast<XnUInt32>(value >> 31));
+	}
+
+	struct Input
+	{
+		const unsigned char* data;
+		const unsigned char* end;
+
+		void corrupted()
+		{
+			throw xncv::Exception("Corrupted compressed skeleton frame");
+		}
+
+		unsigned char byte()
+		{
+			if (data == end)
+				corrupted();
+			return *data++;
+		}
+
+		XnUInt64 varint()
+		{
+			XnUInt64 value = 0;
+			for (int shift = 0; shift < 64; shift += 7)
+			{
+				unsigned char b = byte();
+				value |= static_cast<XnUInt64>(b & 0x7F) << shift;
+				if (!(b & 0x80))
+					return value;
+			}
+			corrupted();
+			return 0;
+		}
+
+		int signedValue()
+		{
+			XnUInt32 value = static_cast<XnUInt32>(varint());
+			return static_cast<int>(value >> 1) ^ -static_cast<int>(value & 1);
+		}
+	};
+
+	//-------------------------------------------------------------------------
+	//Orientation
+	//-------------------------------------------------------------------------
+	void toQuaternion(const float* m, float q[4])
+	{
+		float trace = m[0] + m[4] + m[8];
+		if (trace > 0.0f)
+		{
+			float s = 0.5f / sqrt(trace + 1.0f);
+			q[3] = 0.25f / s;
+			q[0] = (m[7] - m[5]) * s;
+			q[1] = (m[2] - m[6]) * s;
+			q[2] = (m[3] - m[1]) * s;
+		}
+		else if (m[0] > m[4] && m[0] > m[8])
+		{
+			float s = 2.0f * sqrt(std::max(1.0f + m[0] - m[4] - m[8], 1e-12f));
+			q[3] = (m[7] - m[5]) / s;
+			q[0] = 0.25f * s;
+			q[1] = (m[1] + m[3]) / s;
+			q[2] = (m[2] + m[6]) / s;
+		}
+		else if (m[4] > m[8])
+		{
+			float s = 2.0f * sqrt(std::max(1.0f + m[4] - m[0] - m[8], 1e-12f));
+			q[3] = (m[2] - m[6]) / s;
+			q[0] = (m[1] + m[3]) / s;
+			q[1] = 0.25f * s;
+			q[2] = (m[5] + m[7]) / s;
+		}
+		else
+		{
+			float s = 2.0f * sqrt(std::max(1.0f + m[8] - m[0] - m[4], 1e-12f));
+			q[3] = (m[3] - m[1]) / s;
+			q[0] = (m[2] + m[6]) / s;
+			q[1] = (m[5] + m[7]) / s;
+			q[2] = 0.25f * s;
+		}
+
+		float norm = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+		if (norm == 0.0f)
+		{
+			q[0] = q[1] = q[2] = 0.0f;
+			q[3] = 1.0f;
+			return;
+		}
+		for (int i = 0; i < 4; ++i)
+			q[i] /= norm;
+	}
+
+	void toMatrix(const float q[4], float* m)
+	{
+		float x = q[0], y = q[1], z = q[2], w = q[3];
+		m[0] = 1.0f - 2.0f * (y * y + z * z);
+		m[1] = 2.0f * (x * y - z * w);
+		m[2] = 2.0f * (x * z + y * w);
+		m[3] = 2.0f * (x * y + z * w);
+		m[4] = 1.0f - 2.0f * (x * x + z * z);
+		m[5] = 2.0f * (y * z - x * w);
+		m[6] = 2.0f * (x * z - y * w);
+		m[7] = 2.0f * (y * z + x * w);
+		m[8] = 1.0f - 2.0f * (x * x + y * y);
+	}
+
+	//Smallest three: the largest component is dropped and rebuilt from the
+	//unit length, the others lie in [-1/sqrt(2), 1/sqrt(2)].
+	XnUInt64 packQuaternion(const float* matrix, unsigned bits)
+	{
+		float q[4];
+		toQuaternion(matrix, q);
+
+		int largest = 0;
+		for (int i = 1; i < 4; ++i)
+			if (fabs(q[i]) > fabs(q[largest]))
+				largest = i;
+		float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+
+		XnUInt32 maxValue = (1u << bits) - 1;
+		XnUInt64 packed = static_cast<XnUInt64>(largest);
+		for (int i = 0; i < 4; ++i)
+		{
+			if (i == largest)
+				continue;
+			float normalized = (sign * q[i] / SQRT1_2) * 0.5f + 0.5f;
+			normalized = std::min(std::max(normalized, 0.0f), 1.0f);
+			packed = (packed << bits) | static_cast<XnUInt32>(normalized * maxValue + 0.5f);
+		}
+		return packed;
+	}
+
+	void unpackQuaternion(XnUInt64 packed, unsigned bits, float* matrix)
+	{
+		XnUInt32 maxValue = (1u << bits) - 1;
+		int largest = static_cast<int>((packed >> (3 * bits)) & 3);
+
+		float q[4];
+		float sum = 0.0f;
+		for (int i = 3; i >= 0; --i)
+		{
+			if (i == largest)
+				continue;
+			float normalized = static_cast<float>(packed & maxValue) / maxValue;
+			packed >>= bits;
+			q[i] = (normalized * 2.0f - 1.0f) * SQRT1_2;
+			sum += q[i] * q[i];
+		}
+		q[largest] = sqrt(std::max(1.0f - sum, 0.0f));
+		toMatrix(q, matrix);
+	}
+
+	inline unsigned char quantizeConfidence(float confidence)
+	{
+		return static_cast<unsigned char>(std::min(std::max(confidence, 0.0f), 1.0f) * CONFIDENCE_SCALE + 0.5f);
+	}
+
+	xncv::CodecParams validate(const xncv::CodecParams& params)
+	{
+		xncv::CodecParams valid = params;
+		valid.quaternionBits = std::min(std::max(valid.quaternionBits, 2u), 20u);
+		if (!(valid.positionStep > 0.0f))
+			valid.positionStep = 1.0f;
+		if (valid.keyframeInterval == 0)
+			valid.keyframeInterval = 1;
+		return valid;
+	}
+
+	const xncv::QuantizedUser* findUser(const std::vector<xncv::QuantizedUser>& users, XnUserID id)
+	{
+		for (unsigned i = 0; i < users.size(); ++i)
+			if (users[i].id == id)
+				return &users[i];
+		return NULL;
+	}
+}
+
+xncv::CodecParams::CodecParams(float step, unsigned bits, unsigned interval, bool storeProjective)
+	: positionStep(step), quaternionBits(bits), keyframeInterval(interval), projective(storeProjective)
+{
+}
+
+//-----------------------------------------------------------------------------
+//Encoder
+//-----------------------------------------------------------------------------
+xncv::SkeletonEncoder::SkeletonEncoder(const CodecParams& codecParams)
+{
+	setParams(codecParams);
+}
+
+void xncv::SkeletonEncoder::setParams(const CodecParams& codecParams)
+{
+	params = validate(codecParams);
+	reset();
+}
+
+const xncv::CodecParams& xncv::SkeletonEncoder::getParams() const
+{
+	return params;
+}
+
+void xncv::SkeletonEncoder::reset()
+{
+	previous.clear();
+	current.clear();
+	lastFrame = -1;
+	lastKeyframe = -1;
+	keyframe = true;
+}
+
+void xncv::SkeletonEncoder::forceKeyframe()
+{
+	lastFrame = -1;
+}
+
+bool xncv::SkeletonEncoder::beginFrame(int frame)
+{
+	keyframe = lastFrame == -1 || frame != lastFrame + 1 ||
+		frame - lastKeyframe >= static_cast<int>(params.keyframeInterval);
+	if (keyframe)
+	{
+		previous.clear();
+		lastKeyframe = frame;
+	}
+	lastFrame = frame;
+	current.clear();
+	return keyframe;
+}
+
+void xncv::SkeletonEncoder::encode(const SkeletonSnapshot& snapshot, int slot, std::vector<char>& out)
+{
+	current.push_back(QuantizedUser());
+	QuantizedUser& user = current.back();
+	user.id = snapshot.users[slot];
+	user.mask = 0;
+	for (int j = 0; j < MAX_JOINTS; ++j)
+		if (snapshot.present[slot * MAX_JOINTS + j])
+			user.mask |= 1u << j;
+
+	const QuantizedUser* reference = findUser(previous, user.id);
+	putVarint(out, user.id);
+	putVarint(out, user.mask);
+
+	float scale = 1.0f / params.positionStep;
+	for (int j = 0; j < MAX_JOINTS; ++j)
+	{
+		if (!(user.mask & (1u << j)))
+			continue;
+
+		int i = slot * MAX_JOINTS + j;
+		bool hasReference = reference && (reference->mask & (1u << j));
+
+		unsigned char orientationConfidence = quantizeConfidence(snapshot.orientationConfidence[i]);
+		out.push_back(static_cast<char>(quantizeConfidence(snapshot.confidence[i])));
+		out.push_back(static_cast<char>(orientationConfidence));
+
+		int* position = user.position[j];
+		position[0] = cvRound(snapshot.x[i] * scale);
+		position[1] = cvRound(snapshot.y[i] * scale);
+		position[2] = cvRound(snapshot.z[i] * scale);
+		for (int axis = 0; axis < 3; ++axis)
+			putSigned(out, position[axis] - (hasReference ? reference->position[j][axis] : 0));
+
+		if (params.projective)
+		{
+			int* projective = user.projective[j];
+			projective[0] = snapshot.projectiveX[i];
+			projective[1] = snapshot.projectiveY[i];
+			for (int axis = 0; axis < 2; ++axis)
+				putSigned(out, projective[axis] - (hasReference ? reference->projective[j][axis] : 0));
+		}
+
+		//Orientations without confidence carry no information
+		if (orientationConfidence != 0)
+			putVarint(out, packQuaternion(snapshot.orientation[i], params.quaternionBits));
+	}
+}
+
+void xncv::SkeletonEncoder::endFrame()
+{
+	previous.swap(current);
+	current.clear();
+}
+
+//-----------------------------------------------------------------------------
+//Decoder
+//-----------------------------------------------------------------------------
+xncv::SkeletonDecoder::SkeletonDecoder(const CodecParams& codecParams)
+{
+	setParams(codecParams);
+}
+
+void xncv::SkeletonDecoder::setParams(const CodecParams& codecParams)
+{
+	params = validate(codecParams);
+	reset();
+}
+
+const xncv::CodecParams& xncv::SkeletonDecoder::getParams() const
+{
+	return params;
+}
+
+void xncv::SkeletonDecoder::reset()
+{
+	previous.clear();
+	current.clear();
+}
+
+void xncv::SkeletonDecoder::decode(const char* data, size_t length, XnUInt16 users, bool continuous, SkeletonSnapshot& snapshot)
+{
+	if (!continuous)
+		previous.clear();
+
+	Input input;
+	input.data = reinterpret_cast<const unsigned char*>(data);
+	input.end = input.data + length;
+
+	current.resize(users);
+	for (int u = 0; u < users; ++u)
+	{
+		QuantizedUser& user = current[u];
+		user.id = static_cast<XnUserID>(input.varint());
+		user.mask = static_cast<XnUInt32>(input.varint());
+
+		const QuantizedUser* reference = findUser(previous, user.id);
+
+		//Users that do not fit the snapshot are decoded only as reference
+		int slot = snapshot.addUser(user.id);
+		for (int j = 0; j < MAX_JOINTS; ++j)
+		{
+			if (!(user.mask & (1u << j)))
+				continue;
+
+			bool hasReference = reference && (reference->mask & (1u << j));
+			float confidence = input.byte() / CONFIDENCE_SCALE;
+			float orientationConfidence = input.byte() / CONFIDENCE_SCALE;
+
+			int* position = user.position[j];
+			for (int axis = 0; axis < 3; ++axis)
+				position[axis] = input.signedValue() + (hasReference ? reference->position[j][axis] : 0);
+
+			int* projective = user.projective[j];
+			for (int axis = 0; params.projective && axis < 2; ++axis)
+				projective[axis] = input.signedValue() + (hasReference ? reference->projective[j][axis] : 0);
+
+			XnUInt64 quaternion = orientationConfidence != 0.0f ? input.varint() : 0;
+			if (slot == -1)
+				continue;
+
+			int i = slot * MAX_JOINTS + j;
+			snapshot.present[i] = 1;
+			snapshot.x[i] = position[0] * params.positionStep;
+			snapshot.y[i] = position[1] * params.positionStep;
+			snapshot.z[i] = position[2] * params.positionStep;
+			snapshot.confidence[i] = confidence;
+			snapshot.projectiveX[i] = params.projective ? projective[0] : 0;
+			snapshot.projectiveY[i] = params.projective ? projective[1] : 0;
+			snapshot.orientationConfidence[i] = orientationConfidence;
+			if (orientationConfidence != 0.0f)
+				unpackQuaternion(quaternion, params.quaternionBits, snapshot.orientation[i]);
+			else
+				memset(snapshot.orientation[i], 0, sizeof(snapshot.orientation[i]));
+		}
+	}
+
+	previous.swap(current);
+}
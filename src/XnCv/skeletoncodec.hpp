@@ -0,0 +1,89 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__SKELETON_CODEC_HPP__)
+#define __SKELETON_CODEC_HPP__
+
+#include <vector>
+#include "snapshot.hpp"
+
+namespace xncv
+{
+	struct CodecParams
+	{
+		float positionStep; //Millimetres per quantization step
+		unsigned quaternionBits; //Bits of each stored quaternion component (2 to 20)
+		unsigned keyframeInterval; //Maximum number of frames between keyframes
+		bool projective; //Stores projective coordinates
+
+		CodecParams(float step=1.0f, unsigned bits=12, unsigned interval=30, bool storeProjective=true);
+	};
+
+	//Quantized joints of a user, used as reference for the next frame
+	struct QuantizedUser
+	{
+		XnUserID id;
+		XnUInt32 mask;
+		int position[MAX_JOINTS][3];
+		int projective[MAX_JOINTS][2];
+	};
+
+	//Positions are stored as deltas from the previous frame and orientations
+	//as quantized quaternions, all packed in variable length integers.
+	class SkeletonEncoder
+	{
+		private:
+			CodecParams params;
+			std::vector<QuantizedUser> previous;
+			std::vector<QuantizedUser> current;
+			int lastFrame;
+			int lastKeyframe;
+			bool keyframe;
+
+		public:
+			SkeletonEncoder(const CodecParams& codecParams=CodecParams());
+			void setParams(const CodecParams& codecParams);
+			const CodecParams& getParams() const;
+			void reset();
+
+			//Starts a frame and returns true if it must be stored as a keyframe
+			bool beginFrame(int frame);
+			void encode(const SkeletonSnapshot& snapshot, int slot, std::vector<char>& out);
+			void endFrame();
+
+			//The next frame will not depend on the previous ones. Used when
+			//an encoded frame is discarded.
+			void forceKeyframe();
+	};
+
+	class SkeletonDecoder
+	{
+		private:
+			CodecParams params;
+			std::vector<QuantizedUser> previous;
+			std::vector<QuantizedUser> current;
+
+		public:
+			SkeletonDecoder(const CodecParams& codecParams=CodecParams());
+			void setParams(const CodecParams& codecParams);
+			const CodecParams& getParams() const;
+			void reset();
+
+			//Decodes the users of a frame. Frames must be decoded in order,
+			//starting at a keyframe. Set continuous to false when the previous
+			//decoded frame is not the one right before this one.
+			void decode(const char* data, size_t length, XnUInt16 users, bool continuous, SkeletonSnapshot& snapshot);
+	};
+}
+
+#endif
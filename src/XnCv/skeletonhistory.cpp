@@ -0,0 +1,365 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "skeletonhistory.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+xncv::SkeletonHistory::SkeletonHistory(int frames)
+	: capacity(0)
+{
+	setCapacity(frames);
+}
+
+void xncv::SkeletonHistory::setCapacity(int frames)
+{
+	capacity = frames < 2 ? 2 : frames;
+	for (int i = 0; i < MAX_USERS; ++i)
+	{
+		Track& track = tracks[i];
+		track.timestamps.assign(capacity, 0);
+		track.positions.assign(capacity * AXES * MAX_JOINTS, 0.0f);
+		track.present.assign(capacity * MAX_JOINTS, 0);
+		track.path.assign(capacity * MAX_JOINTS, 0.0);
+		track.extremes.assign(EXTREMES * capacity, 0);
+		resetTrack(track, 0);
+	}
+}
+
+int xncv::SkeletonHistory::getCapacity() const
+{
+	return capacity;
+}
+
+void xncv::SkeletonHistory::reset()
+{
+	for (int i = 0; i < MAX_USERS; ++i)
+		resetTrack(tracks[i], 0);
+}
+
+void xncv::SkeletonHistory::resetTrack(Track& track, XnUserID id)
+{
+	track.id = id;
+	track.count = 0;
+	memset(track.seen, 0, sizeof(track.seen));
+	memset(track.head, 0, sizeof(track.head));
+	memset(track.length, 0, sizeof(track.length));
+}
+
+int xncv::SkeletonHistory::findTrack(XnUserID id) const
+{
+	if (id == 0)
+		return -1;
+	for (int i = 0; i < MAX_USERS; ++i)
+		if (tracks[i].id == id)
+			return i;
+	return -1;
+}
+
+int xncv::SkeletonHistory::findSlot(XnUserID id, const SkeletonSnapshot& snapshot)
+{
+	int slot = findTrack(id);
+	if (slot != -1)
+		return slot;
+
+	//New user, reuses the track of someone who left the scene
+	for (int i = 0; i < MAX_USERS; ++i)
+	{
+		if (tracks[i].id != 0 && snapshot.findUser(tracks[i].id) != -1)
+			continue;
+		resetTrack(tracks[i], id);
+		return i;
+	}
+	return -1;
+}
+
+void xncv::SkeletonHistory::push(const SkeletonSnapshot& snapshot)
+{
+	for (int s = 0; s < snapshot.userCount; ++s)
+	{
+		int slot = findSlot(snapshot.users[s], snapshot);
+		if (slot != -1)
+			push(tracks[slot], snapshot, s);
+	}
+}
+
+const float* xncv::SkeletonHistory::sample(const Track& track, int number) const
+{
+	return &track.positions[(number % capacity) * AXES * MAX_JOINTS];
+}
+
+void xncv::SkeletonHistory::push(Track& track, const SkeletonSnapshot& snapshot, int slot)
+{
+	int number = track.count;
+	int index = number % capacity;
+	int previous = (number + capacity - 1) % capacity;
+
+	float* position = &track.positions[index * AXES * MAX_JOINTS];
+	const float* last = &track.positions[previous * AXES * MAX_JOINTS];
+	unsigned char* present = &track.present[index * MAX_JOINTS];
+	double* path = &track.path[index * MAX_JOINTS];
+	const double* lastPath = &track.path[previous * MAX_JOINTS];
+
+	track.timestamps[index] = snapshot.timestamp;
+	const int first = slot * MAX_JOINTS;
+	for (int j = 0; j < MAX_JOINTS; ++j)
+	{
+		int i = first + j;
+		present[j] = snapshot.present[i] && snapshot.confidence[i] > 0.0f;
+		if (present[j])
+		{
+			position[j] = snapshot.x[i];
+			position[MAX_JOINTS + j] = snapshot.y[i];
+			position[2 * MAX_JOINTS + j] = snapshot.z[i];
+		}
+		else
+		{
+			for (int axis = 0; axis < AXES; ++axis)
+				position[axis * MAX_JOINTS + j] = track.seen[j] ? last[axis * MAX_JOINTS + j] : 0.0f;
+		}
+
+		if (number == 0 || !track.seen[j])
+			path[j] = number == 0 ? 0.0 : lastPath[j];
+		else
+		{
+			float dx = position[j] - last[j];
+			float dy = position[MAX_JOINTS + j] - last[MAX_JOINTS + j];
+			float dz = position[2 * MAX_JOINTS + j] - last[2 * MAX_JOINTS + j];
+			path[j] = lastPath[j] + sqrt(dx * dx + dy * dy + dz * dz);
+		}
+
+		if (present[j])
+			track.seen[j] = 1;
+	}
+
+	++track.count;
+	for (int j = 0; j < MAX_JOINTS; ++j)
+	{
+		if (!track.seen[j])
+			continue;
+		for (int axis = 0; axis < AXES; ++axis)
+		{
+			int deque = 2 * (axis * MAX_JOINTS + j);
+			pushExtreme(track, deque, number, false);
+			pushExtreme(track, deque + 1, number, true);
+		}
+	}
+}
+
+void xncv::SkeletonHistory::pushExtreme(Track& track, int deque, int number, bool isMax)
+{
+	int* samples = &track.extremes[deque * capacity];
+	int& head = track.head[deque];
+	int& length = track.length[deque];
+
+	//deque / 2 is the offset of the joint axis inside a sample
+	int offset = deque / 2;
+	float value = sample(track, number)[offset];
+
+	//Samples overwritten by this one leave from the front, so the deque
+	//holds at most capacity - 1 entries before the push...
+	while (length > 0 && samples[head] <= number - capacity)
+	{
+		head = (head + 1) % capacity;
+		--length;
+	}
+
+	//...and the ones that can no longer be the extreme from the back
+	while (length > 0)
+	{
+		float back = sample(track, samples[(head + length - 1) % capacity])[offset];
+		if (isMax ? back > value : back < value)
+			break;
+		--length;
+	}
+	samples[(head + length) % capacity] = number;
+	++length;
+}
+
+int xncv::SkeletonHistory::frontExtreme(const Track& track, int deque, int first) const
+{
+	//Sample numbers grow from front to back, so the extreme of the window
+	//is the first entry not older than it
+	const int* samples = &track.extremes[deque * capacity];
+	int low = 0, high = track.length[deque] - 1;
+	while (low < high)
+	{
+		int middle = (low + high) / 2;
+		if (samples[(track.head[deque] + middle) % capacity] < first)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return samples[(track.head[deque] + low) % capacity];
+}
+
+int xncv::SkeletonHistory::size(XnUserID id) const
+{
+	int slot = findTrack(id);
+	if (slot == -1)
+		return 0;
+	return std::min(tracks[slot].count, capacity);
+}
+
+bool xncv::SkeletonHistory::window(XnUserID id, XnSkeletonJoint joint, int samples, int minimum,
+	const Track*& track, int& first, int& last) const
+{
+	int slot = findTrack(id);
+	if (slot == -1 || joint < XN_SKEL_HEAD || joint > MAX_JOINTS)
+		return false;
+
+	track = &tracks[slot];
+	int stored = std::min(track->count, capacity);
+	if (samples <= 0 || samples > stored)
+		samples = stored;
+	if (samples < minimum)
+		return false;
+
+	last = track->count - 1;
+	first = last - samples + 1;
+
+	//Held positions are not measurements, so both ends must be present
+	int j = joint - 1;
+	return track->present[(first % capacity) * MAX_JOINTS + j] &&
+		track->present[(last % capacity) * MAX_JOINTS + j];
+}
+
+bool xncv::SkeletonHistory::getPosition(XnUserID id, XnSkeletonJoint joint, XnPoint3D& position, int age) const
+{
+	int slot = findTrack(id);
+	if (slot == -1 || joint < XN_SKEL_HEAD || joint > MAX_JOINTS || age < 0 || age >= size(id))
+		return false;
+
+	const Track& track = tracks[slot];
+	int number = track.count - 1 - age;
+	int j = joint - 1;
+	if (!track.present[(number % capacity) * MAX_JOINTS + j])
+		return false;
+
+	const float* p = sample(track, number);
+	position.X = p[j];
+	position.Y = p[MAX_JOINTS + j];
+	position.Z = p[2 * MAX_JOINTS + j];
+	return true;
+}
+
+bool xncv::SkeletonHistory::getDisplacement(XnUserID id, XnSkeletonJoint joint, XnVector3D& displacement, int samples) const
+{
+	const Track* track;
+	int first, last;
+	if (!window(id, joint, samples, 2, track, first, last))
+		return false;
+
+	const float* a = sample(*track, first);
+	const float* b = sample(*track, last);
+	int j = joint - 1;
+	displacement.X = b[j] - a[j];
+	displacement.Y = b[MAX_JOINTS + j] - a[MAX_JOINTS + j];
+	displacement.Z = b[2 * MAX_JOINTS + j] - a[2 * MAX_JOINTS + j];
+	return true;
+}
+
+bool xncv::SkeletonHistory::getVelocity(XnUserID id, XnSkeletonJoint joint, XnVector3D& velocity, int samples) const
+{
+	const Track* track;
+	int first, last;
+	if (!window(id, joint, samples, 2, track, first, last))
+		return false;
+
+	XnUInt64 t0 = track->timestamps[first % capacity];
+	XnUInt64 t1 = track->timestamps[last % capacity];
+	if (t1 <= t0)
+		return false;
+
+	XnVector3D displacement;
+	getDisplacement(id, joint, displacement, last - first + 1);
+	float seconds = static_cast<float>(t1 - t0) / 1000000.0f;
+	velocity.X = displacement.X / seconds;
+	velocity.Y = displacement.Y / seconds;
+	velocity.Z = displacement.Z / seconds;
+	return true;
+}
+
+bool xncv::SkeletonHistory::getAcceleration(XnUserID id, XnSkeletonJoint joint, XnVector3D& acceleration, int samples) const
+{
+	const Track* track;
+	int first, last;
+	if (!window(id, joint, samples, 3, track, first, last))
+		return false;
+
+	//Velocities of the first and last steps, placed at their mid times
+	double t[4];
+	const float* p[4];
+	int numbers[4] = {first, first + 1, last - 1, last};
+	for (int i = 0; i < 4; ++i)
+	{
+		t[i] = static_cast<double>(track->timestamps[numbers[i] % capacity]) / 1000000.0;
+		p[i] = sample(*track, numbers[i]);
+	}
+
+	double dt0 = t[1] - t[0];
+	double dt1 = t[3] - t[2];
+	double span = (t[3] + t[2] - t[1] - t[0]) / 2.0;
+	if (dt0 <= 0.0 || dt1 <= 0.0 || span <= 0.0)
+		return false;
+
+	float* out[AXES] = {&acceleration.X, &acceleration.Y, &acceleration.Z};
+	int j = joint - 1;
+	for (int axis = 0; axis < AXES; ++axis)
+	{
+		int o = axis * MAX_JOINTS + j;
+		double v0 = (p[1][o] - p[0][o]) / dt0;
+		double v1 = (p[3][o] - p[2][o]) / dt1;
+		*out[axis] = static_cast<float>((v1 - v0) / span);
+	}
+	return true;
+}
+
+bool xncv::SkeletonHistory::getPathLength(XnUserID id, XnSkeletonJoint joint, float& length, int samples) const
+{
+	const Track* track;
+	int first, last;
+	if (!window(id, joint, samples, 2, track, first, last))
+		return false;
+
+	int j = joint - 1;
+	length = static_cast<float>(track->path[(last % capacity) * MAX_JOINTS + j] -
+		track->path[(first % capacity) * MAX_JOINTS + j]);
+	return true;
+}
+
+bool xncv::SkeletonHistory::getRange(XnUserID id, XnSkeletonJoint joint, XnPoint3D& minimum, XnPoint3D& maximum, int samples) const
+{
+	int slot = findTrack(id);
+	if (slot == -1 || joint < XN_SKEL_HEAD || joint > MAX_JOINTS || !tracks[slot].seen[joint - 1])
+		return false;
+
+	const Track& track = tracks[slot];
+	int stored = std::min(track.count, capacity);
+	if (samples <= 0 || samples > stored)
+		samples = stored;
+	int first = track.count - samples;
+
+	float* out[2][AXES] = {{&minimum.X, &minimum.Y, &minimum.Z}, {&maximum.X, &maximum.Y, &maximum.Z}};
+	for (int axis = 0; axis < AXES; ++axis)
+	{
+		int offset = axis * MAX_JOINTS + joint - 1;
+		for (int kind = 0; kind < 2; ++kind)
+		{
+			int deque = 2 * offset + kind;
+			*out[kind][axis] = sample(track, frontExtreme(track, deque, first))[offset];
+		}
+	}
+	return true;
+}
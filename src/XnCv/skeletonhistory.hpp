@@ -0,0 +1,99 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__SKELETON_HISTORY_HPP__)
+#define __SKELETON_HISTORY_HPP__
+
+#include <vector>
+#include "snapshot.hpp"
+
+namespace xncv
+{
+	//Last frames of each user skeleton, for gesture recognition. Queries
+	//take a window in samples, 0 meaning all stored ones, and run in
+	//constant time (logarithmic in the capacity for getRange): the running
+	//values are updated as snapshots are pushed.
+	class SkeletonHistory
+	{
+		private:
+			static const int AXES = 3;
+			static const int EXTREMES = 2 * AXES * MAX_JOINTS;
+
+			//Per user ring buffers, sample major, so each push writes a
+			//single contiguous block.
+			struct Track
+			{
+				XnUserID id;
+				int count;
+
+				std::vector<XnUInt64> timestamps;
+				std::vector<float> positions;       //[sample][axis][joint]
+				std::vector<unsigned char> present; //[sample][joint]
+				std::vector<double> path;           //[sample][joint], running sum
+				unsigned char seen[MAX_JOINTS];
+
+				//Monotonic deques of sample numbers, one per joint, axis and
+				//kind (min or max). The front is the window extreme.
+				std::vector<int> extremes;          //[deque][sample]
+				int head[EXTREMES];
+				int length[EXTREMES];
+			};
+
+			int capacity;
+			Track tracks[MAX_USERS];
+
+			void resetTrack(Track& track, XnUserID id);
+			int findTrack(XnUserID id) const;
+			int findSlot(XnUserID id, const SkeletonSnapshot& snapshot);
+			void push(Track& track, const SkeletonSnapshot& snapshot, int slot);
+			void pushExtreme(Track& track, int deque, int sample, bool isMax);
+			int frontExtreme(const Track& track, int deque, int first) const;
+			const float* sample(const Track& track, int number) const;
+			bool window(XnUserID id, XnSkeletonJoint joint, int samples, int minimum,
+				const Track*& track, int& first, int& last) const;
+
+		public:
+			SkeletonHistory(int frames=30);
+
+			//Changing the capacity clears the history
+			void setCapacity(int frames);
+			int getCapacity() const;
+			void reset();
+
+			//Missing joints repeat their last position
+			void push(const SkeletonSnapshot& snapshot);
+
+			//Stored samples of the user, 0 if unknown
+			int size(XnUserID id) const;
+
+			//Age 0 is the most recent sample
+			bool getPosition(XnUserID id, XnSkeletonJoint joint, XnPoint3D& position, int age=0) const;
+
+			//Newest minus oldest position of the window, in mm
+			bool getDisplacement(XnUserID id, XnSkeletonJoint joint, XnVector3D& displacement, int samples=0) const;
+
+			//Mean velocity over the window, in mm/s
+			bool getVelocity(XnUserID id, XnSkeletonJoint joint, XnVector3D& velocity, int samples=0) const;
+
+			//Change between the first and last velocities of the window, in mm/s^2
+			bool getAcceleration(XnUserID id, XnSkeletonJoint joint, XnVector3D& acceleration, int samples=0) const;
+
+			//Distance travelled along the window, in mm
+			bool getPathLength(XnUserID id, XnSkeletonJoint joint, float& length, int samples=0) const;
+
+			//Bounding box of the joint over the window
+			bool getRange(XnUserID id, XnSkeletonJoint joint, XnPoint3D& minimum, XnPoint3D& maximum, int samples=0) const;
+	};
+}
+
+#endif
@@ -1,6 +1,10 @@
 #include "skeletonio.hpp"
 #include "exceptions.hpp"
 #include "videosource.hpp"
+#include "profiler.hpp"
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
 
 //-----------------------------------------------------------------------------
 //Auxiliary read/write functions
@@ -16,6 +20,7 @@ void write(std::fstream& writer, char value) {	writer.write((char*)&value, sizeo
 void write(std::fstream& writer, short value) { writer.write((char*)&value, sizeof(short)); }
 void write(std::fstream& writer, int value) { writer.write((char*)&value, sizeof(int)); }
 void write(std::fstream& writer, long value) { writer.write((char*)&value, sizeof(long)); }
+void write(std::fstream& writer, unsigned long long value) { writer.write((char*)&value, sizeof(unsigned long long)); }
 
 void read(std::fstream& writer, unsigned char &value) {	writer.read((char*)&value, sizeof(unsigned char)); }
 void read(std::fstream& writer, unsigned short &value) { writer.read((char*)&value, sizeof(unsigned short)); }
@@ -28,6 +33,141 @@ void read(std::fstream& writer, char &value) {	writer.read((char*)&value, sizeof
 void read(std::fstream& writer, short &value) { writer.read((char*)&value, sizeof(short)); }
 void read(std::fstream& writer, int &value) { writer.read((char*)&value, sizeof(int)); }
 void read(std::fstream& writer, long &value) { writer.read((char*)&value, sizeof(long)); }
+void read(std::fstream& writer, unsigned long long &value) { writer.read((char*)&value, sizeof(unsigned long long)); }
+
+//-----------------------------------------------------------------------------
+//Version 2 layout
+//-----------------------------------------------------------------------------
+//All fields are little endian with fixed sizes. Frames start with a header
+//followed by a user header and fixed size joint records for each user.
+namespace
+{
+	struct FileHeader
+	{
+		XnUInt32 magic;
+		XnUInt16 version;
+		XnUInt16 flags;
+	};
+
+	struct FrameHeader
+	{
+		XnInt32 frame;
+		XnUInt32 length; //Bytes after this header
+		XnUInt64 timestamp; //Microseconds
+		XnUInt16 users;
+		XnUInt16 flags;
+		XnUInt32 reserved;
+	};
+
+	//Follows the file header in compressed files
+	struct CodecHeader
+	{
+		XnFloat positionStep;
+		XnUInt8 quaternionBits;
+		XnUInt8 reserved;
+		XnUInt16 keyframeInterval;
+	};
+
+	//Follows the other headers in files without projective coordinates
+	struct IntrinsicsHeader
+	{
+		XnInt32 xRes;
+		XnInt32 yRes;
+		XnFloat xzFactor;
+		XnFloat yzFactor;
+	};
+
+	struct UserHeader
+	{
+		XnUInt32 id;
+		XnUInt16 joints;
+		XnUInt16 reserved;
+	};
+
+	struct JointRecord
+	{
+		XnUInt16 type;
+		XnUInt16 reserved;
+		XnFloat position[3];
+		XnFloat confidence;
+		XnFloat orientation[9];
+		XnFloat orientationConfidence;
+		XnInt32 projective[2];
+	};
+
+	//File header flags
+	const XnUInt16 FLAG_COMPRESSED = 1;
+	const XnUInt16 FLAG_INTRINSICS = 2; //Joints have no projective coordinates
+	const XnUInt16 KNOWN_FLAGS = FLAG_COMPRESSED | FLAG_INTRINSICS;
+
+	//Frame header flags
+	const XnUInt16 FRAME_KEYFRAME = 1;
+
+	static_assert(sizeof(FileHeader) == 8, "Unexpected file header size");
+	static_assert(sizeof(FrameHeader) == 24, "Unexpected frame header size");
+	static_assert(sizeof(CodecHeader) == 8, "Unexpected codec header size");
+	static_assert(sizeof(IntrinsicsHeader) == 16, "Unexpected intrinsics header size");
+	static_assert(sizeof(UserHeader) == 8, "Unexpected user header size");
+	static_assert(sizeof(JointRecord) == 68, "Unexpected joint record size");
+
+	//Records are copied as they are on little endian machines
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	template <typename T>
+	void swap(T& value)
+	{
+		unsigned char* bytes = reinterpret_cast<unsigned char*>(&value);
+		std::reverse(bytes, bytes + sizeof(T));
+	}
+
+	void toHost(XnUInt16& value) { swap(value); }
+	void toHost(FileHeader& h) { swap(h.magic); swap(h.version); swap(h.flags); }
+	void toHost(FrameHeader& h) { swap(h.frame); swap(h.length); swap(h.timestamp); swap(h.users); swap(h.flags); }
+	void toHost(CodecHeader& h) { swap(h.positionStep); swap(h.keyframeInterval); }
+	void toHost(IntrinsicsHeader& h) { swap(h.xRes); swap(h.yRes); swap(h.xzFactor); swap(h.yzFactor); }
+	void toHost(UserHeader& h) { swap(h.id); swap(h.joints); }
+	void toHost(JointRecord& r)
+	{
+		swap(r.type);
+		for (int i = 0; i < 3; ++i) swap(r.position[i]);
+		swap(r.confidence);
+		for (int i = 0; i < 9; ++i) swap(r.orientation[i]);
+		swap(r.orientationConfidence);
+		swap(r.projective[0]);
+		swap(r.projective[1]);
+	}
+#else
+	template <typename T>
+	inline void toHost(T&) {}
+#endif
+
+	//The same swap converts back to the file order
+	template <typename T>
+	inline void toFile(T& value) { toHost(value); }
+
+	template <typename T>
+	T getRecord(const char*& data)
+	{
+		T value;
+		memcpy(&value, data, sizeof(T));
+		data += sizeof(T);
+		toHost(value);
+		return value;
+	}
+
+	//Joints without projective coordinates are shorter
+	const size_t SHORT_JOINT_SIZE = offsetof(JointRecord, projective);
+
+	JointRecord getJoint(const char*& data, size_t size)
+	{
+		JointRecord record;
+		memcpy(&record, data, size);
+		if (size < sizeof(JointRecord))
+			record.projective[0] = record.projective[1] = 0;
+		data += size;
+		toHost(record);
+		return record;
+	}
+}
 
 //-----------------------------------------------------------------------------
 //User information
@@ -48,26 +188,6 @@ const std::map<XnSkeletonJoint, XnSkeletonJointTransformation>& xncv::UserInform
 
 std::vector<xncv::Limb> xncv::UserInformation::getLimbs() const
 {
-    static XnSkeletonJoint LIMB_JOINTS[][2] =
-    {
-        { XN_SKEL_HEAD, XN_SKEL_NECK },
-        { XN_SKEL_NECK, XN_SKEL_LEFT_SHOULDER },
-        { XN_SKEL_LEFT_SHOULDER, XN_SKEL_LEFT_ELBOW },
-        { XN_SKEL_LEFT_ELBOW, XN_SKEL_LEFT_HAND },
-        { XN_SKEL_NECK, XN_SKEL_RIGHT_SHOULDER },
-        { XN_SKEL_RIGHT_SHOULDER, XN_SKEL_RIGHT_ELBOW },
-        { XN_SKEL_RIGHT_ELBOW, XN_SKEL_RIGHT_HAND },
-        { XN_SKEL_LEFT_SHOULDER, XN_SKEL_TORSO },
-        { XN_SKEL_RIGHT_SHOULDER, XN_SKEL_TORSO },
-        { XN_SKEL_TORSO, XN_SKEL_LEFT_HIP },
-        { XN_SKEL_LEFT_HIP, XN_SKEL_LEFT_KNEE },
-        { XN_SKEL_LEFT_KNEE, XN_SKEL_LEFT_FOOT },
-        { XN_SKEL_TORSO, XN_SKEL_RIGHT_HIP },
-        { XN_SKEL_RIGHT_HIP, XN_SKEL_RIGHT_KNEE },
-        { XN_SKEL_RIGHT_KNEE, XN_SKEL_RIGHT_FOOT },
-        { XN_SKEL_LEFT_HIP, XN_SKEL_RIGHT_HIP },
-    };
-
 	std::vector<xncv::Limb> limbs;
 	for(XnUInt16 i=0; i < MAX_LIMBS; ++i)
     {
@@ -96,72 +216,426 @@ std::vector<xncv::Limb> xncv::UserInformation::getLimbs() const
 //-----------------------------------------------------------------------------
 //Skeleton reader
 //-----------------------------------------------------------------------------
-xncv::SkeletonReader::SkeletonReader() : frames(0)
+namespace
 {
+	const unsigned INDEX_MAGIC = 0x69436E58;
+	const unsigned short INDEX_VERSION = 3;
+	const size_t INDEX_ENTRY_SIZE = sizeof(int) + 2 * sizeof(XnUInt64) + sizeof(XnUInt32);
+
+	//Bytes hashed at each end of the recording to tell a rewritten file of
+	//the same size from the one the index was built for
+	const size_t FINGERPRINT_SPAN = 4096;
+
+	//Longest run of frame numbers without records that is taken as real,
+	//a day at 30 fps. Higher frames come from a damaged file.
+	const unsigned long long MAX_FRAME_GAP = 30ULL * 60 * 60 * 24;
+
+	const size_t FILE_HEADER_SIZE = sizeof(unsigned) + sizeof(unsigned short);
+	const size_t V1_RECORD_SIZE = sizeof(int) + sizeof(XnUserID) + sizeof(unsigned short);
+	const size_t V1_JOINT_SIZE = sizeof(unsigned short) + 14 * sizeof(float) + 2 * sizeof(int);
+
+	template <typename T>
+	T get(const char*& data)
+	{
+		T value;
+		memcpy(&value, data, sizeof(T));
+		data += sizeof(T);
+		return value;
+	}
+
+	//FNV-1a of the first and last bytes of the file
+	unsigned long long fingerprint(const char* begin, size_t size)
+	{
+		size_t span = std::min(size, FINGERPRINT_SPAN);
+		const char* ends[2] = {begin, begin + size - span};
+		unsigned long long hash = 14695981039346656037ULL;
+		for (int e = 0; e < 2; ++e)
+		{
+			for (size_t i = 0; i < span; ++i)
+			{
+				hash ^= static_cast<unsigned char>(ends[e][i]);
+				hash *= 1099511628211ULL;
+			}
+		}
+		return hash;
+	}
 }
 
-void xncv::SkeletonReader::open(const std::string& filename)
+xncv::SkeletonReader::SkeletonReader()
+	: version(0), flags(0), dataStart(0), jointSize(sizeof(JointRecord)), frames(0), cacheSize(8), decodedEntry(-1)
 {
-	using namespace std;
+}
 
-	fstream reader;
-	reader.open(filename, fstream::in | fstream::binary);
+void xncv::SkeletonReader::open(const std::string& fileName, bool useIndexFile)
+{
+	close();
+	file.open(fileName);
+	this->fileName = fileName;
 
-	unsigned magic;
-	read(reader, magic);
-	if (magic != MAGIC)
-		throw new xncv::IOException("Invalid file", filename);
+	const char* data = file.begin();
+	if (file.size() < FILE_HEADER_SIZE || get<unsigned>(data) != MAGIC)
+	{
+		close();
+		throw xncv::IOException("Invalid file", fileName);
+	}
 
-	unsigned short version;
-	read(reader, version);
+	version = get<unsigned short>(data);
 	if (version > VERSION)
-		throw new xncv::IOException("Version bigger than expected. Please update your xncv library.", filename);
+	{
+		close();
+		throw xncv::IOException("Version bigger than expected. Please update your xncv library.", fileName);
+	}
+
+	if (version >= 2)
+	{
+		if (file.size() < sizeof(FileHeader))
+		{
+			close();
+			throw xncv::IOException("Invalid file", fileName);
+		}
+		data = file.begin();
+		flags = getRecord<FileHeader>(data).flags;
+		if ((flags & ~KNOWN_FLAGS) != 0)
+		{
+			close();
+			throw xncv::IOException("File uses features unknown to this version. Please update your xncv library.", fileName);
+		}
+		dataStart = sizeof(FileHeader);
+
+		if (flags & FLAG_COMPRESSED)
+		{
+			if (file.size() < dataStart + sizeof(CodecHeader))
+			{
+				close();
+				throw xncv::IOException("Invalid file", fileName);
+			}
+			CodecHeader codec = getRecord<CodecHeader>(data);
+			decoder.setParams(CodecParams(codec.positionStep, codec.quaternionBits,
+				codec.keyframeInterval, !hasIntrinsics()));
+			dataStart += sizeof(CodecHeader);
+		}
+
+		if (hasIntrinsics())
+		{
+			if (file.size() < dataStart + sizeof(IntrinsicsHeader))
+			{
+				close();
+				throw xncv::IOException("Invalid file", fileName);
+			}
+			IntrinsicsHeader header = getRecord<IntrinsicsHeader>(data);
+			intrinsics.xRes = header.xRes;
+			intrinsics.yRes = header.yRes;
+			intrinsics.xzFactor = header.xzFactor;
+			intrinsics.yzFactor = header.yzFactor;
+			jointSize = SHORT_JOINT_SIZE;
+			dataStart += sizeof(IntrinsicsHeader);
+		}
+	}
+
+	std::string indexName = fileName + ".idx";
+	if (!useIndexFile || !loadIndex(indexName))
+	{
+		buildIndex();
+		if (useIndexFile)
+			saveIndex(indexName);
+	}
+
+	//Every frame number after the first costs at least one record, so the
+	//ones far beyond what the file holds are dropped before the lookup
+	//table is sized by them
+	size_t recordSize = version == 1 ? V1_RECORD_SIZE : sizeof(FrameHeader);
+	unsigned long long plausible = file.size() / recordSize + MAX_FRAME_GAP;
+	while (!index.empty() && static_cast<unsigned long long>(index.back().frame) >= plausible)
+		index.pop_back();
+
+	//Direct frame lookup
+	frames = index.empty() ? 0 : index.back().frame + 1;
+	frameEntries.assign(frames, -1);
+	for (unsigned i = 0; i < index.size(); ++i)
+		frameEntries[index[i].frame] = static_cast<int>(i);
+}
+
+void xncv::SkeletonReader::close()
+{
+	file.close();
+	fileName.clear();
+	index.clear();
+	frameEntries.clear();
+	cache.clear();
+	frames = 0;
+	version = 0;
+	flags = 0;
+	dataStart = 0;
+	jointSize = sizeof(JointRecord);
+	intrinsics = Intrinsics();
+	decoder.reset();
+	decodedEntry = -1;
+}
+
+bool xncv::SkeletonReader::isOpen() const
+{
+	return file.isOpen();
+}
+
+unsigned short xncv::SkeletonReader::getVersion() const
+{
+	return version;
+}
+
+bool xncv::SkeletonReader::isCompressed() const
+{
+	return (flags & FLAG_COMPRESSED) != 0;
+}
+
+bool xncv::SkeletonReader::hasIntrinsics() const
+{
+	return (flags & FLAG_INTRINSICS) != 0;
+}
+
+const xncv::Intrinsics& xncv::SkeletonReader::getIntrinsics() const
+{
+	return intrinsics;
+}
 
+void xncv::SkeletonReader::buildIndex()
+{
+	index.clear();
+	if (version == 1)
+		buildIndexV1();
+	else
+		buildIndexV2();
+}
+
+void xncv::SkeletonReader::buildIndexV1()
+{
+	//Only record headers are read, joints are skipped
+	const char* begin = file.begin();
+	const char* data = begin + FILE_HEADER_SIZE;
+	const char* end = file.end();
 
-	while (!reader.eof())
+	while (static_cast<size_t>(end - data) >= V1_RECORD_SIZE)
 	{
-		int frame=0;
-		read(reader, frame);
-		if (frame > frames) frames = frame;
+		const char* record = data;
+		int frame = get<int>(data);
+		get<XnUserID>(data);
+		size_t jointsSize = get<unsigned short>(data) * V1_JOINT_SIZE;
 
-		XnUserID userId=0;
-		read(reader, userId);
-		UserInformation userInfo(userId);
+		//Ignores a record truncated by an interrupted recording
+		if (static_cast<size_t>(end - data) < jointsSize)
+			break;
+		data += jointsSize;
 
-		unsigned short jointsSize=0;
-		read(reader, jointsSize);
+		//Users of a frame are consecutive and frames grow, anything else
+		//is damage and ends the scan like a truncated record
+		if (frame < 0 || (!index.empty() && frame < index.back().frame))
+			break;
+
+		if (index.empty() || index.back().frame != frame)
+		{
+			FrameEntry entry = {frame, static_cast<XnUInt64>(record - begin), 0, 0};
+			index.push_back(entry);
+		}
+		++index.back().users;
+	}
+}
+
+void xncv::SkeletonReader::buildIndexV2()
+{
+	//Frame headers hold their length, so each frame is a single jump
+	const char* begin = file.begin();
+	const char* data = begin + dataStart;
+	const char* end = file.end();
+
+	while (static_cast<size_t>(end - data) >= sizeof(FrameHeader))
+	{
+		const char* record = data;
+		FrameHeader header = getRecord<FrameHeader>(data);
+		if (static_cast<size_t>(end - data) < header.length)
+			break;
+		data += header.length;
+
+		//Empty frames only carry a timestamp and need no entry
+		if (header.users == 0)
+			continue;
+
+		//Frames grow, anything else is damage and ends the scan like a
+		//truncated record
+		if (header.frame < 0 || (!index.empty() && header.frame <= index.back().frame))
+			break;
+
+		FrameEntry entry = {header.frame, static_cast<XnUInt64>(record - begin), header.users, header.timestamp};
+		index.push_back(entry);
+	}
+}
+
+bool xncv::SkeletonReader::loadIndex(const std::string& indexName)
+{
+	std::fstream reader(indexName, std::fstream::in | std::fstream::binary);
+	if (!reader.is_open())
+		return false;
+
+	unsigned magic = 0;
+	unsigned short indexVersion = 0;
+	unsigned long long fileSize = 0;
+	unsigned long long hash = 0;
+	unsigned count = 0;
+	read(reader, magic);
+	read(reader, indexVersion);
+	read(reader, fileSize);
+	read(reader, hash);
+	read(reader, count);
+
+	//Outdated index, the file was changed after it was written
+	if (!reader || magic != INDEX_MAGIC || indexVersion != INDEX_VERSION || fileSize != file.size() ||
+		hash != fingerprint(file.begin(), static_cast<size_t>(file.size())))
+		return false;
+
+	//The count must fit in the rest of the index file
+	std::streamoff position = reader.tellg();
+	reader.seekg(0, std::ios::end);
+	std::streamoff remaining = reader.tellg() - position;
+	reader.seekg(position);
+	if (!reader || remaining < 0 || static_cast<unsigned long long>(remaining) / INDEX_ENTRY_SIZE < count)
+		return false;
+
+	//Entries are checked against the recording, so a damaged index falls
+	//back to a scan instead of sending the reader out of the mapping
+	const size_t headerSize = version == 1 ? V1_RECORD_SIZE : sizeof(FrameHeader);
+	const XnUInt64 firstOffset = version == 1 ? FILE_HEADER_SIZE : dataStart;
+	index.resize(count);
+	for (unsigned i = 0; i < count; ++i)
+	{
+		FrameEntry& entry = index[i];
+		read(reader, entry.frame);
+		read(reader, entry.offset);
+		read(reader, entry.users);
+		read(reader, entry.timestamp);
+
+		bool valid = reader && entry.frame >= 0 && entry.users > 0 &&
+			(i == 0 || entry.frame > index[i - 1].frame) &&
+			entry.offset >= firstOffset && entry.offset <= file.size() && file.size() - entry.offset >= headerSize &&
+			(i == 0 || entry.offset > index[i - 1].offset);
+		if (!valid)
+		{
+			index.clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+void xncv::SkeletonReader::saveIndex(const std::string& indexName) const
+{
+	//The index is only an optimization, so failures are ignored
+	std::fstream writer(indexName, std::fstream::out | std::fstream::trunc | std::fstream::binary);
+	if (!writer.is_open())
+		return;
+
+	write(writer, INDEX_MAGIC);
+	write(writer, INDEX_VERSION);
+	write(writer, file.size());
+	write(writer, fingerprint(file.begin(), static_cast<size_t>(file.size())));
+	write(writer, static_cast<unsigned>(index.size()));
+	for (unsigned i = 0; i < index.size(); ++i)
+	{
+		write(writer, index[i].frame);
+		write(writer, index[i].offset);
+		write(writer, index[i].users);
+		write(writer, index[i].timestamp);
+	}
+}
+
+void xncv::SkeletonReader::decode(const FrameEntry& entry, std::vector<UserInformation>& users) const
+{
+	if (version == 1)
+	{
+		decodeV1(entry, users);
+		return;
+	}
+
+	SkeletonSnapshot snapshot;
+	getSnapshot(entry.frame, snapshot);
+
+	users.clear();
+	for (int slot = 0; slot < snapshot.userCount; ++slot)
+	{
+		UserInformation userInfo(snapshot.users[slot]);
+		for (int j = XN_SKEL_HEAD; j <= MAX_JOINTS; ++j)
+		{
+			XnSkeletonJoint jointType = static_cast<XnSkeletonJoint>(j);
+			XnSkeletonJointTransformation transform;
+			if (!snapshot.getJoint(slot, jointType, transform))
+				continue;
+
+			int i = SkeletonSnapshot::index(slot, jointType);
+			ProjectiveJoint projectiveJoint;
+			projectiveJoint.position = cv::Point(snapshot.projectiveX[i], snapshot.projectiveY[i]);
+			projectiveJoint.fConfidence = transform.position.fConfidence;
+
+			userInfo.worldJoints[jointType] = transform;
+			userInfo.projectiveJoints[jointType] = projectiveJoint;
+		}
+		users.push_back(userInfo);
+	}
+}
+
+void xncv::SkeletonReader::checkRecord(const char* data, const char* end, unsigned long long size) const
+{
+	if (size > static_cast<unsigned long long>(end - data))
+		throw xncv::IOException("Corrupted skeleton frame", fileName);
+}
+
+void xncv::SkeletonReader::decodeV1(const FrameEntry& entry, std::vector<UserInformation>& users) const
+{
+	const char* data = file.begin() + entry.offset;
+	users.clear();
+	users.reserve(entry.users);
+
+	for (unsigned u = 0; u < entry.users; ++u)
+	{
+		checkRecord(data, file.end(), V1_RECORD_SIZE);
+		get<int>(data);
+		UserInformation userInfo(get<XnUserID>(data));
+
+		unsigned short jointsSize = get<unsigned short>(data);
+		checkRecord(data, file.end(), static_cast<unsigned long long>(jointsSize) * V1_JOINT_SIZE);
 		for (int i = 0; i < jointsSize; ++i)
 		{
 			//Joint type
-			unsigned short type=0;
-			read(reader, type);
-			XnSkeletonJoint jointType = static_cast<XnSkeletonJoint>(type);
+			XnSkeletonJoint jointType = static_cast<XnSkeletonJoint>(get<unsigned short>(data));
 
 			//World position
 			XnSkeletonJointTransformation transform;
-			read(reader, transform.position.position.X);
-			read(reader, transform.position.position.Y);
-			read(reader, transform.position.position.Z);
-			read(reader, transform.position.fConfidence);
+			transform.position.position.X = get<float>(data);
+			transform.position.position.Y = get<float>(data);
+			transform.position.position.Z = get<float>(data);
+			transform.position.fConfidence = get<float>(data);
 
 			//World orientation
-			for (int i = 0; i < 9; ++i)
-				read(reader, transform.orientation.orientation.elements[i]);
-			read(reader, transform.orientation.fConfidence);
+			for (int e = 0; e < 9; ++e)
+				transform.orientation.orientation.elements[e] = get<float>(data);
+			transform.orientation.fConfidence = get<float>(data);
 
 			//Projective position
 			ProjectiveJoint projectiveJoint;
-			read(reader, projectiveJoint.position.x);
-			read(reader, projectiveJoint.position.y);
+			projectiveJoint.position.x = get<int>(data);
+			projectiveJoint.position.y = get<int>(data);
 			projectiveJoint.fConfidence = transform.position.fConfidence;
 
 			userInfo.worldJoints[jointType] = transform;
-			userInfo.projectiveJoints[jointType] = projectiveJoint;			
+			userInfo.projectiveJoints[jointType] = projectiveJoint;
 		}
-		users[frame].push_back(userInfo);
+		users.push_back(userInfo);
 	}
 }
 
+void xncv::SkeletonReader::setCacheSize(unsigned size)
+{
+	cacheSize = size == 0 ? 1 : size;
+	while (cache.size() > cacheSize)
+		cache.pop_back();
+}
+
 int xncv::SkeletonReader::frameCount() const
 {
 	return frames;
@@ -169,27 +643,558 @@ int xncv::SkeletonReader::frameCount() const
 
 const std::vector<xncv::UserInformation>& xncv::SkeletonReader::getUsers(int frame) const
 {
-	if (frame < 0 || frame >= frameCount())
+	if (frame < 0 || frame >= frameCount() || frameEntries[frame] == -1)
 		return empty;
 
-	return users.find(frame) == users.end() ? empty : users.at(frame);
+	for (auto it = cache.begin(); it != cache.end(); ++it)
+	{
+		if (it->first != frame)
+			continue;
+		cache.splice(cache.begin(), cache, it);
+		return cache.front().second;
+	}
+
+	//Decodes the frame and evicts the least recently used one. A corrupted
+	//frame throws before it reaches the cache.
+	std::vector<UserInformation> users;
+	decode(index[frameEntries[frame]], users);
+	cache.push_front(std::make_pair(frame, std::vector<UserInformation>()));
+	cache.front().second.swap(users);
+	while (cache.size() > cacheSize)
+		cache.pop_back();
+	return cache.front().second;
+}
+
+bool xncv::SkeletonReader::getSnapshot(int frame, SkeletonSnapshot& snapshot) const
+{
+	XNCV_PROFILE_SCOPE("SkeletonReader::getSnapshot");
+	if (frame < 0 || frame >= frameCount() || frameEntries[frame] == -1)
+	{
+		snapshot.clear();
+		snapshot.frame = frame;
+		return false;
+	}
+
+	int entry = frameEntries[frame];
+	if (!isCompressed())
+	{
+		std::vector<UserInformation> users;
+		readSnapshot(entry, decoder, false, users, snapshot);
+		return true;
+	}
+
+	//Compressed frames depend on the previous ones
+	int first = entry;
+	while (first > 0 && !isKeyframe(first) && index[first - 1].frame == index[first].frame - 1)
+		--first;
+
+	//Sequential reads continue from the last decoded frame
+	if (decodedEntry >= first && decodedEntry < entry)
+		first = decodedEntry + 1;
+
+	std::vector<UserInformation> users;
+	for (int e = first; e <= entry; ++e)
+	{
+		bool continuous = e - 1 == decodedEntry;
+		decodedEntry = -1;
+		readSnapshot(e, decoder, continuous, users, snapshot);
+		decodedEntry = e;
+	}
+	return true;
+}
+
+void xncv::SkeletonReader::readSnapshot(int entry, SkeletonDecoder& frameDecoder, bool previousDecoded,
+	std::vector<UserInformation>& users, SkeletonSnapshot& snapshot) const
+{
+	const FrameEntry& frameEntry = index[entry];
+	snapshot.clear();
+	snapshot.frame = frameEntry.frame;
+	snapshot.timestamp = frameEntry.timestamp;
+
+	//Version 1 records have no fixed layout and go through the decoder
+	if (version == 1)
+	{
+		decodeV1(frameEntry, users);
+		for (unsigned u = 0; u < users.size(); ++u)
+		{
+			int slot = snapshot.addUser(users[u].getId());
+			if (slot == -1)
+				break;
+
+			const std::map<XnSkeletonJoint, XnSkeletonJointTransformation>& joints = users[u].getJoints();
+			for (auto it = joints.cbegin(); it != joints.cend(); ++it)
+			{
+				if (it->first < 1 || it->first > MAX_JOINTS)
+					continue;
+				snapshot.setJoint(slot, it->first, it->second);
+				auto projective = users[u].projectiveJoints.find(it->first);
+				int i = SkeletonSnapshot::index(slot, it->first);
+				snapshot.projectiveX[i] = projective->second.position.x;
+				snapshot.projectiveY[i] = projective->second.position.y;
+			}
+		}
+		return;
+	}
+
+	//Records are checked against the frame length, which is checked against
+	//the mapping, so a damaged file cannot send the reader outside of it
+	const char* data = file.begin() + frameEntry.offset;
+	checkRecord(data, file.end(), sizeof(FrameHeader));
+	FrameHeader header = getRecord<FrameHeader>(data);
+	checkRecord(data, file.end(), header.length);
+	const char* end = data + header.length;
+
+	if (isCompressed())
+	{
+		//Frames after a gap or a keyframe do not depend on the ones before
+		bool continuous = previousDecoded && !(header.flags & FRAME_KEYFRAME) &&
+			entry > 0 && index[entry - 1].frame == frameEntry.frame - 1;
+		frameDecoder.decode(data, header.length, header.users, continuous, snapshot);
+	}
+	else
+	{
+		for (unsigned u = 0; u < header.users; ++u)
+		{
+			checkRecord(data, end, sizeof(UserHeader));
+			UserHeader userHeader = getRecord<UserHeader>(data);
+			checkRecord(data, end, static_cast<unsigned long long>(userHeader.joints) * jointSize);
+			int slot = snapshot.addUser(userHeader.id);
+			if (slot == -1)
+				break;
+
+			for (int j = 0; j < userHeader.joints; ++j)
+			{
+				JointRecord record = getJoint(data, jointSize);
+				if (record.type < 1 || record.type > MAX_JOINTS)
+					continue;
+
+				int i = SkeletonSnapshot::index(slot, static_cast<XnSkeletonJoint>(record.type));
+				snapshot.present[i] = 1;
+				snapshot.x[i] = record.position[0];
+				snapshot.y[i] = record.position[1];
+				snapshot.z[i] = record.position[2];
+				snapshot.confidence[i] = record.confidence;
+				memcpy(snapshot.orientation[i], record.orientation, sizeof(record.orientation));
+				snapshot.orientationConfidence[i] = record.orientationConfidence;
+				snapshot.projectiveX[i] = record.projective[0];
+				snapshot.projectiveY[i] = record.projective[1];
+			}
+		}
+	}
+
+	if (!hasIntrinsics())
+		return;
+
+	for (int i = 0; i < snapshot.userCount * MAX_JOINTS; ++i)
+	{
+		if (!snapshot.present[i])
+			continue;
+
+		XnPoint3D point = {snapshot.x[i], snapshot.y[i], snapshot.z[i]};
+		cv::Point projective = worldToProjective(point, intrinsics);
+		snapshot.projectiveX[i] = projective.x;
+		snapshot.projectiveY[i] = projective.y;
+	}
+}
+
+bool xncv::SkeletonReader::isKeyframe(int entry) const
+{
+	const char* data = file.begin() + index[entry].offset;
+	return (getRecord<FrameHeader>(data).flags & FRAME_KEYFRAME) != 0;
+}
+
+int xncv::SkeletonReader::firstEntry(int frame) const
+{
+	int low = 0;
+	int high = static_cast<int>(index.size());
+	while (low < high)
+	{
+		int middle = (low + high) / 2;
+		if (index[middle].frame < frame)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+std::vector<xncv::FrameChunk> xncv::SkeletonReader::splitChunks(int count, const ThreadPool& pool) const
+{
+	std::vector<FrameChunk> chunks;
+	if (index.empty())
+		return chunks;
+
+	if (count <= 0)
+		count = 4 * (pool.size() + 1);
+
+	//Compressed chunks can only start where the decoder state is reset
+	int entries = static_cast<int>(index.size());
+	int begin = 0;
+	for (int c = 1; c <= count && begin < entries; ++c)
+	{
+		int end = static_cast<int>(static_cast<long long>(entries) * c / count);
+		if (end <= begin)
+			continue;
+		if (isCompressed())
+			while (end < entries && !isKeyframe(end) && index[end - 1].frame == index[end].frame - 1)
+				++end;
+
+		FrameChunk chunk = {index[begin].frame, index[end - 1].frame + 1};
+		chunks.push_back(chunk);
+		begin = end;
+	}
+	return chunks;
+}
+
+int xncv::SkeletonReader::chunkStart(int first, int last) const
+{
+	//Compressed chunks not aligned to a keyframe decode the frames before them
+	int start = first;
+	if (isCompressed())
+		while (start > 0 && start < last && !isKeyframe(start) && index[start - 1].frame == index[start].frame - 1)
+			--start;
+	return start;
+}
+
+void xncv::SkeletonReader::decodeChunks(const std::vector<FrameChunk>& chunks, const ChunkReducer& reducer, ThreadPool& pool) const
+{
+	pool.parallelFor(0, static_cast<int>(chunks.size()), [&](int begin, int end) {
+		//Each chunk only reads the mapped file and owns its decoder
+		SkeletonSnapshot snapshot;
+		SkeletonDecoder chunkDecoder(decoder.getParams());
+		std::vector<UserInformation> users;
+
+		for (int c = begin; c < end; ++c)
+		{
+			int first = firstEntry(chunks[c].first);
+			int last = firstEntry(chunks[c].last);
+			int start = chunkStart(first, last);
+			for (int e = start; e < last; ++e)
+			{
+				readSnapshot(e, chunkDecoder, e > start, users, snapshot);
+				if (e >= first)
+					reducer(c, snapshot);
+			}
+		}
+	});
+}
+
+void xncv::SkeletonReader::collectTrajectories(const FrameChunk& chunk, const std::vector<TrajectoryQuery>& queries,
+	std::vector<Trajectory>& trajectories) const
+{
+	int first = firstEntry(chunk.first);
+	int last = firstEntry(chunk.last);
+	std::vector<int> matches;
+
+	//Fixed size records are scanned in place, reading only the joint types.
+	//They are bounded as in readSnapshot.
+	if (version >= 2 && !isCompressed())
+	{
+		for (int e = first; e < last; ++e)
+		{
+			const char* data = file.begin() + index[e].offset;
+			checkRecord(data, file.end(), sizeof(FrameHeader));
+			FrameHeader header = getRecord<FrameHeader>(data);
+			checkRecord(data, file.end(), header.length);
+			const char* end = data + header.length;
+			for (unsigned u = 0; u < header.users; ++u)
+			{
+				checkRecord(data, end, sizeof(UserHeader));
+				UserHeader userHeader = getRecord<UserHeader>(data);
+				checkRecord(data, end, static_cast<unsigned long long>(userHeader.joints) * jointSize);
+				matches.clear();
+				for (unsigned q = 0; q < queries.size(); ++q)
+					if (queries[q].user == userHeader.id)
+						matches.push_back(q);
+
+				if (matches.empty())
+				{
+					data += userHeader.joints * jointSize;
+					continue;
+				}
+
+				for (int j = 0; j < userHeader.joints; ++j, data += jointSize)
+				{
+					XnUInt16 type;
+					memcpy(&type, data, sizeof(type));
+					toHost(type);
+					for (unsigned m = 0; m < matches.size(); ++m)
+					{
+						if (queries[matches[m]].joint != type)
+							continue;
+
+						const char* recordData = data;
+						JointRecord record = getJoint(recordData, jointSize);
+						Trajectory& trajectory = trajectories[matches[m]];
+						trajectory.frames.push_back(header.frame);
+						trajectory.x.push_back(record.position[0]);
+						trajectory.y.push_back(record.position[1]);
+						trajectory.z.push_back(record.position[2]);
+						trajectory.confidence.push_back(record.confidence);
+					}
+				}
+			}
+		}
+		return;
+	}
+
+	SkeletonSnapshot snapshot;
+	SkeletonDecoder chunkDecoder(decoder.getParams());
+	std::vector<UserInformation> users;
+	int start = chunkStart(first, last);
+	for (int e = start; e < last; ++e)
+	{
+		readSnapshot(e, chunkDecoder, e > start, users, snapshot);
+		if (e < first)
+			continue;
+
+		for (unsigned q = 0; q < queries.size(); ++q)
+		{
+			int slot = snapshot.findUser(queries[q].user);
+			if (slot == -1 || queries[q].joint < XN_SKEL_HEAD || queries[q].joint > MAX_JOINTS)
+				continue;
+
+			int i = SkeletonSnapshot::index(slot, queries[q].joint);
+			if (!snapshot.present[i])
+				continue;
+
+			Trajectory& trajectory = trajectories[q];
+			trajectory.frames.push_back(snapshot.frame);
+			trajectory.x.push_back(snapshot.x[i]);
+			trajectory.y.push_back(snapshot.y[i]);
+			trajectory.z.push_back(snapshot.z[i]);
+			trajectory.confidence.push_back(snapshot.confidence[i]);
+		}
+	}
+}
+
+std::vector<xncv::Trajectory> xncv::SkeletonReader::getTrajectories(const std::vector<TrajectoryQuery>& queries,
+	int first, int last, ThreadPool* pool) const
+{
+	if (last < 0 || last > frames)
+		last = frames;
+	if (first < 0)
+		first = 0;
+
+	std::vector<Trajectory> result(queries.size());
+	for (unsigned q = 0; q < queries.size(); ++q)
+	{
+		result[q].user = queries[q].user;
+		result[q].joint = queries[q].joint;
+	}
+	if (queries.empty() || first >= last)
+		return result;
+
+	FrameChunk range = {first, last};
+	if (!pool)
+	{
+		collectTrajectories(range, queries, result);
+		return result;
+	}
+
+	//Each chunk fills its own columns, appended in frame order at the end
+	std::vector<FrameChunk> chunks = splitChunks(0, *pool);
+	std::vector<FrameChunk> clipped;
+	for (unsigned c = 0; c < chunks.size(); ++c)
+	{
+		FrameChunk chunk = {std::max(chunks[c].first, first), std::min(chunks[c].last, last)};
+		if (chunk.first < chunk.last)
+			clipped.push_back(chunk);
+	}
+
+	std::vector<std::vector<Trajectory> > partial(clipped.size(), result);
+	pool->parallelFor(0, static_cast<int>(clipped.size()), [&](int begin, int end) {
+		for (int c = begin; c < end; ++c)
+			collectTrajectories(clipped[c], queries, partial[c]);
+	});
+
+	for (unsigned q = 0; q < result.size(); ++q)
+	{
+		size_t size = 0;
+		for (unsigned c = 0; c < partial.size(); ++c)
+			size += partial[c][q].frames.size();
+
+		Trajectory& trajectory = result[q];
+		trajectory.frames.reserve(size);
+		trajectory.x.reserve(size);
+		trajectory.y.reserve(size);
+		trajectory.z.reserve(size);
+		trajectory.confidence.reserve(size);
+		for (unsigned c = 0; c < partial.size(); ++c)
+		{
+			const Trajectory& part = partial[c][q];
+			trajectory.frames.insert(trajectory.frames.end(), part.frames.begin(), part.frames.end());
+			trajectory.x.insert(trajectory.x.end(), part.x.begin(), part.x.end());
+			trajectory.y.insert(trajectory.y.end(), part.y.begin(), part.y.end());
+			trajectory.z.insert(trajectory.z.end(), part.z.begin(), part.z.end());
+			trajectory.confidence.insert(trajectory.confidence.end(), part.confidence.begin(), part.confidence.end());
+		}
+	}
+	return result;
+}
+
+XnUInt64 xncv::SkeletonReader::getTimestamp(int frame) const
+{
+	if (frame < 0 || frame >= frameCount() || frameEntries[frame] == -1)
+		return 0;
+	return index[frameEntries[frame]].timestamp;
+}
+
+int xncv::SkeletonReader::findFrame(XnUInt64 timestamp, XnUInt64 tolerance) const
+{
+	if (version < 2 || index.empty())
+		return -1;
+
+	//Timestamps grow with the frames, so the index is already sorted
+	int low = 0;
+	int high = static_cast<int>(index.size());
+	while (low < high)
+	{
+		int middle = (low + high) / 2;
+		if (index[middle].timestamp < timestamp)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	int best = -1;
+	XnUInt64 bestDistance = tolerance + 1;
+	for (int i = low - 1; i <= low; ++i)
+	{
+		if (i < 0 || i >= static_cast<int>(index.size()))
+			continue;
+		XnUInt64 t = index[i].timestamp;
+		XnUInt64 distance = t > timestamp ? t - timestamp : timestamp - t;
+		if (distance < bestDistance)
+		{
+			best = index[i].frame;
+			bestDistance = distance;
+		}
+	}
+	return best;
 }
 
 //-----------------------------------------------------------------------------
 //Skeleton writer
 //-----------------------------------------------------------------------------
+namespace
+{
+	template <typename T>
+	void append(std::vector<char>& block, T value)
+	{
+		size_t size = block.size();
+		block.resize(size + sizeof(T));
+		memcpy(&block[size], &value, sizeof(T));
+	}
+
+	XnUInt64 now()
+	{
+		XnUInt64 timestamp = 0;
+		xnOSGetTimeStamp(&timestamp);
+		return timestamp;
+	}
+}
+
 xncv::SkeletonWriter::SkeletonWriter(xncv::VideoSource& videoSource)
-	: writer(), depthGen(&(videoSource.getXnDepthGenerator())), frame(0)
+	: writer(), depthGen(&(videoSource.getXnDepthGenerator())), frame(0),
+	intrinsics(videoSource.getIntrinsics()), needsProjection(false), storeProjective(true),
+	compressed(false), keyframe(false),
+	frameQueued(true), frameWritten(true), closing(false),
+	policy(QUEUE_BLOCK), maxQueuedFrames(64), flushInterval(1000), dropped(0)
 {
 	writer.exceptions(std::fstream::failbit | std::fstream::badbit);
 }
 
+xncv::SkeletonWriter::SkeletonWriter()
+	: writer(), depthGen(NULL), frame(0),
+	needsProjection(false), storeProjective(true),
+	compressed(false), keyframe(false),
+	frameQueued(true), frameWritten(true), closing(false),
+	policy(QUEUE_BLOCK), maxQueuedFrames(64), flushInterval(1000), dropped(0)
+{
+	writer.exceptions(std::fstream::failbit | std::fstream::badbit);
+}
+
+void xncv::SkeletonWriter::setQueuePolicy(QueuePolicy queuePolicy, unsigned maxFrames)
+{
+	Lock lock(queueMutex);
+	policy = queuePolicy;
+	maxQueuedFrames = maxFrames == 0 ? 1 : maxFrames;
+}
+
+void xncv::SkeletonWriter::setFlushInterval(unsigned milliseconds)
+{
+	Lock lock(queueMutex);
+	flushInterval = milliseconds;
+}
+
+void xncv::SkeletonWriter::setCompression(bool enabled, const CodecParams& params)
+{
+	compressed = enabled;
+	encoder.setParams(params);
+}
+
+void xncv::SkeletonWriter::setStoreProjective(bool enabled)
+{
+	storeProjective = enabled;
+}
+
+void xncv::SkeletonWriter::setIntrinsics(const Intrinsics& cameraIntrinsics)
+{
+	//The file header only has room for the sensor model
+	if (!isFullFrame(cameraIntrinsics))
+		throw Exception("Skeleton files need full frame intrinsics");
+	intrinsics = cameraIntrinsics;
+}
+
+unsigned xncv::SkeletonWriter::droppedFrames() const
+{
+	return dropped;
+}
+
 void xncv::SkeletonWriter::open(const std::string& fileName)
 {
+	close();
 	writer.open(fileName, std::fstream::out | std::fstream::trunc | std::fstream::binary);
 	frame = 0;
-	write(writer, MAGIC);
-	write(writer, VERSION); //File version
+	dropped = 0;
+	ioError.clear();
+	closing = false;
+
+	XnUInt16 flags = 0;
+	if (compressed)
+		flags |= FLAG_COMPRESSED;
+	if (!storeProjective)
+		flags |= FLAG_INTRINSICS;
+
+	FileHeader header = {MAGIC, VERSION, flags};
+	toFile(header);
+	block.clear();
+	append(block, header);
+	if (compressed)
+	{
+		CodecParams params = encoder.getParams();
+		params.projective = storeProjective;
+		encoder.setParams(params);
+
+		CodecHeader codec = {params.positionStep, static_cast<XnUInt8>(params.quaternionBits), 0,
+			static_cast<XnUInt16>(std::min(params.keyframeInterval, 65535u))};
+		toFile(codec);
+		append(block, codec);
+	}
+	if (!storeProjective)
+	{
+		IntrinsicsHeader camera = {intrinsics.xRes, intrinsics.yRes, intrinsics.xzFactor, intrinsics.yzFactor};
+		toFile(camera);
+		append(block, camera);
+	}
+	encoder.reset();
+	queue.push_back(std::vector<char>());
+	queue.back().swap(block);
+	beginBlock();
+
+	this->fileName = fileName;
+	ioThread.start([this]() { writeQueued(); });
 }
 
 bool xncv::SkeletonWriter::isOpen() const
@@ -202,55 +1207,310 @@ void xncv::SkeletonWriter::operator<<(const User& user)
 	if (!isOpen() || !user.isTracking() || user.isCalibrating())
 		return;
 
-	write(writer, frame);
-	write (writer, user.getId());
+	int slot = frameSnapshot.addUser(user.getId());
+	if (slot == -1)
+		return;
+
 	auto joints = user.getJoints();
-	unsigned short jointsSize = static_cast<unsigned short>(joints.size());
-	write(writer, jointsSize);	
 	for (auto it = joints.cbegin(); it != joints.cend(); ++it)
+		if (it->first >= XN_SKEL_HEAD && it->first <= MAX_JOINTS)
+			frameSnapshot.setJoint(slot, it->first, it->second);
+
+	//Projected all at once on endFrame
+	needsProjection = true;
+}
+
+void xncv::SkeletonWriter::operator<<(const std::vector<User>& users)
+{
+	for (unsigned i = 0; i < users.size(); ++i)
+		(*this) << users[i];
+}
+
+void xncv::SkeletonWriter::operator<<(const SkeletonSnapshot& snapshot)
+{
+	if (!isOpen())
+		return;
+
+	frameSnapshot.timestamp = snapshot.timestamp;
+	for (int s = 0; s < snapshot.userCount; ++s)
 	{
-		//Joint type
-		write(writer, static_cast<unsigned short>(it->first));
+		int slot = frameSnapshot.addUser(snapshot.users[s]);
+		if (slot == -1)
+			break;
+
+		//Slots hold MAX_JOINTS consecutive joints in every array
+		int from = s * MAX_JOINTS;
+		int to = slot * MAX_JOINTS;
+		memcpy(frameSnapshot.present + to, snapshot.present + from, MAX_JOINTS * sizeof(snapshot.present[0]));
+		memcpy(frameSnapshot.x + to, snapshot.x + from, MAX_JOINTS * sizeof(snapshot.x[0]));
+		memcpy(frameSnapshot.y + to, snapshot.y + from, MAX_JOINTS * sizeof(snapshot.y[0]));
+		memcpy(frameSnapshot.z + to, snapshot.z + from, MAX_JOINTS * sizeof(snapshot.z[0]));
+		memcpy(frameSnapshot.confidence + to, snapshot.confidence + from, MAX_JOINTS * sizeof(snapshot.confidence[0]));
+		memcpy(frameSnapshot.orientation + to, snapshot.orientation + from, MAX_JOINTS * sizeof(snapshot.orientation[0]));
+		memcpy(frameSnapshot.orientationConfidence + to, snapshot.orientationConfidence + from,
+			MAX_JOINTS * sizeof(snapshot.orientationConfidence[0]));
+		memcpy(frameSnapshot.projectiveX + to, snapshot.projectiveX + from, MAX_JOINTS * sizeof(snapshot.projectiveX[0]));
+		memcpy(frameSnapshot.projectiveY + to, snapshot.projectiveY + from, MAX_JOINTS * sizeof(snapshot.projectiveY[0]));
+	}
+}
+
+void xncv::SkeletonWriter::beginBlock()
+{
+	//Room for the frame header, filled by finishBlock
+	block.assign(sizeof(FrameHeader), 0);
+	frameSnapshot.clear();
+	needsProjection = false;
+}
 
-		//World position
-		write(writer, it->second.position.position.X);
-		write(writer, it->second.position.position.Y);
-		write(writer, it->second.position.position.Z);
-		write(writer, it->second.position.fConfidence);
+void xncv::SkeletonWriter::appendUser(int slot)
+{
+	int count = 0;
+	for (int j = 0; j < MAX_JOINTS; ++j)
+		count += frameSnapshot.present[slot * MAX_JOINTS + j];
+
+	UserHeader header = {frameSnapshot.users[slot], static_cast<XnUInt16>(count), 0};
+	toFile(header);
+	append(block, header);
+
+	size_t size = storeProjective ? sizeof(JointRecord) : SHORT_JOINT_SIZE;
+	for (int j = 0; j < MAX_JOINTS; ++j)
+	{
+		int i = slot * MAX_JOINTS + j;
+		if (!frameSnapshot.present[i])
+			continue;
 
-		//World orientation
-		for (int i = 0; i < 9; ++i)
-			write(writer, it->second.orientation.orientation.elements[i]);
-		write(writer, it->second.orientation.fConfidence);
+		JointRecord record;
+		record.type = static_cast<XnUInt16>(j + XN_SKEL_HEAD);
+		record.reserved = 0;
+		record.position[0] = frameSnapshot.x[i];
+		record.position[1] = frameSnapshot.y[i];
+		record.position[2] = frameSnapshot.z[i];
+		record.confidence = frameSnapshot.confidence[i];
+		memcpy(record.orientation, frameSnapshot.orientation[i], sizeof(record.orientation));
+		record.orientationConfidence = frameSnapshot.orientationConfidence[i];
+		record.projective[0] = frameSnapshot.projectiveX[i];
+		record.projective[1] = frameSnapshot.projectiveY[i];
+		toFile(record);
 
-		//Projective position
-		cv::Point projectivePos = xncv::worldToProjective(it->second.position.position, *depthGen);
-		write(writer, projectivePos.x);
-		write(writer, projectivePos.y);
+		size_t offset = block.size();
+		block.resize(offset + size);
+		memcpy(&block[offset], &record, size);
 	}
 }
 
-void xncv::SkeletonWriter::operator<<(const std::vector<User>& users)
+void xncv::SkeletonWriter::finishBlock()
 {
-	for (unsigned i = 0; i < users.size(); ++i)
-		(*this) << users[i];
+	//A single conversion projects the joints of all users
+	if (storeProjective && needsProjection)
+	{
+		if (depthGen)
+			projectSnapshot(frameSnapshot, *depthGen);
+		else
+		{
+			for (int i = 0; i < frameSnapshot.userCount * MAX_JOINTS; ++i)
+			{
+				if (!frameSnapshot.present[i])
+					continue;
+				XnPoint3D point = {frameSnapshot.x[i], frameSnapshot.y[i], frameSnapshot.z[i]};
+				cv::Point projective = worldToProjective(point, intrinsics);
+				frameSnapshot.projectiveX[i] = projective.x;
+				frameSnapshot.projectiveY[i] = projective.y;
+			}
+		}
+	}
+
+	keyframe = compressed && encoder.beginFrame(frame);
+
+	for (int slot = 0; slot < frameSnapshot.userCount; ++slot)
+	{
+		if (compressed)
+			encoder.encode(frameSnapshot, slot, block);
+		else
+			appendUser(slot);
+	}
+
+	FrameHeader header;
+	memset(&header, 0, sizeof(header));
+	header.frame = frame;
+	header.length = static_cast<XnUInt32>(block.size() - sizeof(FrameHeader));
+	header.timestamp = frameSnapshot.timestamp != 0 || !depthGen ? frameSnapshot.timestamp : depthGen->GetTimestamp();
+	header.users = frameSnapshot.userCount;
+	header.flags = keyframe ? FRAME_KEYFRAME : 0;
+	toFile(header);
+	if (compressed)
+		encoder.endFrame();
+	memcpy(&block[0], &header, sizeof(header));
 }
 
 void xncv::SkeletonWriter::endFrame()
 {
 	if (!isOpen()) return;
+	XNCV_PROFILE_SCOPE("SkeletonWriter::endFrame");
+
+	//Serialized before taking the lock, the I/O thread never touches the block
+	finishBlock();
 	++frame;
-	writer.flush();
+
+	Lock lock(queueMutex);
+	if (!ioError.empty())
+		throw xncv::IOException(ioError, fileName);
+
+	//Full queue: wait for the disk, drop the frame or grow
+	while (queue.size() >= maxQueuedFrames && policy == QUEUE_BLOCK)
+	{
+		frameWritten.reset();
+		queueMutex.unlock();
+		frameWritten.wait();
+		queueMutex.lock();
+	}
+
+	if (queue.size() >= maxQueuedFrames && policy == QUEUE_DROP)
+	{
+		++dropped;
+		XNCV_PROFILE_COUNT("skeleton.dropped", 1);
+		encoder.forceKeyframe();
+		beginBlock();
+		return;
+	}
+
+	//Blocks are recycled so their memory is reused
+	queue.push_back(std::vector<char>());
+	queue.back().swap(block);
+	if (!freeBlocks.empty())
+	{
+		block.swap(freeBlocks.back());
+		freeBlocks.pop_back();
+	}
+	beginBlock();
+	frameQueued.set();
+}
+
+void xncv::SkeletonWriter::writeFrame(const SkeletonSnapshot& snapshot)
+{
+	if (!isOpen()) return;
+
+	if (snapshot.frame > frame)
+		frame = snapshot.frame;
+	(*this) << snapshot;
+	endFrame();
+}
+
+void xncv::SkeletonWriter::writeQueued()
+{
+	XnUInt64 lastFlush = now();
+	std::vector<char> current;
+
+	Lock lock(queueMutex);
+	for (;;)
+	{
+		if (queue.empty())
+		{
+			if (closing)
+				break;
+
+			frameQueued.reset();
+			queueMutex.unlock();
+			frameQueued.wait(flushInterval == 0 ? XN_WAIT_INFINITE : flushInterval);
+			queueMutex.lock();
+		}
+
+		if (!queue.empty())
+		{
+			current.swap(queue.front());
+			queue.pop_front();
+			frameWritten.set();
+		}
+		unsigned interval = flushInterval;
+		queueMutex.unlock();
+
+		try
+		{
+			XNCV_PROFILE_SCOPE("SkeletonWriter::write");
+			if (!current.empty())
+				writer.write(&current[0], current.size());
+
+			if (interval != 0 && now() - lastFlush >= interval)
+			{
+				writer.flush();
+				lastFlush = now();
+			}
+		}
+		catch (std::exception& e)
+		{
+			queueMutex.lock();
+			ioError = e.what();
+			queue.clear();
+			frameWritten.set();
+			break;
+		}
+
+		current.clear();
+		queueMutex.lock();
+		if (freeBlocks.size() < maxQueuedFrames)
+		{
+			freeBlocks.push_back(std::vector<char>());
+			freeBlocks.back().swap(current);
+		}
+	}
 }
 
 void xncv::SkeletonWriter::close()
 {
 	if (!isOpen()) return;
-	writer.flush();
-	writer.close();
+
+	{
+		//Data written after the last endFrame is kept
+		Lock lock(queueMutex);
+		if (frameSnapshot.userCount != 0)
+		{
+			finishBlock();
+			queue.push_back(std::vector<char>());
+			queue.back().swap(block);
+		}
+		closing = true;
+		frameQueued.set();
+	}
+	ioThread.join();
+
+	//The stream is closed even after a write error, which is reported
+	//once the file is released
+	std::string error;
+	{
+		Lock lock(queueMutex);
+		error = ioError;
+		ioError.clear();
+	}
+	try
+	{
+		if (error.empty())
+			writer.flush();
+	}
+	catch (std::exception& e)
+	{
+		error = e.what();
+	}
+	try
+	{
+		writer.close();
+	}
+	catch (std::exception& e)
+	{
+		if (error.empty())
+			error = e.what();
+	}
+	writer.clear();
+
+	if (!error.empty())
+		throw xncv::IOException(error, fileName);
 }
 
 xncv::SkeletonWriter::~SkeletonWriter()
 {
-	close();
-}
\ No newline at end of file
+	try
+	{
+		close();
+	}
+	catch (std::exception&)
+	{
+	}
+}
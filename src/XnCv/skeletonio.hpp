@@ -16,14 +16,19 @@
 
 #include <stdexcept>
 #include "user.hpp"
+#include "snapshot.hpp"
+#include "skeletoncodec.hpp"
 #include <fstream>
+#include <list>
+#include "mappedfile.hpp"
+#include "threading.hpp"
 
 namespace xncv
 {
 	class VideoSource;
 
 	const unsigned MAGIC = 0x76436E58;
-	const unsigned short VERSION = 1;
+	const unsigned short VERSION = 2;
 	
 	struct ProjectiveJoint
 	{		
@@ -48,36 +53,210 @@ namespace xncv
 			std::vector<Limb> getLimbs() const;
 	};
 
+	//Frames [first, last) of a skeleton file
+	struct FrameChunk
+	{
+		int first;
+		int last;
+	};
+
+	//Receives the chunk number and each of its frames, in order
+	typedef std::function<void(int, const SkeletonSnapshot&)> ChunkReducer;
+
+	struct TrajectoryQuery
+	{
+		XnUserID user;
+		XnSkeletonJoint joint;
+	};
+
+	//Positions of a joint along the frames where it was recorded, in columns
+	struct Trajectory
+	{
+		XnUserID user;
+		XnSkeletonJoint joint;
+		std::vector<int> frames;
+		std::vector<float> x;
+		std::vector<float> y;
+		std::vector<float> z;
+		std::vector<float> confidence;
+	};
+
 	class SkeletonReader
 	{
-		private:			
-			std::map<int, std::vector<UserInformation> > users;
+		private:
+			struct FrameEntry
+			{
+				int frame;
+				XnUInt64 offset;
+				XnUInt32 users;
+				XnUInt64 timestamp;
+			};
+
+			MappedFile file;
+			std::string fileName;
+			unsigned short version;
+			unsigned short flags;
+			size_t dataStart;
+			size_t jointSize;
+			Intrinsics intrinsics;
+			std::vector<FrameEntry> index;
+			std::vector<int> frameEntries;
 			const std::vector<UserInformation> empty;
 			int frames;
 
+			//Decoded frames, most recently used first
+			mutable std::list<std::pair<int, std::vector<UserInformation> > > cache;
+			unsigned cacheSize;
+
+			//Compressed frames depend on the previous ones, so the decoder
+			//state of the last decoded entry is kept for sequential reads.
+			mutable SkeletonDecoder decoder;
+			mutable int decodedEntry;
+
+			void buildIndex();
+			void buildIndexV1();
+			void buildIndexV2();
+			bool loadIndex(const std::string& indexName);
+			void saveIndex(const std::string& indexName) const;
+			void decode(const FrameEntry& entry, std::vector<UserInformation>& users) const;
+			void decodeV1(const FrameEntry& entry, std::vector<UserInformation>& users) const;
+			void checkRecord(const char* data, const char* end, unsigned long long size) const;
+			void readSnapshot(int entry, SkeletonDecoder& frameDecoder, bool previousDecoded,
+				std::vector<UserInformation>& users, SkeletonSnapshot& snapshot) const;
+			bool isKeyframe(int entry) const;
+			int firstEntry(int frame) const;
+			int chunkStart(int first, int last) const;
+			void collectTrajectories(const FrameChunk& chunk, const std::vector<TrajectoryQuery>& queries,
+				std::vector<Trajectory>& trajectories) const;
+
 		public:
-			SkeletonReader();			
-			void open(const std::string& fileName);
+			SkeletonReader();
+
+			//With useIndexFile the frame index is loaded from, or saved to,
+			//fileName.idx next to the recording. The index is checked against
+			//the file size and a hash of its ends, and rebuilt if it does not match.
+			void open(const std::string& fileName, bool useIndexFile=false);
+			void close();
+			bool isOpen() const;
+			unsigned short getVersion() const;
+			bool isCompressed() const;
+
+			//Files written without projective coordinates store the camera
+			//intrinsics, used to project the joints when they are read.
+			bool hasIntrinsics() const;
+			const Intrinsics& getIntrinsics() const;
+
+			//Number of decoded frames kept in memory
+			void setCacheSize(unsigned frames);
 
 			int frameCount() const;
+
+			//Frames are decoded on demand. The returned vector stays valid
+			//until cacheSize other frames are read. Frames whose records do
+			//not fit in the file throw an IOException, here and in getSnapshot.
 			const std::vector<UserInformation>& getUsers(int frame) const;
+
+			//Fills the snapshot straight from the file records. Returns false
+			//if the frame was not recorded.
+			bool getSnapshot(int frame, SkeletonSnapshot& snapshot) const;
+
+			//Depth timestamp of the frame in microseconds, 0 for version 1 files
+			XnUInt64 getTimestamp(int frame) const;
+
+			//Recorded frame closest to the timestamp, or -1 if none is
+			//within tolerance microseconds
+			int findFrame(XnUInt64 timestamp, XnUInt64 tolerance=20000) const;
+
+			//Splits the file in about count chunks that can be decoded
+			//independently. 0 uses a few chunks per thread of the pool that
+			//will decode them.
+			std::vector<FrameChunk> splitChunks(int count=0, const ThreadPool& pool=defaultThreadPool()) const;
+
+			//Decodes the chunks in parallel. The reducer is called from the
+			//pool threads, but frames of a chunk are always sent in order by
+			//a single thread, so per chunk results need no locking.
+			void decodeChunks(const std::vector<FrameChunk>& chunks, const ChunkReducer& reducer,
+				ThreadPool& pool=defaultThreadPool()) const;
+
+			//One trajectory per query over frames [first, last). A negative
+			//last reads until the end of the file.
+			std::vector<Trajectory> getTrajectories(const std::vector<TrajectoryQuery>& queries,
+				int first=0, int last=-1, ThreadPool* pool=NULL) const;
 	};
 
 	class SkeletonWriter
 	{	
 		private:
 			std::fstream writer;
+			std::string fileName;
 			xn::DepthGenerator* depthGen;
 			int frame;
+			Intrinsics intrinsics;
+
+			//Users of the current frame, serialized on endFrame
+			SkeletonSnapshot frameSnapshot;
+			bool needsProjection;
+			bool storeProjective;
+
+			bool compressed;
+			bool keyframe;
+			SkeletonEncoder encoder;
+
+			//Frames are serialized in memory and written by a background thread
+			std::vector<char> block;
+			std::deque<std::vector<char> > queue;
+			std::vector<std::vector<char> > freeBlocks;
+			Thread ioThread;
+			CriticalSection queueMutex;
+			Event frameQueued;
+			Event frameWritten;
+			bool closing;
+			std::string ioError;
+
+			QueuePolicy policy;
+			unsigned maxQueuedFrames;
+			unsigned flushInterval;
+			unsigned dropped;
+
+			void beginBlock();
+			void finishBlock();
+			void appendUser(int slot);
+			void writeQueued();
 
 		public:
 			SkeletonWriter(VideoSource& generator);
+			//Writer for snapshots read from files, without OpenNI. Joints
+			//are projected with the intrinsics given by setIntrinsics.
+			SkeletonWriter();
 			void open(const std::string& fileName);
 			bool isOpen() const;
+
+			//Stores quantized delta coded frames. Must be set before open.
+			void setCompression(bool enabled, const CodecParams& params=CodecParams());
+
+			//When disabled, only the camera intrinsics are stored and joints
+			//are projected by the reader. Must be set before open.
+			void setStoreProjective(bool enabled);
+			void setIntrinsics(const Intrinsics& cameraIntrinsics);
+
+			void setQueuePolicy(QueuePolicy policy, unsigned maxFrames=64);
+			//Time between flushes to disk, in milliseconds. 0 flushes only on close.
+			void setFlushInterval(unsigned milliseconds);
+			unsigned droppedFrames() const;
+
 			inline void beginFrame() {}
 			void operator << (const User& user);
 			void operator << (const std::vector<User>& users);
+			//Adds all users of a snapshot, such as one filled by UserTracker::captureSkeletons
+			void operator << (const SkeletonSnapshot& snapshot);
 			void endFrame();
+
+			//Writes the snapshot as a whole frame, keeping its frame number
+			//when it is not behind the writer.
+			void writeFrame(const SkeletonSnapshot& snapshot);
+
+			//Writes the queued frames and closes the file. The file is closed
+			//even if writing failed, then the error is thrown as an IOException.
 			void close();
 			~SkeletonWriter();
 	};
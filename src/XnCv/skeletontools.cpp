@@ -0,0 +1,157 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "skeletontools.hpp"
+#include "skeletonio.hpp"
+#include "exceptions.hpp"
+
+namespace
+{
+	//Frame period used to separate merged files, in microseconds
+	const XnUInt64 FRAME_PERIOD = 33333;
+
+	void openWriter(xncv::SkeletonWriter& writer, const xncv::SkeletonReader& reader,
+		const std::string& output, const xncv::ConvertOptions& options)
+	{
+		if (!options.storeProjective && !reader.hasIntrinsics())
+			throw xncv::IOException("Input has no intrinsics to replace the projective coordinates", output);
+
+		if (reader.hasIntrinsics())
+			writer.setIntrinsics(reader.getIntrinsics());
+		writer.setStoreProjective(options.storeProjective);
+		writer.setCompression(options.compressed, options.codec);
+		writer.open(output);
+	}
+
+	//Copies every step frames of [first, last) to the writer, numbered from
+	//firstOut, with timestamps moved by offset. Missing frames stay missing.
+	//Returns the last written timestamp.
+	XnUInt64 copyFrames(const xncv::SkeletonReader& reader, xncv::SkeletonWriter& writer,
+		int first, int last, int step, int firstOut, XnInt64 offset)
+	{
+		XnUInt64 lastTimestamp = 0;
+		xncv::SkeletonSnapshot snapshot;
+		for (int frame = first; frame < last; frame += step)
+		{
+			if (!reader.getSnapshot(frame, snapshot))
+				continue;
+
+			snapshot.frame = firstOut + (frame - first) / step;
+			if (snapshot.timestamp != 0)
+				snapshot.timestamp += offset;
+			lastTimestamp = snapshot.timestamp;
+			writer.writeFrame(snapshot);
+		}
+		return lastTimestamp;
+	}
+
+	bool sameIntrinsics(const xncv::Intrinsics& a, const xncv::Intrinsics& b)
+	{
+		return a.xRes == b.xRes && a.yRes == b.yRes && a.xzFactor == b.xzFactor && a.yzFactor == b.yzFactor &&
+			a.factor == b.factor && a.xOffset == b.xOffset && a.yOffset == b.yOffset;
+	}
+}
+
+xncv::ConvertOptions::ConvertOptions()
+	: compressed(false), codec(), storeProjective(true)
+{
+}
+
+void xncv::sliceSkeletons(const std::string& input, const std::string& output,
+	int first, int last, const ConvertOptions& options, bool renumber)
+{
+	SkeletonReader reader;
+	reader.open(input);
+
+	SkeletonWriter writer;
+	openWriter(writer, reader, output, options);
+
+	if (first < 0)
+		first = 0;
+	if (last < 0 || last > reader.frameCount())
+		last = reader.frameCount();
+
+	copyFrames(reader, writer, first, last, 1, renumber ? 0 : first, 0);
+	writer.close();
+}
+
+void xncv::mergeSkeletons(const std::vector<std::string>& inputs, const std::string& output,
+	const ConvertOptions& options)
+{
+	if (inputs.empty())
+		return;
+
+	SkeletonWriter writer;
+	Intrinsics intrinsics;
+	int nextFrame = 0;
+	XnUInt64 lastTimestamp = 0;
+	for (unsigned i = 0; i < inputs.size(); ++i)
+	{
+		//Only one input is open at a time
+		SkeletonReader reader;
+		reader.open(inputs[i]);
+		if (i == 0)
+		{
+			openWriter(writer, reader, output, options);
+			intrinsics = reader.getIntrinsics();
+		}
+		else if (!options.storeProjective)
+		{
+			//The output projects every joint with the intrinsics of the first
+			//input, so the other inputs must come from the same camera mode
+			if (!reader.hasIntrinsics())
+				throw IOException("Input has no intrinsics to replace the projective coordinates", inputs[i]);
+			if (!sameIntrinsics(reader.getIntrinsics(), intrinsics))
+				throw IOException("Input intrinsics differ from the first input. Merge with projective coordinates instead.", inputs[i]);
+		}
+
+		//Each file starts one frame after the end of the previous one
+		XnInt64 offset = 0;
+		if (lastTimestamp != 0)
+		{
+			int frame = 0;
+			while (frame < reader.frameCount() && reader.getTimestamp(frame) == 0)
+				++frame;
+			if (frame < reader.frameCount())
+				offset = static_cast<XnInt64>(lastTimestamp + FRAME_PERIOD) - static_cast<XnInt64>(reader.getTimestamp(frame));
+		}
+
+		XnUInt64 timestamp = copyFrames(reader, writer, 0, reader.frameCount(), 1, nextFrame, offset);
+		nextFrame += reader.frameCount();
+		if (timestamp != 0)
+			lastTimestamp = timestamp;
+	}
+	writer.close();
+}
+
+void xncv::downsampleSkeletons(const std::string& input, const std::string& output,
+	int factor, const ConvertOptions& options)
+{
+	if (factor < 1)
+		throw Exception("Downsample factor must be at least 1");
+
+	SkeletonReader reader;
+	reader.open(input);
+
+	SkeletonWriter writer;
+	openWriter(writer, reader, output, options);
+
+	copyFrames(reader, writer, 0, reader.frameCount(), factor, 0, 0);
+	writer.close();
+}
+
+void xncv::convertSkeletons(const std::string& input, const std::string& output,
+	const ConvertOptions& options)
+{
+	sliceSkeletons(input, output, 0, -1, options, false);
+}
@@ -0,0 +1,61 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__SKELETONTOOLS_HPP__)
+#define __SKELETONTOOLS_HPP__
+
+#include <string>
+#include <vector>
+#include "skeletoncodec.hpp"
+
+namespace xncv
+{
+	//Output format of the skeleton tools. Files are always written with the
+	//current format version, so old files are upgraded when copied.
+	struct ConvertOptions
+	{
+		bool compressed;
+		CodecParams codec;
+
+		//Without projective coordinates the input must have intrinsics,
+		//which are stored in the output instead.
+		bool storeProjective;
+
+		ConvertOptions();
+	};
+
+	//The tools read one frame at a time from the input and write it as soon
+	//as it is decoded, so memory does not grow with the file size. Neither
+	//OpenNI nor a VideoSource is needed.
+
+	//Copies frames [first, last). A negative last copies until the end.
+	//When renumber is true the output starts at frame 0.
+	void sliceSkeletons(const std::string& input, const std::string& output,
+		int first, int last, const ConvertOptions& options=ConvertOptions(), bool renumber=true);
+
+	//Concatenates the files in order. Frames are renumbered and timestamps
+	//shifted so both keep growing across the files. Without projective
+	//coordinates all inputs must have the same intrinsics.
+	void mergeSkeletons(const std::vector<std::string>& inputs, const std::string& output,
+		const ConvertOptions& options=ConvertOptions());
+
+	//Keeps one of every factor frames, renumbered from 0.
+	void downsampleSkeletons(const std::string& input, const std::string& output,
+		int factor, const ConvertOptions& options=ConvertOptions());
+
+	//Rewrites the file with other version or compression settings.
+	void convertSkeletons(const std::string& input, const std::string& output,
+		const ConvertOptions& options=ConvertOptions());
+}
+
+#endif
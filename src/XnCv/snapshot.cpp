@@ -0,0 +1,131 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "snapshot.hpp"
+#include <cstring>
+
+xncv::SkeletonSnapshot::SkeletonSnapshot()
+{
+	clear();
+}
+
+void xncv::SkeletonSnapshot::clear()
+{
+	frame = 0;
+	timestamp = 0;
+	userCount = 0;
+	memset(users, 0, sizeof(users));
+	memset(present, 0, sizeof(present));
+}
+
+int xncv::SkeletonSnapshot::findUser(XnUserID id) const
+{
+	for (int i = 0; i < userCount; ++i)
+		if (users[i] == id)
+			return i;
+	return -1;
+}
+
+int xncv::SkeletonSnapshot::addUser(XnUserID id)
+{
+	int slot = findUser(id);
+	if (slot != -1)
+		return slot;
+
+	if (userCount == MAX_USERS)
+		return -1;
+
+	slot = userCount++;
+	users[slot] = id;
+	memset(present + index(slot, XN_SKEL_HEAD), 0, MAX_JOINTS);
+	return slot;
+}
+
+void xncv::SkeletonSnapshot::setJoint(int slot, XnSkeletonJoint joint, const XnSkeletonJointTransformation& transform)
+{
+	int i = index(slot, joint);
+	present[i] = 1;
+	x[i] = transform.position.position.X;
+	y[i] = transform.position.position.Y;
+	z[i] = transform.position.position.Z;
+	confidence[i] = transform.position.fConfidence;
+	memcpy(orientation[i], transform.orientation.orientation.elements, sizeof(orientation[i]));
+	orientationConfidence[i] = transform.orientation.fConfidence;
+	projectiveX[i] = 0;
+	projectiveY[i] = 0;
+}
+
+bool xncv::SkeletonSnapshot::getJoint(int slot, XnSkeletonJoint joint, XnSkeletonJointTransformation& transform) const
+{
+	int i = index(slot, joint);
+	if (!present[i])
+		return false;
+
+	transform.position.position.X = x[i];
+	transform.position.position.Y = y[i];
+	transform.position.position.Z = z[i];
+	transform.position.fConfidence = confidence[i];
+	memcpy(transform.orientation.orientation.elements, orientation[i], sizeof(orientation[i]));
+	transform.orientation.fConfidence = orientationConfidence[i];
+	return true;
+}
+
+std::vector<xncv::Limb> xncv::SkeletonSnapshot::getLimbs(int slot) const
+{
+	std::vector<xncv::Limb> limbs;
+	for (XnUInt16 i = 0; i < MAX_LIMBS; ++i)
+	{
+		int j1 = index(slot, LIMB_JOINTS[i][0]);
+		int j2 = index(slot, LIMB_JOINTS[i][1]);
+		if (!present[j1] || !present[j2])
+			continue; // bad joint
+
+		Limb limb;
+		limb.confidence = confidence[j1] < confidence[j2] ? confidence[j1] : confidence[j2];
+		limb.joint1.type = LIMB_JOINTS[i][0];
+		limb.joint1.pos = cv::Point(projectiveX[j1], projectiveY[j1]);
+		limb.joint2.type = LIMB_JOINTS[i][1];
+		limb.joint2.pos = cv::Point(projectiveX[j2], projectiveY[j2]);
+		limbs.push_back(limb);
+	}
+	return limbs;
+}
+
+void xncv::projectSnapshot(SkeletonSnapshot& snapshot, const xn::DepthGenerator& depthGen)
+{
+	//Gather all present joints so they are converted in a single call
+	XnPoint3D world[SkeletonSnapshot::SIZE];
+	XnPoint3D projective[SkeletonSnapshot::SIZE];
+	int indexes[SkeletonSnapshot::SIZE];
+	XnUInt32 count = 0;
+
+	int size = snapshot.userCount * MAX_JOINTS;
+	for (int i = 0; i < size; ++i)
+	{
+		if (!snapshot.present[i])
+			continue;
+		world[count].X = snapshot.x[i];
+		world[count].Y = snapshot.y[i];
+		world[count].Z = snapshot.z[i];
+		indexes[count++] = i;
+	}
+
+	if (count == 0 || depthGen.ConvertRealWorldToProjective(count, world, projective) != XN_STATUS_OK)
+		return;
+
+	for (XnUInt32 i = 0; i < count; ++i)
+	{
+		snapshot.projectiveX[indexes[i]] = static_cast<int>(projective[i].X);
+		snapshot.projectiveY[indexes[i]] = static_cast<int>(projective[i].Y);
+	}
+}
@@ -0,0 +1,60 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__SNAPSHOT_HPP__)
+#define __SNAPSHOT_HPP__
+
+#include "user.hpp"
+
+namespace xncv
+{
+	const XnUInt16 MAX_USERS=5;
+	const XnUInt16 MAX_JOINTS=24;
+
+	//Skeleton of all tracked users in a single frame, stored as a structure of
+	//arrays. Joint data of the user in slot s is found at index(s, joint).
+	struct SkeletonSnapshot
+	{
+		static const int SIZE = MAX_USERS * MAX_JOINTS;
+
+		int frame;
+		XnUInt64 timestamp; //In microseconds
+		XnUInt16 userCount;
+		XnUserID users[MAX_USERS];
+
+		unsigned char present[SIZE];
+		float x[SIZE];
+		float y[SIZE];
+		float z[SIZE];
+		float confidence[SIZE];
+		float orientation[SIZE][9];
+		float orientationConfidence[SIZE];
+		int projectiveX[SIZE];
+		int projectiveY[SIZE];
+
+		SkeletonSnapshot();
+		void clear();
+
+		static int index(int slot, XnSkeletonJoint joint) { return slot * MAX_JOINTS + (joint - 1); }
+		int findUser(XnUserID id) const;
+		int addUser(XnUserID id);
+
+		void setJoint(int slot, XnSkeletonJoint joint, const XnSkeletonJointTransformation& transform);
+		bool getJoint(int slot, XnSkeletonJoint joint, XnSkeletonJointTransformation& transform) const;
+		std::vector<Limb> getLimbs(int slot) const;
+	};
+
+	void projectSnapshot(SkeletonSnapshot& snapshot, const xn::DepthGenerator& depthGen);
+}
+
+#endif
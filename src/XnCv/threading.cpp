@@ -0,0 +1,317 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#include "threading.hpp"
+#include <exception>
+#include <algorithm>
+#include <XnCppWrapper.h>
+#include <opencv2\core\core.hpp>
+#include "exceptions.hpp"
+#include "profiler.hpp"
+
+//-----------------------------------------------------------------------------
+//Synchronization primitives
+//-----------------------------------------------------------------------------
+xncv::CriticalSection::CriticalSection()
+{
+	XnStatus status = xnOSCreateCriticalSection(&handle);
+	if (status != XN_STATUS_OK)
+		throw Exception("Unable to create critical section", status);
+}
+
+void xncv::CriticalSection::lock()
+{
+	xnOSEnterCriticalSection(&handle);
+}
+
+void xncv::CriticalSection::unlock()
+{
+	xnOSLeaveCriticalSection(&handle);
+}
+
+xncv::CriticalSection::~CriticalSection()
+{
+	xnOSCloseCriticalSection(&handle);
+}
+
+xncv::Event::Event(bool manualReset)
+{
+	XnStatus status = xnOSCreateEvent(&handle, manualReset ? TRUE : FALSE);
+	if (status != XN_STATUS_OK)
+		throw Exception("Unable to create event", status);
+}
+
+void xncv::Event::set()
+{
+	xnOSSetEvent(handle);
+}
+
+void xncv::Event::reset()
+{
+	xnOSResetEvent(handle);
+}
+
+bool xncv::Event::wait(XnUInt32 milliseconds)
+{
+	return xnOSWaitEvent(handle, milliseconds) == XN_STATUS_OK;
+}
+
+xncv::Event::~Event()
+{
+	xnOSCloseEvent(&handle);
+}
+
+//-----------------------------------------------------------------------------
+//Thread
+//-----------------------------------------------------------------------------
+xncv::Thread::Thread() : handle(NULL), running(false)
+{
+}
+
+XN_THREAD_PROC xncv::Thread::run(XN_THREAD_PARAM param)
+{
+	static_cast<Thread*>(param)->body();
+	profileThreadExit();
+	XN_THREAD_PROC_RETURN(XN_STATUS_OK);
+}
+
+void xncv::Thread::start(const std::function<void()>& function)
+{
+	if (running)
+		join();
+
+	body = function;
+	XnStatus status = xnOSCreateThread(&Thread::run, this, &handle);
+	if (status != XN_STATUS_OK)
+		throw Exception("Unable to create thread", status);
+	running = true;
+}
+
+void xncv::Thread::join()
+{
+	if (!running)
+		return;
+
+	xnOSWaitForThreadExit(handle, XN_WAIT_INFINITE);
+	xnOSCloseThread(&handle);
+	running = false;
+}
+
+bool xncv::Thread::isRunning() const
+{
+	return running;
+}
+
+xncv::Thread::~Thread()
+{
+	join();
+}
+
+//-----------------------------------------------------------------------------
+//Thread pool
+//-----------------------------------------------------------------------------
+xncv::ThreadPool::ThreadPool(int threads) : taskReady(true), stopping(false)
+{
+	//The thread calling parallelFor also works, so leave one core for it.
+	if (threads <= 0)
+		threads = cv::getNumberOfCPUs() - 1;
+
+	for (int i = 0; i < threads; ++i)
+	{
+		workers.push_back(new Thread());
+		workers.back()->start([this]() { work(); });
+	}
+}
+
+int xncv::ThreadPool::size() const
+{
+	return static_cast<int>(workers.size());
+}
+
+void xncv::ThreadPool::submit(const std::function<void()>& task)
+{
+	if (workers.empty())
+	{
+		task();
+		return;
+	}
+
+	Lock lock(mutex);
+	tasks.push_back(task);
+	taskReady.set();
+}
+
+bool xncv::ThreadPool::runPending()
+{
+	std::function<void()> task;
+	{
+		Lock lock(mutex);
+		if (tasks.empty())
+			return false;
+		task = tasks.front();
+		tasks.pop_front();
+	}
+
+	try
+	{
+		task();
+	}
+	catch (...)
+	{
+		//Tasks are responsible for reporting their own errors
+	}
+	return true;
+}
+
+void xncv::ThreadPool::work()
+{
+	for (;;)
+	{
+		std::function<void()> task;
+		{
+			Lock lock(mutex);
+			while (tasks.empty() && !stopping)
+			{
+				taskReady.reset();
+				mutex.unlock();
+				taskReady.wait();
+				mutex.lock();
+			}
+			if (tasks.empty())
+				return;
+
+			task = tasks.front();
+			tasks.pop_front();
+		}
+
+		try
+		{
+			task();
+		}
+		catch (...)
+		{
+			//Tasks are responsible for reporting their own errors
+		}
+	}
+}
+
+namespace
+{
+	struct ParallelForState
+	{
+		xncv::CriticalSection mutex;
+		xncv::Event done;
+		int remaining;
+		std::exception_ptr error;
+
+		ParallelForState(int chunks) : done(true), remaining(chunks) {}
+
+		void run(const std::function<void(int, int)>& body, int begin, int end)
+		{
+			try
+			{
+				body(begin, end);
+			}
+			catch (...)
+			{
+				xncv::Lock lock(mutex);
+				if (!error)
+					error = std::current_exception();
+			}
+
+			xncv::Lock lock(mutex);
+			if (--remaining == 0)
+				done.set();
+		}
+
+		bool finished()
+		{
+			xncv::Lock lock(mutex);
+			return remaining == 0;
+		}
+	};
+}
+
+void xncv::ThreadPool::parallelFor(int begin, int end, const std::function<void(int, int)>& body, int grain)
+{
+	if (end <= begin)
+		return;
+
+	if (grain < 1)
+		grain = 1;
+
+	//A few chunks per thread balance uneven workloads
+	int length = end - begin;
+	int chunks = (length + grain - 1) / grain;
+	int maxChunks = 4 * (size() + 1);
+	if (chunks > maxChunks)
+		chunks = maxChunks;
+
+	if (chunks == 1 || workers.empty())
+	{
+		body(begin, end);
+		return;
+	}
+
+	ParallelForState state(chunks);
+	for (int i = 1; i < chunks; ++i)
+	{
+		int first = begin + static_cast<int>(static_cast<long long>(length) * i / chunks);
+		int last = begin + static_cast<int>(static_cast<long long>(length) * (i + 1) / chunks);
+		submit([&state, &body, first, last]() { state.run(body, first, last); });
+	}
+	state.run(body, begin, begin + length / chunks);
+
+	//Help with queued work instead of blocking, so nested calls from
+	//inside the pool never starve.
+	while (!state.finished())
+		if (!runPending())
+			state.done.wait();
+
+	if (state.error)
+		std::rethrow_exception(state.error);
+}
+
+xncv::ThreadPool::~ThreadPool()
+{
+	{
+		Lock lock(mutex);
+		stopping = true;
+		taskReady.set();
+	}
+
+	for (unsigned i = 0; i < workers.size(); ++i)
+		delete workers[i];
+}
+
+xncv::ThreadPool& xncv::defaultThreadPool()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+void xncv::parallelTiles(int count, bool parallel, const std::function<void(int, int)>& body)
+{
+	ThreadPool& pool = defaultThreadPool();
+	int tiles = parallel ? std::min(pool.size() + 1, count) : 1;
+	if (tiles <= 1)
+	{
+		body(0, count);
+		return;
+	}
+
+	pool.parallelFor(0, tiles, [&](int begin, int end) {
+		for (int t = begin; t < end; ++t)
+			body(count * t / tiles, count * (t + 1) / tiles);
+	});
+}
@@ -0,0 +1,123 @@
+/******************************************************************************
+*
+* COPYRIGHT Vincius G. Mendona ALL RIGHTS RESERVED.
+*
+* This software cannot be copied, stored, distributed without
+* Vincius G.Mendona prior authorization.
+*
+* This file was made available on https://github.com/ViniGodoy/xncv and it
+* is free to be restributed or used under Creative Commons license 2.5 br:
+* http://creativecommons.org/licenses/by-sa/2.5/br/
+*
+*******************************************************************************/
+
+#if !defined(__THREADING_HPP__)
+#define __THREADING_HPP__
+
+#include <deque>
+#include <vector>
+#include <functional>
+#include <XnOS.h>
+
+namespace xncv
+{
+	//What a producer does when a bounded queue is full: wait for the
+	//consumer, drop the new item or let the queue grow
+	enum QueuePolicy {QUEUE_BLOCK, QUEUE_DROP, QUEUE_GROW};
+
+	class CriticalSection
+	{
+		private:
+			XN_CRITICAL_SECTION_HANDLE handle;
+
+			CriticalSection(const CriticalSection&);
+			CriticalSection& operator=(const CriticalSection&);
+		public:
+			CriticalSection();
+			void lock();
+			void unlock();
+			~CriticalSection();
+	};
+
+	class Lock
+	{
+		private:
+			CriticalSection& section;
+
+			Lock(const Lock&);
+			Lock& operator=(const Lock&);
+		public:
+			Lock(CriticalSection& criticalSection) : section(criticalSection) { section.lock(); }
+			~Lock() { section.unlock(); }
+	};
+
+	class Event
+	{
+		private:
+			XN_EVENT_HANDLE handle;
+
+			Event(const Event&);
+			Event& operator=(const Event&);
+		public:
+			Event(bool manualReset=true);
+			void set();
+			void reset();
+			bool wait(XnUInt32 milliseconds=XN_WAIT_INFINITE);
+			~Event();
+	};
+
+	class Thread
+	{
+		private:
+			XN_THREAD_HANDLE handle;
+			std::function<void()> body;
+			bool running;
+
+			static XN_THREAD_PROC run(XN_THREAD_PARAM param);
+
+			Thread(const Thread&);
+			Thread& operator=(const Thread&);
+		public:
+			Thread();
+			void start(const std::function<void()>& function);
+			void join();
+			bool isRunning() const;
+			~Thread();
+	};
+
+	class ThreadPool
+	{
+		private:
+			std::vector<Thread*> workers;
+			std::deque<std::function<void()> > tasks;
+			CriticalSection mutex;
+			Event taskReady;
+			bool stopping;
+
+			void work();
+			bool runPending();
+
+			ThreadPool(const ThreadPool&);
+			ThreadPool& operator=(const ThreadPool&);
+		public:
+			ThreadPool(int threads=0);
+
+			int size() const;
+			void submit(const std::function<void()>& task);
+
+			//Splits [begin, end) in chunks of at least grain elements and
+			//runs them on the pool. The calling thread also takes part and
+			//returns only when all chunks are finished.
+			void parallelFor(int begin, int end, const std::function<void(int, int)>& body, int grain=1);
+
+			~ThreadPool();
+	};
+
+	ThreadPool& defaultThreadPool();
+
+	//Runs body(first, last) over [0, count) split in one contiguous tile
+	//per thread of the default pool, or in a single call if not parallel
+	void parallelTiles(int count, bool parallel, const std::function<void(int, int)>& body);
+}
+
+#endif
@@ -12,6 +12,27 @@
 *******************************************************************************/
 
 #include "user.hpp"
+#include "profiler.hpp"
+
+const XnSkeletonJoint xncv::LIMB_JOINTS[MAX_LIMBS][2] =
+{
+	{ XN_SKEL_HEAD, XN_SKEL_NECK },
+	{ XN_SKEL_NECK, XN_SKEL_LEFT_SHOULDER },
+	{ XN_SKEL_LEFT_SHOULDER, XN_SKEL_LEFT_ELBOW },
+	{ XN_SKEL_LEFT_ELBOW, XN_SKEL_LEFT_HAND },
+	{ XN_SKEL_NECK, XN_SKEL_RIGHT_SHOULDER },
+	{ XN_SKEL_RIGHT_SHOULDER, XN_SKEL_RIGHT_ELBOW },
+	{ XN_SKEL_RIGHT_ELBOW, XN_SKEL_RIGHT_HAND },
+	{ XN_SKEL_LEFT_SHOULDER, XN_SKEL_TORSO },
+	{ XN_SKEL_RIGHT_SHOULDER, XN_SKEL_TORSO },
+	{ XN_SKEL_TORSO, XN_SKEL_LEFT_HIP },
+	{ XN_SKEL_LEFT_HIP, XN_SKEL_LEFT_KNEE },
+	{ XN_SKEL_LEFT_KNEE, XN_SKEL_LEFT_FOOT },
+	{ XN_SKEL_TORSO, XN_SKEL_RIGHT_HIP },
+	{ XN_SKEL_RIGHT_HIP, XN_SKEL_RIGHT_KNEE },
+	{ XN_SKEL_RIGHT_KNEE, XN_SKEL_RIGHT_FOOT },
+	{ XN_SKEL_LEFT_HIP, XN_SKEL_RIGHT_HIP },
+};
 
 xncv::User::User(XnUserID userId, xn::UserGenerator* generator)
 : id(userId), userGen(generator)
@@ -76,6 +97,7 @@ bool xncv::User::getJoint(XnSkeletonJoint type, XnSkeletonJointTransformation& t
 
 std::map<XnSkeletonJoint, XnSkeletonJointTransformation> xncv::User::getJoints() const
 {
+	XNCV_PROFILE_SCOPE("User::getJoints");
 	std::map<XnSkeletonJoint, XnSkeletonJointTransformation> jointMap;
 	if (!isTracking())
 		return jointMap;
@@ -95,26 +117,7 @@ std::map<XnSkeletonJoint, XnSkeletonJointTransformation> xncv::User::getJoints()
 
 std::vector<xncv::Limb> xncv::User::getLimbs(const xn::DepthGenerator& depthGen) const
 {
-    static XnSkeletonJoint LIMB_JOINTS[][2] =
-    {
-        { XN_SKEL_HEAD, XN_SKEL_NECK },
-        { XN_SKEL_NECK, XN_SKEL_LEFT_SHOULDER },
-        { XN_SKEL_LEFT_SHOULDER, XN_SKEL_LEFT_ELBOW },
-        { XN_SKEL_LEFT_ELBOW, XN_SKEL_LEFT_HAND },
-        { XN_SKEL_NECK, XN_SKEL_RIGHT_SHOULDER },
-        { XN_SKEL_RIGHT_SHOULDER, XN_SKEL_RIGHT_ELBOW },
-        { XN_SKEL_RIGHT_ELBOW, XN_SKEL_RIGHT_HAND },
-        { XN_SKEL_LEFT_SHOULDER, XN_SKEL_TORSO },
-        { XN_SKEL_RIGHT_SHOULDER, XN_SKEL_TORSO },
-        { XN_SKEL_TORSO, XN_SKEL_LEFT_HIP },
-        { XN_SKEL_LEFT_HIP, XN_SKEL_LEFT_KNEE },
-        { XN_SKEL_LEFT_KNEE, XN_SKEL_LEFT_FOOT },
-        { XN_SKEL_TORSO, XN_SKEL_RIGHT_HIP },
-        { XN_SKEL_RIGHT_HIP, XN_SKEL_RIGHT_KNEE },
-        { XN_SKEL_RIGHT_KNEE, XN_SKEL_RIGHT_FOOT },
-        { XN_SKEL_LEFT_HIP, XN_SKEL_RIGHT_HIP },
-    };
-
+	XNCV_PROFILE_SCOPE("User::getLimbs");
 	std::vector<xncv::Limb> limbs;
 
 	if (!isTracking())
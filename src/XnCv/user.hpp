@@ -21,6 +21,7 @@
 namespace xncv
 {
 	const XnUInt16 MAX_LIMBS=16;
+	extern const XnSkeletonJoint LIMB_JOINTS[MAX_LIMBS][2];
 
 	struct JointInfo
 	{
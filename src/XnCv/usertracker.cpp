@@ -13,25 +13,55 @@
 
 #include "usertracker.hpp"
 #include "exceptions.hpp"
+#include "threading.hpp"
+#include "profiler.hpp"
 
 using namespace std;
 
+namespace
+{
+	//Frames a cached calibration has to produce a skeleton
+	const int CALIBRATION_TRIAL_FRAMES = 30;
+
+	XnUInt64 now()
+	{
+		XnUInt64 timestamp = 0;
+		xnOSGetHighResTimeStamp(&timestamp);
+		return timestamp;
+	}
+}
+
 // Callback: New user was detected
-void XN_CALLBACK_TYPE onNewUser(xn::UserGenerator& generator, XnUserID nId, void* pCookie)
+void XN_CALLBACK_TYPE xncv::UserTracker::onNewUser(xn::UserGenerator& generator, XnUserID nId, void* pCookie)
 {
+	UserTracker* tracker = static_cast<UserTracker*>(pCookie);
+	tracker->detectionTimes[nId] = now();
+
+	//Returning users are usually tracked right away with a recent calibration
+	if (tracker->loadCachedCalibration(nId))
+		return;
+
     generator.GetSkeletonCap().RequestCalibration(nId, TRUE);
 }
 
 // Callback: An existing user was lost
-void XN_CALLBACK_TYPE onLostUser(xn::UserGenerator& generator, XnUserID nId, void* pCookie)
+void XN_CALLBACK_TYPE xncv::UserTracker::onLostUser(xn::UserGenerator& generator, XnUserID nId, void* pCookie)
 {
+	UserTracker* tracker = static_cast<UserTracker*>(pCookie);
+	tracker->detectionTimes.erase(nId);
+	tracker->trials.erase(nId);
 }
 
-void XN_CALLBACK_TYPE onCalibrationComplete(xn::SkeletonCapability& capability, XnUserID nId, XnCalibrationStatus eStatus, void* pCookie)
+void XN_CALLBACK_TYPE xncv::UserTracker::onCalibrationComplete(xn::SkeletonCapability& capability, XnUserID nId, XnCalibrationStatus eStatus, void* pCookie)
 {
     if (eStatus == XN_CALIBRATION_STATUS_OK)
 	{
-        capability.StartTracking(nId);
+		UserTracker* tracker = static_cast<UserTracker*>(pCookie);
+		tracker->cacheCalibration(nId);
+		capability.StartTracking(nId);
+
+		CalibrationTrial trial = {false, 0, 0, 0};
+		tracker->trials[nId] = trial;
 		return;
 	}
 
@@ -44,7 +74,11 @@ void XN_CALLBACK_TYPE onCalibrationComplete(xn::SkeletonCapability& capability,
 }
 
 xncv::UserTracker::UserTracker(VideoSource& source, XnSkeletonProfile profile)
+	: depthGen(&source.getXnDepthGenerator()), intrinsics(source.getIntrinsics()), calibrationCacheSize(0),
+	trialFrame(0), historySize(0)
 {
+	resetCalibrationStats();
+
 	if (source.fromFile())
 		throw xncv::NoCapabilityException("Cannot generate skeleton from files!");
 
@@ -58,14 +92,15 @@ xncv::UserTracker::UserTracker(VideoSource& source, XnSkeletonProfile profile)
 		throw xncv::NoCapabilityException("Generator does not suport skeleton capability!");
 	}
 	userGen.GetSkeletonCap().SetSkeletonProfile(profile);
-	userGen.RegisterUserCallbacks(&onNewUser, &onLostUser, nullptr, userHandler);
-	userGen.GetSkeletonCap().RegisterToCalibrationComplete(&onCalibrationComplete, nullptr, calibrationHandler);
+	userGen.RegisterUserCallbacks(&onNewUser, &onLostUser, this, userHandler);
+	userGen.GetSkeletonCap().RegisterToCalibrationComplete(&onCalibrationComplete, this, calibrationHandler);
 
 	userGen.StartGenerating();
 }
 
 xncv::UserTracker::~UserTracker()
 {
+	setCalibrationCacheSize(0);
 	userGen.UnregisterUserCallbacks(userHandler);
 	userGen.GetSkeletonCap().UnregisterFromCalibrationComplete(calibrationHandler);
 	userGen.Release();
@@ -94,8 +129,10 @@ bool xncv::UserTracker::setProfile(XnSkeletonProfile profile)
 
 bool xncv::UserTracker::hasUser(XnUserID id)
 {
-	XnUserID ids[5];
-	XnUInt16 numIds = 5;
+	updateTrials();
+
+	XnUserID ids[MAX_USERS];
+	XnUInt16 numIds = MAX_USERS;
 	userGen.GetUsers(ids, numIds);
 
 	for (int i = 0; i < numIds; ++i)
@@ -113,8 +150,11 @@ xncv::User xncv::UserTracker::getUser(XnUserID id)
 
 vector<xncv::User> xncv::UserTracker::getUsers()
 {
-	XnUserID ids[5];
-	XnUInt16 numIds = 5;
+	XNCV_PROFILE_SCOPE("UserTracker::getUsers");
+	updateTrials();
+
+	XnUserID ids[MAX_USERS];
+	XnUInt16 numIds = MAX_USERS;
 	userGen.GetUsers(ids, numIds);
 
 	vector<User> users;
@@ -123,6 +163,228 @@ vector<xncv::User> xncv::UserTracker::getUsers()
 	return users;
 }
 
+void xncv::UserTracker::captureSkeletons(SkeletonSnapshot& snapshot)
+{
+	XNCV_PROFILE_SCOPE("UserTracker::captureSkeletons");
+	snapshot.clear();
+	snapshot.frame = static_cast<int>(depthGen->GetFrameID());
+	snapshot.timestamp = depthGen->GetTimestamp();
+
+	updateTrials();
+
+	XnUserID ids[MAX_USERS];
+	XnUInt16 numIds = MAX_USERS;
+	userGen.GetUsers(ids, numIds);
+
+	XnSkeletonJoint joints[MAX_JOINTS];
+	XnUInt16 numJoints = MAX_JOINTS;
+	userGen.GetSkeletonCap().EnumerateActiveJoints(joints, numJoints);
+
+	for (int i = 0; i < numIds; ++i)
+	{
+		if (!userGen.GetSkeletonCap().IsTracking(ids[i]) || userGen.GetSkeletonCap().IsCalibrating(ids[i]))
+			continue;
+
+		int slot = snapshot.addUser(ids[i]);
+		for (int j = 0; j < numJoints; ++j)
+		{
+			XnSkeletonJointTransformation joint;
+			if (userGen.GetSkeletonCap().GetSkeletonJoint(ids[i], joints[j], joint) == XN_STATUS_OK)
+				snapshot.setJoint(slot, joints[j], joint);
+		}
+	}
+
+	projectSnapshot(snapshot, *depthGen);
+
+	if (historySize > 0)
+		history.push(snapshot);
+}
+
+cv::Mat xncv::UserTracker::captureLabels(bool clone) const
+{
+	XNCV_PROFILE_SCOPE("UserTracker::captureLabels");
+	return clone ? xncv::captureLabels(userGen).clone() : xncv::captureLabels(userGen);
+}
+
+std::vector<xncv::PointCloud> xncv::UserTracker::capturePointClouds(float voxelSize, bool parallel) const
+{
+	XNCV_PROFILE_SCOPE("UserTracker::capturePointClouds");
+	return calcPointClouds(captureLabels(), xncv::captureDepth(*depthGen), intrinsics,
+		voxelSize, parallel ? &defaultThreadPool() : NULL);
+}
+
+bool xncv::UserTracker::loadCachedCalibration(XnUserID id, unsigned firstSlot)
+{
+	for (unsigned i = firstSlot; i < calibrationSlots.size(); ++i)
+	{
+		XnUInt32 slot = calibrationSlots[i];
+		if (userGen.GetSkeletonCap().LoadCalibrationData(id, slot) != XN_STATUS_OK)
+			continue;
+
+		if (userGen.GetSkeletonCap().StartTracking(id) != XN_STATUS_OK)
+			continue;
+
+		CalibrationTrial trial = {true, i + 1, slot, 0};
+		trials[id] = trial;
+		return true;
+	}
+	return false;
+}
+
+void xncv::UserTracker::cacheCalibration(XnUserID id)
+{
+	if (calibrationCacheSize <= 0)
+		return;
+
+	//Reuses the least recently used slot when the cache is full
+	XnUInt32 slot = 0;
+	if (static_cast<int>(calibrationSlots.size()) >= calibrationCacheSize)
+	{
+		slot = calibrationSlots.back();
+		calibrationSlots.pop_back();
+		userGen.GetSkeletonCap().ClearCalibrationData(slot);
+	}
+	else
+	{
+		while (std::find(calibrationSlots.begin(), calibrationSlots.end(), slot) != calibrationSlots.end())
+			++slot;
+	}
+
+	if (userGen.GetSkeletonCap().SaveCalibrationData(id, slot) == XN_STATUS_OK)
+		calibrationSlots.insert(calibrationSlots.begin(), slot);
+}
+
+bool xncv::UserTracker::hasSkeleton(XnUserID id)
+{
+	if (!userGen.GetSkeletonCap().IsTracking(id))
+		return false;
+
+	XnSkeletonJointPosition torso;
+	return userGen.GetSkeletonCap().GetSkeletonJointPosition(id, XN_SKEL_TORSO, torso) == XN_STATUS_OK &&
+		torso.fConfidence > 0.0f;
+}
+
+void xncv::UserTracker::updateTrials()
+{
+	//Trials count frames, however many queries each frame gets
+	XnUInt32 frame = depthGen->GetFrameID();
+	if (frame == trialFrame)
+		return;
+	trialFrame = frame;
+
+	auto trial = trials.begin();
+	while (trial != trials.end())
+	{
+		XnUserID id = trial->first;
+		CalibrationTrial& state = trial->second;
+		if (hasSkeleton(id))
+		{
+			//Confirmed: keeps the slot as the most recently used
+			auto slot = std::find(calibrationSlots.begin(), calibrationSlots.end(), state.slot);
+			if (state.cached && slot != calibrationSlots.end())
+			{
+				calibrationSlots.erase(slot);
+				calibrationSlots.insert(calibrationSlots.begin(), state.slot);
+			}
+			recordTimeToSkeleton(id, state.cached);
+			trials.erase(trial++);
+			continue;
+		}
+
+		//Full calibrations are trusted, they only wait for the skeleton
+		if (!state.cached || ++state.frames < CALIBRATION_TRIAL_FRAMES)
+		{
+			++trial;
+			continue;
+		}
+
+		userGen.GetSkeletonCap().StopTracking(id);
+		unsigned nextSlot = state.nextSlot;
+		trials.erase(trial++);
+		if (!loadCachedCalibration(id, nextSlot))
+			userGen.GetSkeletonCap().RequestCalibration(id, TRUE);
+	}
+}
+
+void xncv::UserTracker::recordTimeToSkeleton(XnUserID id, bool cached)
+{
+	auto detection = detectionTimes.find(id);
+	if (detection == detectionTimes.end())
+		return;
+
+	double elapsed = (now() - detection->second) / 1000.0;
+	detectionTimes.erase(detection);
+
+	//Incremental means
+	CalibrationStats& stats = calibrationStats;
+	stats.lastTimeToSkeleton = elapsed;
+	if (cached)
+	{
+		++stats.cachedCalibrations;
+		stats.meanCachedTimeToSkeleton += (elapsed - stats.meanCachedTimeToSkeleton) / stats.cachedCalibrations;
+	}
+	else
+	{
+		++stats.fullCalibrations;
+		stats.meanFullTimeToSkeleton += (elapsed - stats.meanFullTimeToSkeleton) / stats.fullCalibrations;
+	}
+}
+
+void xncv::UserTracker::setCalibrationCacheSize(int size)
+{
+	calibrationCacheSize = size < 0 ? 0 : size;
+	while (static_cast<int>(calibrationSlots.size()) > calibrationCacheSize)
+	{
+		userGen.GetSkeletonCap().ClearCalibrationData(calibrationSlots.back());
+		calibrationSlots.pop_back();
+	}
+}
+
+int xncv::UserTracker::getCalibrationCacheSize() const
+{
+	return calibrationCacheSize;
+}
+
+void xncv::UserTracker::clearCalibrationCache()
+{
+	for (unsigned i = 0; i < calibrationSlots.size(); ++i)
+		userGen.GetSkeletonCap().ClearCalibrationData(calibrationSlots[i]);
+	calibrationSlots.clear();
+}
+
+void xncv::UserTracker::resetCalibrationStats()
+{
+	calibrationStats.cachedCalibrations = 0;
+	calibrationStats.fullCalibrations = 0;
+	calibrationStats.lastTimeToSkeleton = 0.0;
+	calibrationStats.meanCachedTimeToSkeleton = 0.0;
+	calibrationStats.meanFullTimeToSkeleton = 0.0;
+}
+
+const xncv::CalibrationStats& xncv::UserTracker::getCalibrationStats() const
+{
+	return calibrationStats;
+}
+
+void xncv::UserTracker::setHistorySize(int frames)
+{
+	historySize = frames < 0 ? 0 : frames;
+	if (historySize > 0)
+		history.setCapacity(historySize);
+	else
+		history.reset();
+}
+
+int xncv::UserTracker::getHistorySize() const
+{
+	return historySize;
+}
+
+const xncv::SkeletonHistory& xncv::UserTracker::getHistory() const
+{
+	return history;
+}
+
 void xncv::drawLimbs(cv::Mat& image, const vector<xncv::Limb>& limbs, float confidenceThreshold, unsigned char color)
 {
 	std::for_each(limbs.begin(), limbs.end(), [&image, confidenceThreshold, color](const xncv::Limb& limb)
@@ -130,9 +392,25 @@ void xncv::drawLimbs(cv::Mat& image, const vector<xncv::Limb>& limbs, float conf
 		cv::line(image, limb.joint1.pos, limb.joint2.pos,
 			cv::Scalar::all(color), 
 			limb.confidence < confidenceThreshold ? 1 : 2);
-		cv::circle(image, limb.joint1.pos, 3, cv::Scalar::all(color), -1);
-		cv::circle(image, limb.joint2.pos, 3, cv::Scalar::all(color), -1);
 	});
+
+	//Joints are shared between limbs, so each one is drawn only once
+	vector<xncv::JointInfo> drawn;
+	for (unsigned i = 0; i < limbs.size(); ++i)
+	{
+		const xncv::JointInfo* joints[] = {&limbs[i].joint1, &limbs[i].joint2};
+		for (int j = 0; j < 2; ++j)
+		{
+			bool found = false;
+			for (unsigned k = 0; k < drawn.size() && !found; ++k)
+				found = drawn[k].type == joints[j]->type && drawn[k].pos == joints[j]->pos;
+			if (found)
+				continue;
+
+			cv::circle(image, joints[j]->pos, 3, cv::Scalar::all(color), -1);
+			drawn.push_back(*joints[j]);
+		}
+	}
 }
 
 std::vector<xncv::User> xncv::filterClosest(const std::vector<xncv::User>& users)
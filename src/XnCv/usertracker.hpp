@@ -16,17 +16,68 @@
 
 #include "videosource.hpp"
 #include "user.hpp"
+#include "snapshot.hpp"
+#include "skeletonhistory.hpp"
+#include "pointcloud.hpp"
 
 namespace xncv
 {
+	struct CalibrationStats
+	{
+		int cachedCalibrations;
+		int fullCalibrations;
+
+		//Time from user detection to the first tracked joints, in
+		//milliseconds
+		double lastTimeToSkeleton;
+		double meanCachedTimeToSkeleton;
+		double meanFullTimeToSkeleton;
+	};
+
 	class UserTracker
 	{
 		private:			
 			xn::UserGenerator userGen;
+			xn::DepthGenerator* depthGen;
+			Intrinsics intrinsics;
 
 			XnCallbackHandle calibrationHandler;
 			XnCallbackHandle userHandler;
 
+			//Calibration cache: OpenNI slots, most recently used first
+			int calibrationCacheSize;
+			std::vector<XnUInt32> calibrationSlots;
+			std::map<XnUserID, XnUInt64> detectionTimes;
+			CalibrationStats calibrationStats;
+
+			//Loading a slot only means OpenNI accepted it, so each user is on
+			//trial until real joints arrive. A cached slot that gives no
+			//skeleton in time is dropped for the next one, and then for a
+			//full calibration.
+			struct CalibrationTrial
+			{
+				bool cached;
+				unsigned nextSlot;
+				XnUInt32 slot;
+				int frames;
+			};
+			std::map<XnUserID, CalibrationTrial> trials;
+			XnUInt32 trialFrame;
+
+			//Filled by captureSkeletons when historySize is not zero
+			SkeletonHistory history;
+			int historySize;
+
+			bool loadCachedCalibration(XnUserID id, unsigned firstSlot=0);
+			void cacheCalibration(XnUserID id);
+			void updateTrials();
+			bool hasSkeleton(XnUserID id);
+			void recordTimeToSkeleton(XnUserID id, bool cached);
+
+			static void XN_CALLBACK_TYPE onNewUser(xn::UserGenerator& generator, XnUserID nId, void* pCookie);
+			static void XN_CALLBACK_TYPE onLostUser(xn::UserGenerator& generator, XnUserID nId, void* pCookie);
+			static void XN_CALLBACK_TYPE onCalibrationComplete(xn::SkeletonCapability& capability, XnUserID nId, XnCalibrationStatus eStatus, void* pCookie);
+
 		public:
 			UserTracker(VideoSource& source, XnSkeletonProfile profile=XN_SKEL_PROFILE_ALL);
 			~UserTracker();
@@ -35,9 +86,26 @@ namespace xncv
 			bool setJointActive(XnSkeletonJoint joint, bool active=true);
 			bool setProfile(XnSkeletonProfile profile);
 
+			//These and captureSkeletons also confirm pending calibrations,
+			//so one of them should run every frame
 			bool hasUser(XnUserID id);
 			User getUser(XnUserID id);
 			std::vector<User> getUsers();
+
+			void captureSkeletons(SkeletonSnapshot& snapshot);
+			cv::Mat captureLabels(bool clone=false) const;
+			std::vector<PointCloud> capturePointClouds(float voxelSize=0.0f, bool parallel=true) const;
+
+			void setCalibrationCacheSize(int size);
+			int getCalibrationCacheSize() const;
+			void clearCalibrationCache();
+			const CalibrationStats& getCalibrationStats() const;
+			void resetCalibrationStats();
+
+			//Frames kept for each user by captureSkeletons, 0 disables it
+			void setHistorySize(int frames);
+			int getHistorySize() const;
+			const SkeletonHistory& getHistory() const;
 	};
 
 	void drawLimbs(cv::Mat& image, const std::vector<xncv::Limb>& limbs, float confidenceThreshold=0.5f, unsigned char color=0);
@@ -15,10 +15,11 @@
 #include "functions.hpp"
 #include "exceptions.hpp"
 
-void xncv::VideoSource::init(const std::string& file)
+void xncv::VideoSource::init(const std::string& file, int device)
 {
 	recorder = nullptr;
 	isFile = !file.empty();
+	lastFrameId = 0;
 	if (context.Init() != XN_STATUS_OK) throw std::runtime_error("Unable to init context");
 
 	if (isFile)
@@ -29,11 +30,36 @@ void xncv::VideoSource::init(const std::string& file)
 			throw UnableToInitGenerator("Unable to init image generator.");
 		if (context.FindExistingNode(XN_NODE_TYPE_DEPTH, depthGen) != XN_STATUS_OK)
 			throw UnableToInitGenerator("Unable to depth generator.");
+		intrinsics = xncv::getIntrinsics(depthGen);
 		return;
 	}
 
-	if (imgGen.Create(context) != XN_STATUS_OK) throw UnableToInitGenerator("Unable to init image generator.");
-	if (depthGen.Create(context) != XN_STATUS_OK) throw UnableToInitGenerator("Unable to depth generator.");
+	//Other sensors are selected by creating their device node first
+	xn::Query query;
+	xn::Query* deviceQuery = NULL;
+	if (device > 0)
+	{
+		xn::NodeInfoList devices;
+		if (context.EnumerateProductionTrees(XN_NODE_TYPE_DEVICE, NULL, devices) != XN_STATUS_OK)
+			throw UnableToInitGenerator("Unable to find devices.");
+
+		xn::NodeInfoList::Iterator it = devices.Begin();
+		for (int i = 0; i < device && it != devices.End(); ++i)
+			++it;
+		if (it == devices.End())
+			throw UnableToInitGenerator("Device not found.");
+
+		xn::NodeInfo deviceInfo = *it;
+		xn::Device deviceNode;
+		if (context.CreateProductionTree(deviceInfo, deviceNode) != XN_STATUS_OK)
+			throw UnableToInitGenerator("Unable to init device.");
+		query.AddNeededNode(deviceInfo.GetInstanceName());
+		deviceQuery = &query;
+	}
+
+	if (imgGen.Create(context, deviceQuery) != XN_STATUS_OK) throw UnableToInitGenerator("Unable to init image generator.");
+	if (depthGen.Create(context, deviceQuery) != XN_STATUS_OK) throw UnableToInitGenerator("Unable to depth generator.");
+	intrinsics = xncv::getIntrinsics(depthGen);
 }
 
 xncv::VideoSource::VideoSource()
@@ -46,6 +72,11 @@ xncv::VideoSource::VideoSource(const std::string& file)
 	init(file);
 }
 
+xncv::VideoSource::VideoSource(int device)
+{
+	init("", device);
+}
+
 bool xncv::VideoSource::fromFile() const
 {
 	return isFile;
@@ -65,18 +96,68 @@ void xncv::VideoSource::stop()
 
 void xncv::VideoSource::update()
 {
-	if (context.WaitAndUpdateAll() != XN_STATUS_OK)
-		throw new GeneratorError("Unable to update data from generators!");
+	{
+		XNCV_PROFILE_SCOPE("VideoSource::update");
+		if (context.WaitAndUpdateAll() != XN_STATUS_OK)
+			throw new GeneratorError("Unable to update data from generators!");
+	}
+
+#if defined(XNCV_ENABLE_PROFILING)
+	//Gaps in the depth frame ids are frames the application was too slow for
+	XnUInt32 frameId = depthGen.GetFrameID();
+	XNCV_PROFILE_COUNT("frames", 1);
+	if (lastFrameId != 0 && frameId > lastFrameId + 1)
+		XNCV_PROFILE_COUNT("frames.dropped", frameId - lastFrameId - 1);
+	lastFrameId = frameId;
+	profileTick();
+#endif
+}
+
+xncv::CaptureMode::CaptureMode(int factor, DepthDecimation decimation, const cv::Rect& region)
+	: depthFactor(factor), depthDecimation(decimation), imageFactor(factor), roi(region)
+{
+}
+
+void xncv::VideoSource::setCaptureMode(const CaptureMode& mode)
+{
+	//Checked here too, so a bad mode fails when set instead of on capture
+	if (mode.depthFactor < 1 || mode.depthFactor > MAX_DECIMATION ||
+		mode.imageFactor < 1 || mode.imageFactor > MAX_DECIMATION)
+		throw Exception("Invalid decimation factor");
+	captureMode = mode;
+}
+
+const xncv::CaptureMode& xncv::VideoSource::getCaptureMode() const
+{
+	return captureMode;
 }
 
 cv::Mat xncv::VideoSource::captureBGR(bool clone) const
 {
-	return clone ? xncv::captureBGR(imgGen).clone() : xncv::captureBGR(imgGen);
+	if (captureMode.imageFactor == 1 && captureMode.roi.area() == 0)
+		return clone ? xncv::captureBGR(imgGen).clone() : xncv::captureBGR(imgGen);
+
+	//Reads the OpenNI buffer once, swapping channels while decimating
+	decimateImage(xncv::captureRGB(imgGen), imageBuffer, captureMode.imageFactor, captureMode.roi, true);
+	return clone ? imageBuffer.clone() : imageBuffer;
 }
 
 cv::Mat xncv::VideoSource::captureDepth(bool clone) const
 {
-	return clone ? xncv::captureDepth(depthGen).clone() : xncv::captureDepth(depthGen);
+	XNCV_PROFILE_SCOPE("VideoSource::captureDepth");
+	if (clone)
+		XNCV_PROFILE_COUNT("buffers.estimated", 1);
+	if (captureMode.depthFactor == 1)
+	{
+		//A roi alone is just a view of the OpenNI buffer
+		cv::Mat depth = xncv::captureDepth(depthGen);
+		if (captureMode.roi.area() > 0)
+			depth = depth(captureRect(depth.size(), 1, captureMode.roi));
+		return clone ? depth.clone() : depth;
+	}
+
+	decimateDepth(xncv::captureDepth(depthGen), depthBuffer, captureMode.depthFactor, captureMode.depthDecimation, captureMode.roi);
+	return clone ? depthBuffer.clone() : depthBuffer;
 }
 
 cv::Mat xncv::VideoSource::calcDepthHist() const
@@ -96,10 +177,25 @@ cv::Point xncv::VideoSource::worldToProjective(const XnPoint3D& point)
 
 XnPoint3D xncv::VideoSource::projectiveToWorld(const cv::Point& point, XnFloat z)
 {
-	if (z < 0.0f) z = captureDepth().ptr<ushort>(point.y)[point.x];
+	if (z < 0.0f) z = xncv::captureDepth(depthGen).ptr<ushort>(point.y)[point.x];
 	return xncv::projectiveToWorld(point, z, depthGen);
 }
 
+const xncv::Intrinsics& xncv::VideoSource::getIntrinsics() const
+{
+	return intrinsics;
+}
+
+xncv::Intrinsics xncv::VideoSource::getCaptureIntrinsics() const
+{
+	return captureIntrinsics(intrinsics, captureMode.depthFactor, captureMode.roi);
+}
+
+xncv::ProfileStats xncv::VideoSource::stats() const
+{
+	return profileStats();
+}
+
 void xncv::VideoSource::seek(XnInt32 frame, XnPlayerSeekOrigin origin)
 {
 	//Command is ignored for the input device.
@@ -17,6 +17,8 @@
 #include <string>
 #include <opencv2\opencv.hpp>
 #include <XnCppWrapper.h>
+#include "functions.hpp"
+#include "profiler.hpp"
 
 
 namespace xncv
@@ -24,6 +26,19 @@ namespace xncv
 	enum DepthCompression {DEPTH_DONT_CAPTURE, DEPTH_NONE, DEPTH_EMB_TABLES_16Z};
 	enum ImageCompression {IMG_DONT_CAPTURE, IMG_NONE, IMG_JPEG};
 
+	//Capture time decimation and region of interest. The roi is given in
+	//sensor coordinates and applied before decimation, so a captured pixel
+	//p maps back to captureRect(size, factor, roi).tl() + factor * p.
+	struct CaptureMode
+	{
+		int depthFactor;
+		DepthDecimation depthDecimation;
+		int imageFactor;
+		cv::Rect roi;
+
+		CaptureMode(int factor=1, DepthDecimation decimation=DECIMATE_NEAREST_VALID, const cv::Rect& region=cv::Rect());
+	};
+
 	class VideoSource
 	{
 		private:
@@ -32,10 +47,15 @@ namespace xncv
 			xn::ImageGenerator imgGen;
 			xn::DepthGenerator depthGen;
 			xn::Recorder* recorder;
+			Intrinsics intrinsics;
+			CaptureMode captureMode;
+			mutable cv::Mat depthBuffer;
+			mutable cv::Mat imageBuffer;
 
 			bool isFile;
+			XnUInt32 lastFrameId;
 
-			void init(const std::string& file);
+			void init(const std::string& file, int device=0);
 			void seek(XnInt32 frame, XnPlayerSeekOrigin origin);
 
 			std::string fixFileName(const std::string fileName);
@@ -43,6 +63,8 @@ namespace xncv
 		public:
 			VideoSource();
 			VideoSource(const std::string& file);
+			//The device-th sensor connected to the computer
+			VideoSource(int device);
 			
 			bool fromFile() const;
 
@@ -60,14 +82,29 @@ namespace xncv
 			int currentFrame() const;
 			int size() const;
 
+			//With a capture mode other than the default, captures that are
+			//not cloned share buffers reused by the next call. Factors
+			//outside 1 to MAX_DECIMATION throw.
+			void setCaptureMode(const CaptureMode& mode);
+			const CaptureMode& getCaptureMode() const;
+
 			cv::Mat captureBGR(bool clone=false) const;
 			cv::Mat captureDepth(bool clone=false) const;
 
 			cv::Mat calcDepthHist() const;
 			cv::Mat calcDepthHist(const cv::Mat& depth) const;
 
+			//Points and intrinsics in full sensor coordinates. Use
+			//getCaptureIntrinsics with the images of captureDepth.
 			cv::Point worldToProjective(const XnPoint3D& point);
-			XnPoint3D projectiveToWorld(const cv::Point& point, XnFloat z=-1.0f);			
+			XnPoint3D projectiveToWorld(const cv::Point& point, XnFloat z=-1.0f);
+			const Intrinsics& getIntrinsics() const;
+			Intrinsics getCaptureIntrinsics() const;
+
+			//Library timers and counters, empty unless xncv was built with
+			//XNCV_ENABLE_PROFILING. They are process wide, the same as
+			//profileStats, so they include every source and thread.
+			ProfileStats stats() const;
 
 			xn::Context& getXnContext() { return context; }
 			xn::Player& getXnPlayer() { return player; }
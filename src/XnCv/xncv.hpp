@@ -20,9 +20,28 @@
 
 //Xncv
 #include "functions.hpp"
+#include "threading.hpp"
+#include "profiler.hpp"
 #include "exceptions.hpp"
 #include "videosource.hpp"
+#include "snapshot.hpp"
 #include "usertracker.hpp"
+#include "jointfilter.hpp"
+#include "skeletonhistory.hpp"
+#include "depthfilter.hpp"
+#include "background.hpp"
+#include "blobs.hpp"
+#include "integral.hpp"
+#include "normals.hpp"
+#include "labels.hpp"
+#include "pointcloud.hpp"
+#include "compositor.hpp"
+#include "skeletoncodec.hpp"
 #include "skeletonio.hpp"
+#include "skeletontools.hpp"
+#include "sessionplayer.hpp"
+#include "pipeline.hpp"
+#include "framesource.hpp"
+#include "multisource.hpp"
 
 #endif
\ No newline at end of file